@@ -0,0 +1,225 @@
+/*****************************************************************************
+ *
+ *                                  aot.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our ahead-of-time runtime
+ *     module. It starts a translated program and hands execution between
+ *     its compiled code and the interpreter in the operations module. The
+ *     registers and program counter are passed through the operations
+ *     struct, so the interpreter continues exactly where compiled code
+ *     stopped. This module is exported to programs written by um2c.
+ *
+ *
+ ****************************************************************************/
+
+#include "aot.h"
+#include "instruction_packing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define num_registers 8
+
+/* the opcodes Aot_resume has to look out for */
+#define SSTORE 2
+#define LOADP 12
+#define INVALID 14
+
+/* private helper functions, details can be viewed below */
+static void     save_registers(Operations_T op, const uint32_t *registers);
+static uint32_t mark_stale    (Aot_program *program, uint32_t index,
+                               uint32_t value);
+
+
+/* FUNCTION:    Aot_main
+ * Purpose:     the main function of a translated program
+ * Arg:         argc, argv: the program's arguments, of which there must be
+ *                          none
+ *              program: the translation, whose image is loaded
+ *              run: the translated code
+ * Returns:     the program's exit status
+ * Effect:      Loads the image into a new machine, runs it and reports a
+ *              machine failure the same way the um executable does
+ * Exported to: Programs written by um2c
+ * Error:       Exits with a usage message if arguments are given
+ */
+int Aot_main(int argc, char *argv[], const Aot_program *program,
+             Um_result (*run)(Operations_T op))
+{
+        assert(program != NULL && run != NULL);
+
+        if (argc != 1) {
+                fprintf(stderr, "Incorrect number of arguments provided\n");
+                fprintf(stderr, "Usage: %s\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+
+        Operations_T op = Operations_new();
+        read_in_words(program->image, program->num_words, op);
+
+        Um_result result = run(op);
+        if (result.status == UM_FAULT) {
+                fprintf(stderr, "UM failure at instruction %u: %s\n",
+                        Operations_pc(op), Operations_fault(op));
+                Operations_free(&op);
+                return EXIT_FAILURE;
+        }
+
+        Operations_free(&op);
+        return EXIT_SUCCESS;
+}
+
+
+/* FUNCTION:    Aot_interpret
+ * Purpose:     finish the program in the interpreter
+ * Arg:         op: the machine
+ *              registers: the UM registers from compiled code
+ *              pc: the instruction to continue at
+ * Returns:     the result of Operations_run
+ * Effect:      N/A
+ * Exported to: Programs written by um2c
+ * Error:       N/A
+ */
+Um_result Aot_interpret(Operations_T op, const uint32_t *registers,
+                        uint32_t pc)
+{
+        assert(op != NULL && registers != NULL);
+
+        save_registers(op, registers);
+        Operations_set_pc(op, pc);
+
+        return Operations_run(op, 0);
+}
+
+
+/* FUNCTION:    Aot_resume
+ * Purpose:     run the interpreter until compiled code can take over again
+ * Arg:         op: the machine
+ *              program: the translation
+ *              registers: the UM registers, updated in place
+ *              pc: the instruction to continue at, updated in place
+ * Returns:     a result with status UM_BUDGET when *pc starts a block that
+ *              is not stale, or the result of a program that stopped in the
+ *              interpreter
+ * Effect:      Executes one instruction at a time, marking the blocks its
+ *              stores change as stale. Loading a program from another
+ *              segment makes the interpreter run the rest of the program
+ * Exported to: Programs written by um2c
+ * Error:       N/A
+ */
+Um_result Aot_resume(Operations_T op, Aot_program *program,
+                     uint32_t *registers, uint32_t *pc)
+{
+        assert(op != NULL && program != NULL);
+        assert(registers != NULL && pc != NULL);
+
+        Memory_T memory = Operations_memory(op);
+        uint32_t *saved = Operations_registers(op);
+        Um_result result = { UM_BUDGET, 0 };
+
+        save_registers(op, registers);
+        Operations_set_pc(op, *pc);
+
+        while (*pc >= program->num_words || program->labels[*pc] == NULL) {
+                Um_decoded ins = { INVALID, 0, 0, 0, 0 };
+                if (*pc < segment_length(0, memory)) {
+                        ins = decode_instruction(load_word(0, *pc, memory));
+                }
+
+                /* the translation is of no use with a new segment 0 */
+                if (ins.opcode == LOADP && saved[ins.b] != 0) {
+                        return Operations_run(op, 0);
+                }
+                uint32_t index = saved[ins.b];
+                uint32_t value = saved[ins.c];
+
+                result = Operations_run(op, 1);
+                if (result.status != UM_BUDGET) {
+                        return result;
+                }
+                if (ins.opcode == SSTORE && saved[ins.a] == 0) {
+                        mark_stale(program, index, value);
+                }
+                *pc = Operations_pc(op);
+        }
+
+        for (int i = 0; i < num_registers; i++) {
+                registers[i] = saved[i];
+        }
+        return result;
+}
+
+
+/* FUNCTION:    Aot_store
+ * Purpose:     store a word in segment 0 for compiled code
+ * Arg:         op: the machine
+ *              program: the translation
+ *              index: the index of the word in segment 0
+ *              value: the word to store
+ * Returns:     the start of the block the store made stale, or AOT_NONE
+ * Effect:      Stores the word through the operations module, so the
+ *              interpreter sees it too
+ * Exported to: Programs written by um2c
+ * Error:       N/A
+ */
+uint32_t Aot_store(Operations_T op, Aot_program *program, uint32_t index,
+                   uint32_t value)
+{
+        Operations_store(op, 0, index, value);
+
+        return mark_stale(program, index, value);
+}
+
+
+/* FUNCTION:    save_registers
+ * Purpose:     give the interpreter the registers of compiled code
+ * Arg:         op: the machine
+ *              registers: the UM registers
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void save_registers(Operations_T op, const uint32_t *registers)
+{
+        uint32_t *saved = Operations_registers(op);
+        for (int i = 0; i < num_registers; i++) {
+                saved[i] = registers[i];
+        }
+}
+
+
+/* FUNCTION:    mark_stale
+ * Purpose:     make the block holding a word stale if the word changed
+ * Arg:         program: the translation
+ *              index: the index of the stored word in segment 0
+ *              value: the word stored
+ * Returns:     the start of the block made stale, or AOT_NONE if the word
+ *              was not translated or still holds what was translated
+ * Effect:      Clears the block's label. The block a translated word belongs
+ *              to starts at the nearest block start at or before it, since
+ *              control only enters a block at its start
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static uint32_t mark_stale(Aot_program *program, uint32_t index,
+                           uint32_t value)
+{
+        if (index >= program->num_words || 
+            !((program->code[index >> 5] >> (index & 31)) & 1) ||
+            value == program->image[index]) {
+                return AOT_NONE;
+        }
+
+        uint32_t start = index;
+        while (!((program->leaders[start >> 5] >> (start & 31)) & 1)) {
+                start--;
+        }
+        program->labels[start] = NULL;
+
+        return start;
+}
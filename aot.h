@@ -0,0 +1,270 @@
+/*****************************************************************************
+ *
+ *                                  aot.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our ahead-of-time runtime module. The
+ *     C files written by um2c include this header and are linked with it and
+ *     the other UM modules. A translated program is one function with a
+ *     label at the start of every basic block, and one of the macros below
+ *     per instruction. The macros use these locals of the translated
+ *     function:
+ *
+ *        r0 - r7: the UM registers
+ *        op, mem, table, io: the machine, its memory, its segment table
+ *                            and its I/O device
+ *        pc: where to continue when leaving compiled code
+ *        labels: the address of the label for each block start, or NULL
+ *
+ *     and these globals of the translated file:
+ *
+ *        aot_program: the Aot_program describing the translation
+ *        aot_image, AOT_NUM_WORDS: the program as it was translated
+ *
+ *     A store that changes a translated word makes its block stale by
+ *     clearing the block's label, and every block checks its label when it
+ *     is entered. Anything compiled code does not handle itself goes to the
+ *     label resume, which single-steps the interpreter until it reaches a
+ *     block that is not stale, or to interpret, which runs the rest of the
+ *     program in the interpreter: machine failures, HALT and loading a
+ *     program from another segment. This module is exported to programs
+ *     written by um2c.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_AOT_INCLUDED
+#define UM_AOT_INCLUDED
+
+#include <stdint.h>
+#include "operations.h"
+#include "memory.h"
+#include "io.h"
+
+/* 
+ * what a translated program knows about its translation:
+ *      image: the program as it was translated
+ *      code: bit i is set if word i was translated
+ *      leaders: bit i is set if word i starts a block
+ *      labels: the translated function's label table, in which the label of
+ *              a stale block is NULL
+ *      num_words: the number of words in image
+ */
+typedef struct Aot_program {
+        const uint32_t *image;
+        const uint32_t *code;
+        const uint32_t *leaders;
+        void **labels;
+        uint32_t num_words;
+} Aot_program;
+
+/* returned by Aot_store when no translated word changed */
+#define AOT_NONE UINT32_MAX
+
+/* FUNCTION:    Aot_main
+ * Purpose:     the main function of a translated program
+ * Arg:         argc, argv: the program's arguments, of which there must be
+ *                          none
+ *              program: the translation, whose image is loaded
+ *              run: the translated code
+ * Returns:     the program's exit status
+ * Effect:      Loads the image into a new machine, runs it and reports a
+ *              machine failure the same way the um executable does
+ * Exported to: Programs written by um2c
+ * Error:       Exits with a usage message if arguments are given
+ */
+int Aot_main(int argc, char *argv[], const Aot_program *program,
+             Um_result (*run)(Operations_T op));
+
+
+/* FUNCTION:    Aot_interpret
+ * Purpose:     finish the program in the interpreter
+ * Arg:         op: the machine
+ *              registers: the UM registers from compiled code
+ *              pc: the instruction to continue at
+ * Returns:     the result of Operations_run
+ * Effect:      N/A
+ * Exported to: Programs written by um2c
+ * Error:       N/A
+ */
+Um_result Aot_interpret(Operations_T op, const uint32_t *registers,
+                        uint32_t pc);
+
+
+/* FUNCTION:    Aot_resume
+ * Purpose:     run the interpreter until compiled code can take over again
+ * Arg:         op: the machine
+ *              program: the translation
+ *              registers: the UM registers, updated in place
+ *              pc: the instruction to continue at, updated in place
+ * Returns:     a result with status UM_BUDGET when *pc starts a block that
+ *              is not stale, or the result of a program that stopped in the
+ *              interpreter
+ * Effect:      Executes one instruction at a time, marking the blocks its
+ *              stores change as stale. Loading a program from another
+ *              segment makes the interpreter run the rest of the program
+ * Exported to: Programs written by um2c
+ * Error:       N/A
+ */
+Um_result Aot_resume(Operations_T op, Aot_program *program,
+                     uint32_t *registers, uint32_t *pc);
+
+
+/* FUNCTION:    Aot_store
+ * Purpose:     store a word in segment 0 for compiled code
+ * Arg:         op: the machine
+ *              program: the translation
+ *              index: the index of the word in segment 0
+ *              value: the word to store
+ * Returns:     the start of the block the store made stale, or AOT_NONE
+ * Effect:      Stores the word through the operations module, so the
+ *              interpreter sees it too
+ * Exported to: Programs written by um2c
+ * Error:       N/A
+ */
+uint32_t Aot_store(Operations_T op, Aot_program *program, uint32_t index,
+                   uint32_t value);
+
+
+/* the address of a label, and a jump to one, accepted by -pedantic */
+#define AOT_LABEL(name) (__extension__ &&name)
+#define AOT_GOTO(target) __extension__ ({ goto *(target); })
+
+/* leave compiled code at the instruction at */
+#define AOT_LEAVE(at)                                                   \
+        do {                                                            \
+                pc = (at);                                              \
+                goto interpret;                                         \
+        } while (0)
+
+#define AOT_CMOV(a, b, c)                                               \
+        do {                                                            \
+                if (r##c != 0) {                                        \
+                        r##a = r##b;                                    \
+                }                                                       \
+        } while (0)
+
+#define AOT_SLOAD(a, b, c) r##a = (*table)[r##b].words[r##c]
+
+/* the start of every block: a stale block is left to the interpreter */
+#define AOT_BLOCK(at)                                                   \
+        do {                                                            \
+                if (labels[at] == NULL) {                               \
+                        pc = (at);                                      \
+                        goto resume;                                    \
+                }                                                       \
+        } while (0)
+
+/* a store that makes the running block stale ends it */
+#define AOT_SSTORE(at, block, a, b, c)                                  \
+        do {                                                            \
+                if (r##a == 0) {                                        \
+                        if (Aot_store(op, &aot_program, r##b, r##c) ==  \
+                            (block)) {                                  \
+                                pc = (at) + 1;                          \
+                                goto resume;                            \
+                        }                                               \
+                } else if ((*table)[r##a].shared) {                     \
+                        store_word(r##a, r##b, r##c, mem);              \
+                } else {                                                \
+                        (*table)[r##a].words[r##b] = r##c;              \
+                }                                                       \
+        } while (0)
+
+#define AOT_ADD(a, b, c) r##a = r##b + r##c
+#define AOT_MUL(a, b, c) r##a = r##b * r##c
+#define AOT_NAND(a, b, c) r##a = ~(r##b & r##c)
+
+#define AOT_DIV(at, a, b, c)                                            \
+        do {                                                            \
+                if (r##c == 0) {                                        \
+                        AOT_LEAVE(at);                                  \
+                }                                                       \
+                r##a = r##b / r##c;                                     \
+        } while (0)
+
+#define AOT_MAP(b, c) r##b = new_segment(r##c, mem)
+
+#define AOT_UNMAP(at, c)                                                \
+        do {                                                            \
+                if (r##c == 0 || !segment_mapped(r##c, mem)) {          \
+                        AOT_LEAVE(at);                                  \
+                }                                                       \
+                remove_segment(r##c, mem);                              \
+        } while (0)
+
+#define AOT_OUT(at, c)                                                  \
+        do {                                                            \
+                if (r##c > 255) {                                       \
+                        AOT_LEAVE(at);                                  \
+                }                                                       \
+                Io_put(io, r##c);                                       \
+        } while (0)
+
+#define AOT_IN(c)                                                       \
+        do {                                                            \
+                int value_ = Io_get(io);                                \
+                r##c = (value_ == -1) ? ~0u : (uint32_t)value_;         \
+        } while (0)
+
+/* a jump within segment 0 goes straight to its label if it has one */
+#define AOT_LOADP(at, b, c)                                             \
+        do {                                                            \
+                if (r##b != 0 || r##c >= AOT_NUM_WORDS) {               \
+                        AOT_LEAVE(at);                                  \
+                }                                                       \
+                if (labels[r##c] == NULL) {                             \
+                        pc = r##c;                                      \
+                        goto resume;                                    \
+                }                                                       \
+                AOT_GOTO(labels[r##c]);                                 \
+        } while (0)
+
+#define AOT_LV(a, value) r##a = (value)
+
+/* HALT and opcodes 14 and 15 are left to the interpreter */
+#define AOT_HALT(at) AOT_LEAVE(at)
+#define AOT_INVALID(at) AOT_LEAVE(at)
+
+/* the locals of a translated function, and its two ways out */
+#define AOT_ENTER                                                       \
+        Memory_T mem = Operations_memory(op);                           \
+        Segment **table = segment_table(mem);                           \
+        Io_T io = Operations_io(op);                                    \
+        uint32_t pc = Operations_pc(op);                                \
+        uint32_t *spill = Operations_registers(op);                     \
+        uint32_t r0 = spill[0], r1 = spill[1], r2 = spill[2];           \
+        uint32_t r3 = spill[3], r4 = spill[4], r5 = spill[5];           \
+        uint32_t r6 = spill[6], r7 = spill[7];                          \
+        Um_result result;                                               \
+        (void)io;                                                       \
+        (void)table;                                                    \
+        aot_program.labels = labels;                                    \
+        goto resume;                                                    \
+interpret:                                                              \
+        AOT_SPILL();                                                    \
+        return Aot_interpret(op, spill, pc);                            \
+resume:                                                                 \
+        AOT_SPILL();                                                    \
+        result = Aot_resume(op, &aot_program, spill, &pc);              \
+        if (result.status != UM_BUDGET) {                               \
+                return result;                                          \
+        }                                                               \
+        r0 = spill[0]; r1 = spill[1]; r2 = spill[2]; r3 = spill[3];     \
+        r4 = spill[4]; r5 = spill[5]; r6 = spill[6]; r7 = spill[7];     \
+        if (pc >= AOT_NUM_WORDS) {                                      \
+                goto interpret;                                         \
+        }                                                               \
+        AOT_GOTO(labels[pc])
+
+#define AOT_SPILL()                                                     \
+        do {                                                            \
+                spill[0] = r0; spill[1] = r1; spill[2] = r2;            \
+                spill[3] = r3; spill[4] = r4; spill[5] = r5;            \
+                spill[6] = r6; spill[7] = r7;                           \
+        } while (0)
+
+#endif
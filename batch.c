@@ -0,0 +1,492 @@
+/*****************************************************************************
+ *
+ *                                  batch.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our batch module. Each thread
+ *     owns a queue of jobs, kept as a ring with its own lock. The owner
+ *     takes jobs from the front and puts a job that used up its slice at
+ *     the back, so the jobs of one thread take turns; a thread with an
+ *     empty queue steals from the back of the other queues, which moves
+ *     long jobs to idle threads. A job's machine is made by the first
+ *     thread to run it and freed by the thread that sees it stop, and no
+ *     two threads ever hold the same job, so the machines need no locking
+ *     of their own. This module is exported to our batch runner, umbatch.
+ *
+ *
+ ****************************************************************************/
+
+#include "batch.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* the number of jobs a batch has room for before it first grows */
+#define initial_jobs 16
+
+/*
+ * one job:
+ *      program: the pathname of its program
+ *      input, input_length: its input, until its machine is made
+ *      op: its machine while it runs, NULL before and after
+ *      status, fault: how it ended, the fault being a copy the job owns
+ *      steps: the instructions it has executed
+ *      output, output_length: what it wrote, once it has stopped
+ */
+typedef struct Job {
+        const char *program;
+        unsigned char *input;
+        size_t input_length;
+        Operations_T op;
+        Um_status status;
+        char *fault;
+        uint64_t steps;
+        unsigned char *output;
+        size_t output_length;
+} Job;
+
+/*
+ * a thread's queue of jobs, a ring with room for every job of the batch:
+ *      lock: held while the queue is read or changed
+ *      jobs: the ring
+ *      front: the index in the ring of the first job
+ *      count: the number of jobs in the queue
+ */
+typedef struct Queue {
+        pthread_mutex_t lock;
+        Job **jobs;
+        unsigned front;
+        unsigned count;
+} Queue;
+
+/*
+ * struct definition for our Batch struct which holds:
+ *      num_threads, slice, jit: how the batch runs, see Batch_new
+ *      jobs, num_jobs, capacity: the jobs, in the order they were added
+ *      queues: one queue per thread, while the batch runs
+ *      remaining: the jobs that have not stopped, changed atomically
+ *      ran: whether Batch_run has been called
+ */
+struct Batch_T {
+        unsigned num_threads;
+        uint64_t slice;
+        bool jit;
+        Job *jobs;
+        unsigned num_jobs;
+        unsigned capacity;
+        Queue *queues;
+        unsigned remaining;
+        bool ran;
+};
+
+/* what each thread is started with */
+typedef struct Worker {
+        Batch_T batch;
+        unsigned index;
+} Worker;
+
+/* private helper functions, details can be viewed below */
+static void *work     (void *worker);
+static bool  run_slice(Batch_T batch, Job *job);
+static void  finish   (Job *job, Um_status status, const char *fault);
+static Job  *take     (Queue *queue, unsigned capacity, bool front);
+static void  put_back (Queue *queue, unsigned capacity, Job *job);
+
+
+/* FUNCTION:    Batch_new
+ * Purpose:     create an empty batch
+ * Arg:         num_threads: the threads to run jobs on, at least 1
+ *              slice: the instructions a job runs before it yields, at
+ *                     least 1
+ *              jit: whether jobs run with Operations_run_jit instead of
+ *                   Operations_run
+ * Returns:     a new Batch_T
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if num_threads or slice is 0, or for
+ *              unsuccessful memory allocation
+ */
+Batch_T Batch_new(unsigned num_threads, uint64_t slice, bool jit)
+{
+        assert(num_threads > 0 && slice > 0);
+
+        Batch_T batch = malloc(sizeof(*batch));
+        assert(batch != NULL);
+
+        batch->num_threads = num_threads;
+        batch->slice = slice;
+        batch->jit = jit;
+        batch->jobs = malloc(initial_jobs * sizeof(*batch->jobs));
+        assert(batch->jobs != NULL);
+        batch->num_jobs = 0;
+        batch->capacity = initial_jobs;
+        batch->queues = NULL;
+        batch->remaining = 0;
+        batch->ran = false;
+
+        return batch;
+}
+
+
+/* FUNCTION:    Batch_free
+ * Purpose:     free a batch and the results of its jobs
+ * Arg:         batch: a pointer to a Batch_T
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Batch_free(Batch_T *batch)
+{
+        assert(batch != NULL && *batch != NULL);
+
+        for (unsigned i = 0; i < (*batch)->num_jobs; i++) {
+                Job *job = &(*batch)->jobs[i];
+                free(job->input);
+                free(job->output);
+                free(job->fault);
+                if (job->op != NULL) {
+                        Operations_free(&job->op);
+                }
+        }
+        free((*batch)->jobs);
+        free(*batch);
+        *batch = NULL;
+}
+
+
+/* FUNCTION:    Batch_add
+ * Purpose:     add a job to a batch that has not run yet
+ * Arg:         batch: the batch
+ *              program: the pathname of the .um program, which must stay
+ *                       valid until the batch has run
+ *              input: the bytes the program reads, may be NULL if length
+ *                     is 0. They are copied
+ *              length: the number of input bytes
+ * Returns:     the job's number, counting from 0 in the order added
+ * Effect:      The program is loaded by the thread that first runs the job
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch or program is NULL, if the
+ *              batch has run, or for unsuccessful memory allocation
+ */
+unsigned Batch_add(Batch_T batch, const char *program,
+                   const unsigned char *input, size_t length)
+{
+        assert(batch != NULL && program != NULL);
+        assert(input != NULL || length == 0);
+        assert(!batch->ran);
+
+        if (batch->num_jobs == batch->capacity) {
+                batch->capacity *= 2;
+                batch->jobs = realloc(batch->jobs, batch->capacity *
+                                                   sizeof(*batch->jobs));
+                assert(batch->jobs != NULL);
+        }
+
+        Job *job = &batch->jobs[batch->num_jobs];
+        memset(job, 0, sizeof(*job));
+        job->program = program;
+        job->input = malloc(length + 1);
+        assert(job->input != NULL);
+        if (length > 0) {
+                memcpy(job->input, input, length);
+        }
+        job->input_length = length;
+        job->status = UM_BUDGET;
+
+        return batch->num_jobs++;
+}
+
+
+/* FUNCTION:    Batch_run
+ * Purpose:     run every job in a batch to the end
+ * Arg:         batch: the batch
+ * Returns:     N/A
+ * Effect:      Deals the jobs out to the queues in turn, then runs the
+ *              threads until every job has stopped
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch is NULL, if it has already
+ *              run, or if a thread cannot be started
+ */
+void Batch_run(Batch_T batch)
+{
+        assert(batch != NULL);
+        assert(!batch->ran);
+        batch->ran = true;
+
+        unsigned num_threads = batch->num_threads;
+        unsigned capacity = batch->num_jobs + 1;
+
+        batch->queues = malloc(num_threads * sizeof(*batch->queues));
+        assert(batch->queues != NULL);
+        for (unsigned t = 0; t < num_threads; t++) {
+                Queue *queue = &batch->queues[t];
+                pthread_mutex_init(&queue->lock, NULL);
+                queue->jobs = malloc(capacity * sizeof(*queue->jobs));
+                assert(queue->jobs != NULL);
+                queue->front = 0;
+                queue->count = 0;
+        }
+        for (unsigned i = 0; i < batch->num_jobs; i++) {
+                put_back(&batch->queues[i % num_threads], capacity,
+                         &batch->jobs[i]);
+        }
+        batch->remaining = batch->num_jobs;
+
+        pthread_t *threads = malloc(num_threads * sizeof(*threads));
+        Worker *workers = malloc(num_threads * sizeof(*workers));
+        assert(threads != NULL && workers != NULL);
+        for (unsigned t = 0; t < num_threads; t++) {
+                workers[t] = (Worker){ batch, t };
+                int failed = pthread_create(&threads[t], NULL, work,
+                                            &workers[t]);
+                assert(failed == 0);
+        }
+        for (unsigned t = 0; t < num_threads; t++) {
+                pthread_join(threads[t], NULL);
+        }
+        free(threads);
+        free(workers);
+
+        for (unsigned t = 0; t < num_threads; t++) {
+                pthread_mutex_destroy(&batch->queues[t].lock);
+                free(batch->queues[t].jobs);
+        }
+        free(batch->queues);
+        batch->queues = NULL;
+}
+
+
+/* FUNCTION:    Batch_status
+ * Purpose:     get how a job ended
+ * Arg:         batch: a batch that has run
+ *              job: the job's number
+ *              fault: set to why the job failed, or NULL, unless NULL.
+ *                     A program that cannot be loaded fails
+ * Returns:     UM_HALTED or UM_FAULT
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch is NULL or job is not a job
+ */
+Um_status Batch_status(Batch_T batch, unsigned job, const char **fault)
+{
+        assert(batch != NULL && job < batch->num_jobs);
+
+        if (fault != NULL) {
+                *fault = batch->jobs[job].fault;
+        }
+        return batch->jobs[job].status;
+}
+
+
+/* FUNCTION:    Batch_output
+ * Purpose:     get what a job wrote
+ * Arg:         batch: a batch that has run
+ *              job: the job's number
+ *              length: set to the number of output bytes
+ * Returns:     the output, owned by the batch
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch is NULL or job is not a job
+ */
+const unsigned char *Batch_output(Batch_T batch, unsigned job,
+                                  size_t *length)
+{
+        assert(batch != NULL && job < batch->num_jobs && length != NULL);
+
+        *length = batch->jobs[job].output_length;
+        return batch->jobs[job].output;
+}
+
+
+/* FUNCTION:    Batch_steps
+ * Purpose:     get how many instructions a job executed
+ * Arg:         batch: a batch that has run
+ *              job: the job's number
+ * Returns:     the instruction count
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch is NULL or job is not a job
+ */
+uint64_t Batch_steps(Batch_T batch, unsigned job)
+{
+        assert(batch != NULL && job < batch->num_jobs);
+
+        return batch->jobs[job].steps;
+}
+
+
+/* FUNCTION:    work
+ * Purpose:     the body of each thread
+ * Arg:         worker: the thread's Worker
+ * Returns:     NULL
+ * Effect:      Runs a slice of the job at the front of its own queue, or
+ *              of a job stolen from the back of another queue, until no
+ *              job is left. A thread that finds nothing to run while jobs
+ *              are still running elsewhere yields the processor and looks
+ *              again, since a job that is put back can be stolen
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void *work(void *worker)
+{
+        Batch_T batch = ((Worker *)worker)->batch;
+        unsigned self = ((Worker *)worker)->index;
+        unsigned capacity = batch->num_jobs + 1;
+        Queue *own = &batch->queues[self];
+
+        for (;;) {
+                Job *job = take(own, capacity, true);
+                for (unsigned k = 1; job == NULL && k < batch->num_threads;
+                     k++) {
+                        unsigned victim = (self + k) % batch->num_threads;
+                        job = take(&batch->queues[victim], capacity, false);
+                }
+
+                if (job == NULL) {
+                        if (__atomic_load_n(&batch->remaining,
+                                            __ATOMIC_ACQUIRE) == 0) {
+                                return NULL;
+                        }
+                        sched_yield();
+                } else if (run_slice(batch, job)) {
+                        put_back(own, capacity, job);
+                } else {
+                        __atomic_sub_fetch(&batch->remaining, 1,
+                                           __ATOMIC_ACQ_REL);
+                }
+        }
+}
+
+
+/* FUNCTION:    run_slice
+ * Purpose:     run a job for one slice
+ * Arg:         batch: the batch
+ *              job: the job, held by the calling thread
+ * Returns:     true if the job used up its slice and has more to run
+ * Effect:      Makes the job's machine on its first slice, with a memory
+ *              device for its I/O, and frees it once the job stops
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static bool run_slice(Batch_T batch, Job *job)
+{
+        if (job->op == NULL) {
+                job->op = Operations_new();
+                Operations_set_io(job->op, Io_new_memory(job->input,
+                                                         job->input_length));
+                free(job->input);
+                job->input = NULL;
+
+                if (read_in_file(job->program, job->op) < 0) {
+                        finish(job, UM_FAULT, "program cannot be read");
+                        return false;
+                }
+        }
+
+        Um_result result = batch->jit ?
+                           Operations_run_jit(job->op, batch->slice) :
+                           Operations_run(job->op, batch->slice);
+        job->steps += result.steps;
+        if (result.status == UM_BUDGET) {
+                return true;
+        }
+
+        finish(job, result.status, (result.status == UM_FAULT) ?
+                                   Operations_fault(job->op) : NULL);
+        return false;
+}
+
+
+/* FUNCTION:    finish
+ * Purpose:     record how a job stopped and free its machine
+ * Arg:         job: the job, whose machine exists
+ *              status: UM_HALTED or UM_FAULT
+ *              fault: why it failed, or NULL
+ * Returns:     N/A
+ * Effect:      Copies the output and the fault out of the machine first,
+ *              since a fault can be built in the machine itself
+ * Exported to: N/A
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+static void finish(Job *job, Um_status status, const char *fault)
+{
+        size_t length;
+        Io_T io = Operations_io(job->op);
+        Io_flush(io);
+        const unsigned char *output = Io_output(io, &length);
+
+        job->output = malloc(length + 1);
+        assert(job->output != NULL);
+        if (length > 0) {
+                memcpy(job->output, output, length);
+        }
+        job->output_length = length;
+        job->status = status;
+        if (fault != NULL) {
+                job->fault = malloc(strlen(fault) + 1);
+                assert(job->fault != NULL);
+                strcpy(job->fault, fault);
+        }
+
+        Operations_free(&job->op);
+}
+
+
+/* FUNCTION:    take
+ * Purpose:     take a job out of a queue
+ * Arg:         queue: the queue
+ *              capacity: the size of its ring
+ *              front: true to take from the front, as the owner does, or
+ *                     false to take from the back, as a thief does
+ * Returns:     the job, or NULL if the queue is empty
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static Job *take(Queue *queue, unsigned capacity, bool front)
+{
+        Job *job = NULL;
+
+        pthread_mutex_lock(&queue->lock);
+        if (queue->count > 0) {
+                if (front) {
+                        job = queue->jobs[queue->front];
+                        queue->front = (queue->front + 1) % capacity;
+                } else {
+                        job = queue->jobs[(queue->front + queue->count - 1)
+                                          % capacity];
+                }
+                queue->count--;
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        return job;
+}
+
+
+/* FUNCTION:    put_back
+ * Purpose:     put a job at the back of a queue
+ * Arg:         queue: the queue
+ *              capacity: the size of its ring, more than the jobs in the
+ *                        batch, so it never fills
+ *              job: the job
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void put_back(Queue *queue, unsigned capacity, Job *job)
+{
+        pthread_mutex_lock(&queue->lock);
+        queue->jobs[(queue->front + queue->count) % capacity] = job;
+        queue->count++;
+        pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,132 @@
+/*****************************************************************************
+ *
+ *                                  batch.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our batch module. This module runs
+ *     many independent UM jobs in one process, each with its own machine
+ *     and its own in-memory input and output, on a pool of threads. Every
+ *     thread has a queue of jobs; a job runs for a step budget and then
+ *     goes to the back of its queue so a long job cannot starve short ones,
+ *     and a thread whose queue is empty steals the job at the back of
+ *     another thread's queue. The operations and memory modules keep all
+ *     of their state in the structs they hand out, so machines on
+ *     different threads never share anything. This module is exported to
+ *     our batch runner, umbatch.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_BATCH_INCLUDED
+#define UM_BATCH_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "operations.h"
+
+typedef struct Batch_T *Batch_T;
+
+/* FUNCTION:    Batch_new
+ * Purpose:     create an empty batch
+ * Arg:         num_threads: the threads to run jobs on, at least 1
+ *              slice: the instructions a job runs before it yields, at
+ *                     least 1
+ *              jit: whether jobs run with Operations_run_jit instead of
+ *                   Operations_run
+ * Returns:     a new Batch_T
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if num_threads or slice is 0, or for
+ *              unsuccessful memory allocation
+ */
+Batch_T Batch_new(unsigned num_threads, uint64_t slice, bool jit);
+
+
+/* FUNCTION:    Batch_free
+ * Purpose:     free a batch and the results of its jobs
+ * Arg:         batch: a pointer to a Batch_T
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Batch_free(Batch_T *batch);
+
+
+/* FUNCTION:    Batch_add
+ * Purpose:     add a job to a batch that has not run yet
+ * Arg:         batch: the batch
+ *              program: the pathname of the .um program, which must stay
+ *                       valid until the batch has run
+ *              input: the bytes the program reads, may be NULL if length
+ *                     is 0. They are copied
+ *              length: the number of input bytes
+ * Returns:     the job's number, counting from 0 in the order added
+ * Effect:      The program is loaded by the thread that first runs the job
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch or program is NULL, if the
+ *              batch has run, or for unsuccessful memory allocation
+ */
+unsigned Batch_add(Batch_T batch, const char *program,
+                   const unsigned char *input, size_t length);
+
+
+/* FUNCTION:    Batch_run
+ * Purpose:     run every job in a batch to the end
+ * Arg:         batch: the batch
+ * Returns:     N/A
+ * Effect:      Starts the threads, waits until every job has halted or
+ *              failed, and keeps each job's status, output and instruction
+ *              count. A job's machine is freed as soon as it stops
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch is NULL, if it has already
+ *              run, or if a thread cannot be started
+ */
+void Batch_run(Batch_T batch);
+
+
+/* FUNCTION:    Batch_status
+ * Purpose:     get how a job ended
+ * Arg:         batch: a batch that has run
+ *              job: the job's number
+ *              fault: set to why the job failed, or NULL, unless NULL.
+ *                     A program that cannot be loaded fails
+ * Returns:     UM_HALTED or UM_FAULT
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch is NULL or job is not a job
+ */
+Um_status Batch_status(Batch_T batch, unsigned job, const char **fault);
+
+
+/* FUNCTION:    Batch_output
+ * Purpose:     get what a job wrote
+ * Arg:         batch: a batch that has run
+ *              job: the job's number
+ *              length: set to the number of output bytes
+ * Returns:     the output, owned by the batch
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch is NULL or job is not a job
+ */
+const unsigned char *Batch_output(Batch_T batch, unsigned job,
+                                  size_t *length);
+
+
+/* FUNCTION:    Batch_steps
+ * Purpose:     get how many instructions a job executed
+ * Arg:         batch: a batch that has run
+ *              job: the job's number
+ * Returns:     the instruction count
+ * Effect:      N/A
+ * Exported to: Our batch runner
+ * Error:       Checked runtime error if batch is NULL or job is not a job
+ */
+uint64_t Batch_steps(Batch_T batch, unsigned job);
+
+#endif
@@ -0,0 +1,358 @@
+/*****************************************************************************
+ *
+ *                                  cache.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our code cache module. An
+ *     entry is a header of six 64-bit words followed by the decoded
+ *     entries, exactly as they sit in memory, and then the image itself,
+ *     so a hit is one mmap, a compare of the image, a hash of the mapped
+ *     entries and a copy. The header holds a magic word with a format
+ *     version, the size of a decoded entry, the image's length, the two
+ *     halves of its hash and the hash of the entries. The hash is two
+ *     independent multiply-and-rotate lanes over the words, which is fast
+ *     and spreads every bit but is not meant to stand up to someone
+ *     choosing images to collide, so it only names the entry: the image
+ *     stored in it has to match segment 0 word for word. Each store copies what it writes and
+ *     runs in its own thread; a cache starts at most max_stores of them,
+ *     so a program that keeps loading new code into segment 0 does not
+ *     fill the directory.
+ *
+ *
+ ****************************************************************************/
+
+#include "cache.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* the first word of an entry, "UMc" and the format version */
+#define cache_magic 0x554d630000000002ULL
+
+/* the 64-bit words before the decoded entries */
+#define header_words 6
+
+/* the most entries one cache writes */
+#define max_stores 64
+
+/* a hexadecimal hash, the suffix, and the temporary file suffix */
+#define max_name 128
+
+/*
+ * struct definition for our Cache struct which holds:
+ *      dir: the directory's pathname
+ *      writers: the threads started by Cache_store
+ *      num_writers: the number of them
+ */
+struct Cache_T {
+        char *dir;
+        pthread_t writers[max_stores];
+        unsigned num_writers;
+};
+
+/*
+ * what a writer thread is given, all owned by it:
+ *      path: the entry's pathname
+ *      temp: the temporary file's pathname
+ *      header: the entry's header
+ *      program: a copy of the decoded entries
+ *      words: a copy of the image they were decoded from
+ *      length: the number of entries, and of words
+ */
+typedef struct Store {
+        char *path;
+        char *temp;
+        uint64_t header[header_words];
+        Um_decoded *program;
+        uint32_t *words;
+        uint32_t length;
+} Store;
+
+/* private helper functions, details can be viewed below */
+static void  hash_words (const uint32_t *words, size_t num_words,
+                         uint64_t key[2]);
+static char *entry_path (Cache_T cache, const uint64_t key[2],
+                         const char *suffix);
+static void *write_entry(void *store);
+
+
+/* FUNCTION:    Cache_new
+ * Purpose:     use a directory as a code cache
+ * Arg:         dir: the directory's pathname, which must exist. It is
+ *                   copied
+ * Returns:     a new Cache_T
+ * Effect:      N/A
+ * Exported to: Operation module: used when a cache directory is set
+ * Error:       Checked runtime error if dir is NULL, or for unsuccessful
+ *              memory allocation
+ */
+Cache_T Cache_new(const char *dir)
+{
+        assert(dir != NULL);
+
+        Cache_T cache = malloc(sizeof(*cache));
+        assert(cache != NULL);
+
+        cache->dir = malloc(strlen(dir) + 1);
+        assert(cache->dir != NULL);
+        strcpy(cache->dir, dir);
+        cache->num_writers = 0;
+
+        return cache;
+}
+
+
+/* FUNCTION:    Cache_free
+ * Purpose:     stop using a code cache
+ * Arg:         cache: a pointer to a Cache_T
+ * Returns:     N/A
+ * Effect:      Waits for the entries still being written
+ * Exported to: Operation module: used when freeing an operations struct
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Cache_free(Cache_T *cache)
+{
+        assert(cache != NULL && *cache != NULL);
+
+        for (unsigned i = 0; i < (*cache)->num_writers; i++) {
+                pthread_join((*cache)->writers[i], NULL);
+        }
+        free((*cache)->dir);
+        free(*cache);
+
+        *cache = NULL;
+}
+
+
+/* FUNCTION:    Cache_load
+ * Purpose:     look up the decoded form of an image
+ * Arg:         cache: the cache
+ *              words: the image, as in segment 0
+ *              length: the number of words, more than 0
+ *              program: set to the decoded form on a hit, with one entry
+ *                       per word
+ * Returns:     true on a hit: an entry that holds this very image and
+ *              whose decoded entries match the hash stored with them
+ * Effect:      Maps the entry and checks it before copying anything, so on
+ *              a miss program is unchanged. Nothing proves the decoded
+ *              entries were made from the image, so a hit must still be
+ *              checked to be a program the caller could have decoded
+ * Exported to: Operation module: used before decoding a new segment 0
+ * Error:       Checked runtime error if an argument is NULL
+ */
+bool Cache_load(Cache_T cache, const uint32_t *words, uint32_t length,
+                Um_decoded *program)
+{
+        assert(cache != NULL && words != NULL && program != NULL);
+
+        uint64_t key[2];
+        hash_words(words, length, key);
+
+        char *path = entry_path(cache, key, "");
+        int fd = open(path, O_RDONLY);
+        free(path);
+        if (fd < 0) {
+                return false;
+        }
+
+        size_t payload = (size_t)length * sizeof(*program);
+        size_t image = (size_t)length * sizeof(*words);
+        size_t num_bytes = header_words * sizeof(uint64_t) + payload + image;
+        struct stat meta_data;
+        void *bytes = MAP_FAILED;
+        if (fstat(fd, &meta_data) == 0 &&
+            (uint64_t)meta_data.st_size == num_bytes) {
+                bytes = mmap(NULL, num_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (bytes == MAP_FAILED) {
+                return false;
+        }
+
+        /* the entries are checked where they are mapped, then copied. An
+           entry is only for the very image it was decoded from */
+        const uint64_t *header = bytes;
+        const Um_decoded *entries = (const void *)(header + header_words);
+        const uint32_t *source = (const void *)(entries + length);
+        uint64_t check[2];
+        bool hit = header[0] == cache_magic &&
+                   header[1] == sizeof(*program) &&
+                   header[2] == length &&
+                   header[3] == key[0] && header[4] == key[1] &&
+                   memcmp(source, words, image) == 0;
+        if (hit) {
+                hash_words((const uint32_t *)entries,
+                           payload / sizeof(uint32_t), check);
+                hit = header[5] == check[0];
+        }
+        if (hit) {
+                memcpy(program, entries, payload);
+        }
+
+        munmap(bytes, num_bytes);
+        return hit;
+}
+
+
+/* FUNCTION:    Cache_store
+ * Purpose:     add the decoded form of an image to the cache
+ * Arg:         cache: the cache
+ *              words: the image, as in segment 0
+ *              length: the number of words, more than 0
+ *              program: its decoded form, with one entry per word
+ * Returns:     N/A
+ * Effect:      Copies the decoded form and the image, and writes both
+ *              in a background thread, first to a temporary file that is
+ *              then renamed, so a reader never sees a partly written
+ *              entry. Errors while writing only mean the entry is missing
+ * Exported to: Operation module: used after decoding a segment 0 that was
+ *              not in the cache
+ * Error:       Checked runtime error if an argument is NULL, or for
+ *              unsuccessful memory allocation
+ */
+void Cache_store(Cache_T cache, const uint32_t *words, uint32_t length,
+                 const Um_decoded *program)
+{
+        assert(cache != NULL && words != NULL && program != NULL);
+
+        if (cache->num_writers == max_stores) {
+                return;
+        }
+
+        Store *store = malloc(sizeof(*store));
+        assert(store != NULL);
+        size_t payload = (size_t)length * sizeof(*program);
+        store->program = malloc(payload);
+        assert(store->program != NULL);
+        memcpy(store->program, program, payload);
+        store->words = malloc((size_t)length * sizeof(*words));
+        assert(store->words != NULL);
+        memcpy(store->words, words, (size_t)length * sizeof(*words));
+        store->length = length;
+
+        uint64_t key[2], check[2];
+        hash_words(words, length, key);
+        hash_words((const uint32_t *)program, payload / sizeof(uint32_t),
+                   check);
+        store->header[0] = cache_magic;
+        store->header[1] = sizeof(*program);
+        store->header[2] = length;
+        store->header[3] = key[0];
+        store->header[4] = key[1];
+        store->header[5] = check[0];
+
+        /* the temporary name is unique to this process and this store */
+        char suffix[max_name];
+        snprintf(suffix, sizeof(suffix), ".%ld.%p.tmp", (long)getpid(),
+                 (void *)store);
+        store->path = entry_path(cache, key, "");
+        store->temp = entry_path(cache, key, suffix);
+
+        if (pthread_create(&cache->writers[cache->num_writers], NULL,
+                           write_entry, store) == 0) {
+                cache->num_writers++;
+        } else {
+                write_entry(store);
+        }
+}
+
+
+/* FUNCTION:    hash_words
+ * Purpose:     hash a run of words
+ * Arg:         words: the words
+ *              num_words: how many there are
+ *              key: set to the hash
+ * Returns:     N/A
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static void hash_words(const uint32_t *words, size_t num_words,
+                       uint64_t key[2])
+{
+        uint64_t lane0 = 0x9e3779b97f4a7c15ULL ^ num_words;
+        uint64_t lane1 = 0xc2b2ae3d27d4eb4fULL;
+
+        for (size_t i = 0; i < num_words; i++) {
+                lane0 = (lane0 ^ words[i]) * 0xff51afd7ed558ccdULL;
+                lane0 = (lane0 << 29) | (lane0 >> 35);
+                lane1 = (lane1 + words[i]) * 0xc4ceb9fe1a85ec53ULL;
+                lane1 = (lane1 << 31) | (lane1 >> 33);
+        }
+
+        /* so every word reaches every bit of both halves */
+        lane0 ^= lane1 >> 32;
+        lane1 ^= lane0 >> 29;
+        key[0] = (lane0 ^ (lane0 >> 33)) * 0xff51afd7ed558ccdULL;
+        key[1] = (lane1 ^ (lane1 >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        key[0] ^= key[0] >> 33;
+        key[1] ^= key[1] >> 33;
+}
+
+
+/* FUNCTION:    entry_path
+ * Purpose:     build the pathname of an entry
+ * Arg:         cache: the cache
+ *              key: the hash of the entry's image
+ *              suffix: added after the entry's name
+ * Returns:     dir/<key in hexadecimal>.umc<suffix>, which the caller frees
+ * Effect:      N/A
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+static char *entry_path(Cache_T cache, const uint64_t key[2],
+                        const char *suffix)
+{
+        size_t size = strlen(cache->dir) + strlen(suffix) + max_name;
+        char *path = malloc(size);
+        assert(path != NULL);
+
+        snprintf(path, size, "%s/%016llx%016llx.umc%s", cache->dir,
+                 (unsigned long long)key[0], (unsigned long long)key[1],
+                 suffix);
+        return path;
+}
+
+
+/* FUNCTION:    write_entry
+ * Purpose:     write an entry, the body of a writer thread
+ * Arg:         store: the Store to write, which is freed
+ * Returns:     NULL
+ * Effect:      Writes the temporary file and renames it over the entry, or
+ *              removes it if anything fails
+ * Error:       N/A
+ */
+static void *write_entry(void *store)
+{
+        Store *entry = store;
+        size_t payload = (size_t)entry->length * sizeof(*entry->program);
+        size_t image = (size_t)entry->length * sizeof(*entry->words);
+
+        FILE *out = fopen(entry->temp, "wb");
+        if (out != NULL) {
+                bool written =
+                        fwrite(entry->header, sizeof(entry->header), 1,
+                               out) == 1 &&
+                        fwrite(entry->program, 1, payload, out) == payload &&
+                        fwrite(entry->words, 1, image, out) == image;
+                if (fclose(out) != 0 || !written ||
+                    rename(entry->temp, entry->path) != 0) {
+                        remove(entry->temp);
+                }
+        }
+
+        free(entry->path);
+        free(entry->temp);
+        free(entry->program);
+        free(entry->words);
+        free(entry);
+        return NULL;
+}
@@ -0,0 +1,95 @@
+/*****************************************************************************
+ *
+ *                                  cache.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our code cache module. It keeps the
+ *     decoded and fused form of segment 0 images in a directory, one file
+ *     per image, named after a 128-bit hash of the image's words, so a
+ *     program that is run again, or that unpacks the same code into
+ *     segment 0 again, does not have to be decoded again. An entry also
+ *     holds a hash of its own contents, and is only used if the image's
+ *     hash, its length and that check all match, so a stale or damaged
+ *     entry is never run. Entries are written by a background thread. This
+ *     module is exported to our operations module.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_CACHE_INCLUDED
+#define UM_CACHE_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "instruction_packing.h"
+
+typedef struct Cache_T *Cache_T;
+
+/* FUNCTION:    Cache_new
+ * Purpose:     use a directory as a code cache
+ * Arg:         dir: the directory's pathname, which must exist. It is
+ *                   copied
+ * Returns:     a new Cache_T
+ * Effect:      N/A
+ * Exported to: Operation module: used when a cache directory is set
+ * Error:       Checked runtime error if dir is NULL, or for unsuccessful
+ *              memory allocation
+ */
+Cache_T Cache_new(const char *dir);
+
+
+/* FUNCTION:    Cache_free
+ * Purpose:     stop using a code cache
+ * Arg:         cache: a pointer to a Cache_T
+ * Returns:     N/A
+ * Effect:      Waits for the entries still being written
+ * Exported to: Operation module: used when freeing an operations struct
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Cache_free(Cache_T *cache);
+
+
+/* FUNCTION:    Cache_load
+ * Purpose:     look up the decoded form of an image
+ * Arg:         cache: the cache
+ *              words: the image, as in segment 0
+ *              length: the number of words, more than 0
+ *              program: set to the decoded form on a hit, with one entry
+ *                       per word
+ * Returns:     true on a hit: an entry that holds this very image and
+ *              whose decoded entries match the hash stored with them
+ * Effect:      Maps the entry and checks it before copying anything, so on
+ *              a miss program is unchanged. Nothing proves the decoded
+ *              entries were made from the image, so a hit must still be
+ *              checked to be a program the caller could have decoded
+ * Exported to: Operation module: used before decoding a new segment 0
+ * Error:       Checked runtime error if an argument is NULL
+ */
+bool Cache_load(Cache_T cache, const uint32_t *words, uint32_t length,
+                Um_decoded *program);
+
+
+/* FUNCTION:    Cache_store
+ * Purpose:     add the decoded form of an image to the cache
+ * Arg:         cache: the cache
+ *              words: the image, as in segment 0
+ *              length: the number of words, more than 0
+ *              program: its decoded form, with one entry per word
+ * Returns:     N/A
+ * Effect:      Copies the decoded form and the image, and writes both
+ *              in a background thread, first to a temporary file that is
+ *              then renamed, so a reader never sees a partly written
+ *              entry. Errors while writing only mean the entry is missing
+ * Exported to: Operation module: used after decoding a segment 0 that was
+ *              not in the cache
+ * Error:       Checked runtime error if an argument is NULL, or for
+ *              unsuccessful memory allocation
+ */
+void Cache_store(Cache_T cache, const uint32_t *words, uint32_t length,
+                 const Um_decoded *program);
+
+#endif
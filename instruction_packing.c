@@ -19,6 +19,11 @@
 #include "instruction_packing.h"
 #include <bitpack.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
 /* bit size of a character, since we are reading data from the file in terms of
    characters */
 #define char_bitsize 8
@@ -134,3 +139,127 @@ uint32_t get_value(uint32_t instruction)
 {
         return Bitpack_getu(instruction, val_width, val_lsb);
 }
+
+
+/* FUNCTION:    decode_instruction
+ * Purpose:     unpack every field of an instruction at once
+ * Arg:         instruction: an uint32_t word representing the instruction
+ * Returns:     a Um_decoded holding the opcode, the register numbers a, b and
+ *              c, and the load value
+ * Effect:      N/A
+ * Exported to: Operation module: used when building the decoded copy of
+ *              segment 0
+ * Error:       N/A
+ */
+Um_decoded decode_instruction(uint32_t instruction)
+{
+        Um_decoded decoded = { 0, 0, 0, 0, 0 };
+
+        decoded.opcode = get_operation(instruction);
+        decoded.a = get_register(instruction, 'a');
+
+        if (decoded.opcode == load_reg_opcode) {
+                decoded.value = get_value(instruction);
+        } else {
+                decoded.b = get_register(instruction, 'b');
+                decoded.c = get_register(instruction, 'c');
+        }
+
+        return decoded;
+}
+
+
+#ifdef HAVE_X86_SIMD
+/* 
+ * shuffle control that reverses the bytes of each 32-bit lane, used by both
+ * SIMD kernels below
+ */
+static const unsigned char bswap_lanes[32] = {
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+/* FUNCTION:    unpack_words_avx2
+ * Purpose:     byte swap 8 words at a time with AVX2
+ * Arg:         words, bytes, num_words: as for unpack_words
+ * Returns:     the number of words converted, a multiple of 8
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+__attribute__((target("avx2")))
+static uint32_t unpack_words_avx2(uint32_t *words, const unsigned char *bytes,
+                                  uint32_t num_words)
+{
+        __m256i mask = _mm256_loadu_si256((const __m256i *)bswap_lanes);
+        uint32_t i = 0;
+
+        for (; i + 8 <= num_words; i += 8) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)
+                                               (bytes + 4 * (size_t)i));
+                _mm256_storeu_si256((__m256i *)(words + i), 
+                                    _mm256_shuffle_epi8(v, mask));
+        }
+
+        return i;
+}
+
+
+/* FUNCTION:    unpack_words_ssse3
+ * Purpose:     byte swap 4 words at a time with SSSE3
+ * Arg:         words, bytes, num_words: as for unpack_words
+ * Returns:     the number of words converted, a multiple of 4
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+__attribute__((target("ssse3")))
+static uint32_t unpack_words_ssse3(uint32_t *words, const unsigned char *bytes,
+                                   uint32_t num_words)
+{
+        __m128i mask = _mm_loadu_si128((const __m128i *)bswap_lanes);
+        uint32_t i = 0;
+
+        for (; i + 4 <= num_words; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i *)
+                                            (bytes + 4 * (size_t)i));
+                _mm_storeu_si128((__m128i *)(words + i), 
+                                 _mm_shuffle_epi8(v, mask));
+        }
+
+        return i;
+}
+#endif
+
+
+/* FUNCTION:    unpack_words
+ * Purpose:     convert a run of big-endian bytes into instruction words
+ * Arg:         words: where the words are written
+ *              bytes: 4 * num_words bytes, most significant byte first
+ *              num_words: the number of words to convert
+ * Returns:     N/A
+ * Effect:      Fills words[0..num_words). The bytes are swapped 32 or 16 at a
+ *              time with AVX2 or SSSE3 when the processor supports them
+ * Exported to: Operation module. Used when reading in a program image
+ * Error:       N/A
+ */
+void unpack_words(uint32_t *words, const unsigned char *bytes, 
+                  uint32_t num_words)
+{
+        uint32_t i = 0;
+
+#ifdef HAVE_X86_SIMD
+        if (__builtin_cpu_supports("avx2")) {
+                i = unpack_words_avx2(words, bytes, num_words);
+        } else if (__builtin_cpu_supports("ssse3")) {
+                i = unpack_words_ssse3(words, bytes, num_words);
+        }
+#endif
+
+        /* the words the SIMD kernels left over, or all of them without SIMD */
+        for (; i < num_words; i++) {
+                const unsigned char *b = bytes + 4 * (size_t)i;
+                words[i] = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+                           ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+        }
+}
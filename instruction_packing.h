@@ -20,6 +20,28 @@
 
 #include "stdint.h"
 
+/* 
+ * An instruction with every field already unpacked. Registers that the
+ * opcode does not use are 0, and value is only meaningful for load value.
+ * The struct is 8 bytes so a decoded program stays dense in the cache.
+ */
+typedef struct Um_decoded {
+        uint8_t opcode;
+        uint8_t a;
+        uint8_t b;
+        uint8_t c;
+        uint32_t value;
+} Um_decoded;
+
+/*
+ * decode_instruction never returns an opcode from UM_FUSED up. The
+ * operations module gives one to an LV that starts a sequence it runs as a
+ * single superinstruction; the entry is otherwise that LV, unchanged, and
+ * UM_PLAIN_OPCODE gives the opcode it was decoded with.
+ */
+#define UM_FUSED 16
+#define UM_PLAIN_OPCODE(ins) ((ins).opcode >= UM_FUSED ? 13u : (ins).opcode)
+
 /* FUNCTION:    pack_instruction
  * Purpose:     pack 4 separate char variables representing different bits of
  *              an instruction into a single uint32_t instruction
@@ -71,4 +93,30 @@ uint32_t get_register(uint32_t instruction, char reg);
  */
 uint32_t get_value(uint32_t instruction);
 
+/* FUNCTION:    decode_instruction
+ * Purpose:     unpack every field of an instruction at once
+ * Arg:         instruction: an uint32_t word representing the instruction
+ * Returns:     a Um_decoded holding the opcode, the register numbers a, b and
+ *              c, and the load value
+ * Effect:      N/A
+ * Exported to: Operation module: used when building the decoded copy of
+ *              segment 0
+ * Error:       N/A
+ */
+Um_decoded decode_instruction(uint32_t instruction);
+
+/* FUNCTION:    unpack_words
+ * Purpose:     convert a run of big-endian bytes into instruction words
+ * Arg:         words: where the words are written
+ *              bytes: 4 * num_words bytes, most significant byte first
+ *              num_words: the number of words to convert
+ * Returns:     N/A
+ * Effect:      Fills words[0..num_words). The bytes are swapped 32 or 16 at a
+ *              time with AVX2 or SSSE3 when the processor supports them
+ * Exported to: Operation module. Used when reading in a program image
+ * Error:       N/A
+ */
+void unpack_words(uint32_t *words, const unsigned char *bytes, 
+                  uint32_t num_words);
+
 #endif
\ No newline at end of file
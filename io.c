@@ -0,0 +1,1033 @@
+/*****************************************************************************
+ *
+ *                                  io.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our I/O module. Every device has
+ *     an output buffer and an input buffer, and Io_put and Io_get only use
+ *     them while there is room or data left. When the output buffer is full
+ *     or the input buffer is empty, the device's own functions in its
+ *     Io_ops table decide what happens: a buffered device writes the buffer
+ *     out or reads the next chunk, a memory device grows its output or
+ *     reports the end of input, and a direct device, which has no buffers,
+ *     does a single-byte write() or read(). This module is exported to our
+ *     operations module.
+ *
+ *     When the input of a buffered or async device is a regular file, the
+ *     input buffer is the file itself, mapped from its current offset to
+ *     its end, so Io_get serves every byte without a system call. Only
+ *     once the mapping is used up does fill go back to read(), which
+ *     finds anything appended since, and the descriptor's offset is moved
+ *     to what was consumed, as it would be after read().
+ *
+ *     A device with a log hands it every piece of output where the piece
+ *     leaves the device, and every piece of input once the program has
+ *     read all of it: in_logged marks how much of the input buffer has
+ *     been logged, and the rest is logged before the buffer is refilled or
+ *     freed, so input read ahead but never read by the program is left
+ *     out. A replaying device keeps its own kind of output but takes a
+ *     fill that serves the logged input where it is mapped, and like a
+ *     mapped file it never waits, so it does not flush before input.
+ *
+ *     The output buffer of an async device is a window of at most
+ *     ring_window bytes into a ring shared with its writer thread. Filling
+ *     the window hands it to the writer by moving the ring's head and opens
+ *     the next one, so Io_put still only stores a byte, and the interpreter
+ *     makes no system call unless the ring is full. The head and tail are
+ *     each written by one thread only and read by the other with atomic
+ *     loads; the lock and condition variables are only used by a thread
+ *     that has to sleep, the writer when the ring is empty and the
+ *     interpreter when it is full or being flushed. Each thread says it is
+ *     going to sleep before it looks at the other's position one last
+ *     time, and the other looks for a sleeper after moving its position,
+ *     both with sequentially consistent atomics, so a wakeup is never
+ *     missed.
+ *
+ *
+ ****************************************************************************/
+
+#include "io.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* size of the output buffer and of each read-ahead for buffered devices */
+#define buffer_size (1 << 16)
+
+/* starting size of the output collected by a memory device */
+#define memory_output_size 4096
+
+/* size of the ring an async device's writer drains, a power of 2 */
+#define ring_size (1 << 20)
+
+/* the most output an async device holds before handing it to the writer */
+#define ring_window (1 << 16)
+
+/*
+ * the ring of an async device, shared by the interpreter, which fills it,
+ * and the writer thread, which empties it:
+ *      bytes: ring_size bytes
+ *      head: how many bytes have ever been handed to the writer, only
+ *            written by the interpreter
+ *      tail: how many of those have been written out, only written by the
+ *            writer
+ *      out_fd: where the writer writes
+ *      writer: the writer thread
+ *      lock: held while a thread decides to sleep, and to wake it
+ *      ready: signalled when bytes are handed over or the device closes
+ *      drained: signalled when bytes have been written out
+ *      writer_asleep, reader_asleep: whether the writer, or the interpreter,
+ *            is sleeping or about to
+ *      closing: set when the device is freed
+ */
+typedef struct Ring {
+        unsigned char *bytes;
+        size_t head;
+        size_t tail;
+        int out_fd;
+        pthread_t writer;
+        pthread_mutex_t lock;
+        pthread_cond_t ready;
+        pthread_cond_t drained;
+        int writer_asleep;
+        int reader_asleep;
+        int closing;
+} Ring;
+
+/*
+ * the functions that make up one kind of device:
+ *      drain: called by Io_put when the output buffer is full
+ *      fill: called by Io_get when the input buffer is empty; returns the
+ *            next byte or -1
+ *      flush: writes out any buffered output
+ */
+typedef struct Io_ops {
+        void (*drain)(Io_T io, unsigned char c);
+        int  (*fill) (Io_T io);
+        void (*flush)(Io_T io);
+} Io_ops;
+
+/*
+ * struct definition for our Io struct which holds:
+ *      ops: the functions for this kind of device
+ *      in_fd, out_fd: the file descriptors used, -1 for memory devices
+ *      out, out_length, out_capacity: the output buffer
+ *      in, in_position, in_length: the input buffer and how much of it has
+ *      been consumed
+ *      mapped_length: the size of the mapping if in is a mapping of the
+ *      input file, otherwise 0
+ *      waits: whether input may have to wait, so output is flushed first
+ *      ring: the ring of an async device, NULL for the others
+ *      log, in_logged: the log, or NULL, and how much of the input buffer
+ *      has been logged
+ */
+struct Io_T {
+        const Io_ops *ops;
+        int in_fd;
+        int out_fd;
+        unsigned char *out;
+        size_t out_length;
+        size_t out_capacity;
+        unsigned char *in;
+        size_t in_position;
+        size_t in_length;
+        size_t mapped_length;
+        bool waits;
+        Ring *ring;
+        Iolog_T log;
+        size_t in_logged;
+};
+
+/* private helper functions, details can be viewed below */
+static Io_T new_device     (const Io_ops *ops, int in_fd, int out_fd);
+static void write_all      (int fd, const unsigned char *bytes, size_t length);
+static void buffered_drain (Io_T io, unsigned char c);
+static int  buffered_fill  (Io_T io);
+static void buffered_flush (Io_T io);
+static void memory_drain   (Io_T io, unsigned char c);
+static int  memory_fill    (Io_T io);
+static void memory_flush   (Io_T io);
+static void direct_drain   (Io_T io, unsigned char c);
+static int  direct_fill    (Io_T io);
+static void direct_flush   (Io_T io);
+static void async_drain    (Io_T io, unsigned char c);
+static void async_flush    (Io_T io);
+static void publish        (Io_T io);
+static void await_tail     (Ring *ring, size_t target);
+static void *drain_ring    (void *ring);
+static void writev_all     (int fd, struct iovec *parts, int count);
+static void map_input      (Io_T io);
+static void unmap_input    (Io_T io, size_t consumed);
+static int  replay_fill    (Io_T io);
+static void log_consumed   (Io_T io);
+
+static const Io_ops buffered_ops = { buffered_drain, buffered_fill,
+                                     buffered_flush };
+static const Io_ops memory_ops   = { memory_drain, memory_fill,
+                                     memory_flush };
+static const Io_ops direct_ops   = { direct_drain, direct_fill,
+                                     direct_flush };
+static const Io_ops async_ops    = { async_drain, buffered_fill,
+                                     async_flush };
+
+/* the same devices replaying a log */
+static const Io_ops buffered_replay_ops = { buffered_drain, replay_fill,
+                                            buffered_flush };
+static const Io_ops direct_replay_ops   = { direct_drain, replay_fill,
+                                            direct_flush };
+static const Io_ops async_replay_ops    = { async_drain, replay_fill,
+                                            async_flush };
+
+
+/* FUNCTION:    Io_new_buffered
+ * Purpose:     create a device that buffers both directions on two file
+ *              descriptors
+ * Arg:         in_fd: the descriptor input is read from
+ *              out_fd: the descriptor output is written to
+ * Returns:     a new Io_T
+ * Effect:      N/A
+ * Exported to: Operation module and main program: the default device
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Io_T Io_new_buffered(int in_fd, int out_fd)
+{
+        Io_T io = new_device(&buffered_ops, in_fd, out_fd);
+
+        io->out = malloc(buffer_size);
+        io->in = malloc(buffer_size);
+        assert(io->out != NULL && io->in != NULL);
+        io->out_capacity = buffer_size;
+        map_input(io);
+
+        return io;
+}
+
+
+/* FUNCTION:    Io_new_memory
+ * Purpose:     create a device that reads from a byte array and collects its
+ *              output in memory
+ * Arg:         input: the bytes the program will read, may be NULL if
+ *                     length is 0
+ *              length: the number of input bytes
+ * Returns:     a new Io_T
+ * Effect:      The input bytes are copied, so the caller may free them
+ * Exported to: Main program and batch runners: used for runs whose input
+ *              and output are not files
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Io_T Io_new_memory(const unsigned char *input, size_t length)
+{
+        Io_T io = new_device(&memory_ops, -1, -1);
+
+        io->out = malloc(memory_output_size);
+        io->in = malloc(length == 0 ? 1 : length);
+        assert(io->out != NULL && io->in != NULL);
+        io->out_capacity = memory_output_size;
+
+        if (length > 0) {
+                memcpy(io->in, input, length);
+        }
+        io->in_length = length;
+
+        return io;
+}
+
+
+/* FUNCTION:    Io_new_direct
+ * Purpose:     create a device that does one read() or write() per byte
+ * Arg:         in_fd: the descriptor input is read from
+ *              out_fd: the descriptor output is written to
+ * Returns:     a new Io_T
+ * Effect:      N/A
+ * Exported to: Main program: used when every byte must leave immediately
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Io_T Io_new_direct(int in_fd, int out_fd)
+{
+        /* no buffers, so every byte goes through drain and fill */
+        return new_device(&direct_ops, in_fd, out_fd);
+}
+
+
+/* FUNCTION:    Io_new_async
+ * Purpose:     create a device whose output is written by a thread of its
+ *              own
+ * Arg:         in_fd: the descriptor input is read from
+ *              out_fd: the descriptor output is written to
+ * Returns:     a new Io_T
+ * Effect:      Starts the writer thread. Input is read ahead as by a
+ *              buffered device. If the thread cannot be started, the device
+ *              is a buffered one instead
+ * Exported to: Main program: used to keep write() off the interpreter's
+ *              thread
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Io_T Io_new_async(int in_fd, int out_fd)
+{
+        Io_T io = Io_new_buffered(in_fd, out_fd);
+
+        Ring *ring = malloc(sizeof(*ring));
+        assert(ring != NULL);
+        ring->bytes = malloc(ring_size);
+        assert(ring->bytes != NULL);
+        ring->head = 0;
+        ring->tail = 0;
+        ring->out_fd = out_fd;
+        pthread_mutex_init(&ring->lock, NULL);
+        pthread_cond_init(&ring->ready, NULL);
+        pthread_cond_init(&ring->drained, NULL);
+        ring->writer_asleep = 0;
+        ring->reader_asleep = 0;
+        ring->closing = 0;
+
+        if (pthread_create(&ring->writer, NULL, drain_ring, ring) != 0) {
+                pthread_mutex_destroy(&ring->lock);
+                pthread_cond_destroy(&ring->ready);
+                pthread_cond_destroy(&ring->drained);
+                free(ring->bytes);
+                free(ring);
+                return io;
+        }
+
+        /* the first Io_put opens a window into the ring */
+        free(io->out);
+        io->out = NULL;
+        io->out_capacity = 0;
+        io->ops = &async_ops;
+        io->ring = ring;
+
+        return io;
+}
+
+
+/* FUNCTION:    Io_set_log
+ * Purpose:     record a device's input and output in a log, or replay
+ *              them from one
+ * Arg:         io: a buffered, direct or async device that has not been
+ *                  used yet
+ *              log: a recording or replaying log, which the caller keeps
+ *                   and frees after the device
+ * Returns:     N/A
+ * Effect:      A replaying device reads its input from the log instead of
+ *              its input descriptor, and stops flushing output before input
+ * Exported to: Main program: used by --record, --record-input and --replay
+ * Error:       Checked runtime error if an argument is NULL, or io is a
+ *              memory device or already has a log
+ */
+void Io_set_log(Io_T io, Iolog_T log)
+{
+        assert(io != NULL && log != NULL);
+        assert(io->ops != &memory_ops && io->log == NULL);
+
+        io->log = log;
+        io->in_logged = io->in_position;
+        if (!Iolog_replaying(log)) {
+                return;
+        }
+
+        if (io->mapped_length > 0) {
+                unmap_input(io, io->in_position);
+        }
+        free(io->in);
+        io->in = NULL;
+        io->in_position = io->in_length = 0;
+        io->waits = false;
+        io->ops = io->ops == &direct_ops ? &direct_replay_ops :
+                  io->ops == &async_ops  ? &async_replay_ops :
+                                           &buffered_replay_ops;
+}
+
+
+/* FUNCTION:    Io_free
+ * Purpose:     flush and free a device
+ * Arg:         io: a pointer to an Io_T
+ * Returns:     N/A
+ * Effect:      Writes out any buffered output, then frees the device and
+ *              stops its writer thread if it has one. The file descriptors
+ *              are not closed
+ * Exported to: Operation module: used when freeing an operations struct
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Io_free(Io_T *io)
+{
+        assert(io != NULL && *io != NULL);
+
+        Io_flush(*io);
+
+        /* the output buffer of an async device is part of its ring */
+        Ring *ring = (*io)->ring;
+        if (ring != NULL) {
+                pthread_mutex_lock(&ring->lock);
+                ring->closing = 1;
+                pthread_cond_signal(&ring->ready);
+                pthread_mutex_unlock(&ring->lock);
+                pthread_join(ring->writer, NULL);
+
+                pthread_mutex_destroy(&ring->lock);
+                pthread_cond_destroy(&ring->ready);
+                pthread_cond_destroy(&ring->drained);
+                free(ring->bytes);
+                free(ring);
+        } else {
+                free((*io)->out);
+        }
+        if ((*io)->log != NULL && Iolog_replaying((*io)->log)) {
+                /* the input buffer is part of the log */
+                (*io)->in = NULL;
+        } else if ((*io)->log != NULL) {
+                log_consumed(*io);
+        }
+        if ((*io)->mapped_length > 0) {
+                unmap_input(*io, (*io)->in_position);
+        }
+        free((*io)->in);
+        free(*io);
+        *io = NULL;
+}
+
+
+/* FUNCTION:    Io_put
+ * Purpose:     output one byte
+ * Arg:         io: the device
+ *              c: the byte
+ * Returns:     N/A
+ * Effect:      Appends the byte to the output buffer, writing the buffer out
+ *              when it is full
+ * Exported to: Operation module: used in the output instruction
+ * Error:       N/A
+ */
+void Io_put(Io_T io, unsigned char c)
+{
+        if (io->out_length < io->out_capacity) {
+                io->out[io->out_length++] = c;
+        } else {
+                io->ops->drain(io, c);
+        }
+}
+
+
+/* FUNCTION:    Io_get
+ * Purpose:     input one byte
+ * Arg:         io: the device
+ * Returns:     the byte read, or -1 at the end of input
+ * Effect:      Flushes buffered output first, so a prompt is always seen
+ *              before the program waits for an answer. Input from a mapped
+ *              file never waits, so then the output is left to be written
+ *              in full buffers
+ * Exported to: Operation module: used in the input instruction
+ * Error:       N/A
+ */
+int Io_get(Io_T io)
+{
+        if (io->waits) {
+                io->ops->flush(io);
+        }
+
+        if (io->in_position < io->in_length) {
+                return io->in[io->in_position++];
+        }
+
+        return io->ops->fill(io);
+}
+
+
+/* FUNCTION:    Io_flush
+ * Purpose:     write out any buffered output
+ * Arg:         io: the device
+ * Returns:     N/A
+ * Effect:      For memory devices the output stays in memory. For async
+ *              devices, returns once the writer thread has written it all
+ * Exported to: Operation module: used when the program halts
+ * Error:       N/A
+ */
+void Io_flush(Io_T io)
+{
+        io->ops->flush(io);
+}
+
+
+/* FUNCTION:    Io_output
+ * Purpose:     get the output collected by a memory device
+ * Arg:         io: a device made by Io_new_memory
+ *              length: set to the number of output bytes
+ * Returns:     pointer to the output bytes, owned by the device
+ * Effect:      N/A
+ * Exported to: Main program and batch runners
+ * Error:       Checked runtime error if io is not a memory device
+ */
+const unsigned char *Io_output(Io_T io, size_t *length)
+{
+        assert(io != NULL && length != NULL);
+        assert(io->ops == &memory_ops);
+
+        *length = io->out_length;
+        return io->out;
+}
+
+
+/* FUNCTION:    new_device
+ * Purpose:     allocate a device with empty buffers
+ * Arg:         ops: the functions for this kind of device
+ *              in_fd, out_fd: the file descriptors used
+ * Returns:     a new Io_T
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+static Io_T new_device(const Io_ops *ops, int in_fd, int out_fd)
+{
+        Io_T io = malloc(sizeof(*io));
+        assert(io != NULL);
+
+        io->ops = ops;
+        io->in_fd = in_fd;
+        io->out_fd = out_fd;
+        io->out = NULL;
+        io->out_length = 0;
+        io->out_capacity = 0;
+        io->in = NULL;
+        io->in_position = 0;
+        io->in_length = 0;
+        io->mapped_length = 0;
+        io->waits = true;
+        io->ring = NULL;
+        io->log = NULL;
+        io->in_logged = 0;
+
+        return io;
+}
+
+
+/* FUNCTION:    write_all
+ * Purpose:     write a run of bytes to a file descriptor
+ * Arg:         fd: the descriptor
+ *              bytes: the bytes to write
+ *              length: the number of bytes
+ * Returns:     N/A
+ * Effect:      Retries short writes and interrupted calls. Like stdio, gives
+ *              up silently on any other error
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void write_all(int fd, const unsigned char *bytes, size_t length)
+{
+        while (length > 0) {
+                ssize_t written = write(fd, bytes, length);
+                if (written < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return;
+                }
+                bytes += written;
+                length -= written;
+        }
+}
+
+
+/* FUNCTION:    buffered_drain
+ * Purpose:     make room in a full output buffer
+ * Arg:         io: a buffered device
+ *              c: the byte that did not fit
+ * Returns:     N/A
+ * Effect:      Writes the buffer out, then buffers c
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void buffered_drain(Io_T io, unsigned char c)
+{
+        buffered_flush(io);
+        io->out[io->out_length++] = c;
+}
+
+
+/* FUNCTION:    buffered_fill
+ * Purpose:     read the next chunk of input
+ * Arg:         io: a buffered device
+ * Returns:     the first byte of the chunk, or -1 at the end of input
+ * Effect:      Reads as much as is available, up to the buffer size. A
+ *              mapped input file that has been used up is unmapped first
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static int buffered_fill(Io_T io)
+{
+        if (io->log != NULL) {
+                log_consumed(io);
+        }
+        if (io->mapped_length > 0) {
+                unmap_input(io, io->mapped_length);
+        }
+
+        ssize_t got;
+        do {
+                got = read(io->in_fd, io->in, buffer_size);
+        } while (got < 0 && errno == EINTR);
+
+        io->in_logged = 0;
+        if (got <= 0) {
+                io->in_position = io->in_length = 0;
+                if (io->log != NULL) {
+                        Iolog_end_of_input(io->log);
+                }
+                return -1;
+        }
+
+        io->in_length = got;
+        io->in_position = 1;
+        return io->in[0];
+}
+
+
+/* FUNCTION:    buffered_flush
+ * Purpose:     write out the output buffer
+ * Arg:         io: a buffered device
+ * Returns:     N/A
+ * Effect:      Empties the output buffer
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void buffered_flush(Io_T io)
+{
+        if (io->out_length > 0) {
+                if (io->log != NULL) {
+                        Iolog_output(io->log, io->out, io->out_length);
+                }
+                write_all(io->out_fd, io->out, io->out_length);
+                io->out_length = 0;
+        }
+}
+
+
+/* FUNCTION:    memory_drain
+ * Purpose:     grow the collected output when it is full
+ * Arg:         io: a memory device
+ *              c: the byte that did not fit
+ * Returns:     N/A
+ * Effect:      Doubles the output buffer, then appends c
+ * Exported to: N/A
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+static void memory_drain(Io_T io, unsigned char c)
+{
+        io->out_capacity *= 2;
+        io->out = realloc(io->out, io->out_capacity);
+        assert(io->out != NULL);
+
+        io->out[io->out_length++] = c;
+}
+
+
+/* FUNCTION:    memory_fill
+ * Purpose:     called once all the input bytes have been read
+ * Arg:         io: a memory device
+ * Returns:     -1, the end of input
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static int memory_fill(Io_T io)
+{
+        (void)io;
+        return -1;
+}
+
+
+/* FUNCTION:    memory_flush
+ * Purpose:     nothing to write out, the output stays in memory
+ * Arg:         io: a memory device
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void memory_flush(Io_T io)
+{
+        (void)io;
+}
+
+
+/* FUNCTION:    direct_drain
+ * Purpose:     write one byte straight to the output descriptor
+ * Arg:         io: a direct device
+ *              c: the byte
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void direct_drain(Io_T io, unsigned char c)
+{
+        if (io->log != NULL) {
+                Iolog_output(io->log, &c, 1);
+        }
+        write_all(io->out_fd, &c, 1);
+}
+
+
+/* FUNCTION:    direct_fill
+ * Purpose:     read one byte straight from the input descriptor
+ * Arg:         io: a direct device
+ * Returns:     the byte, or -1 at the end of input
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static int direct_fill(Io_T io)
+{
+        unsigned char c;
+        ssize_t got;
+        do {
+                got = read(io->in_fd, &c, 1);
+        } while (got < 0 && errno == EINTR);
+
+        if (io->log != NULL && got == 1) {
+                Iolog_input(io->log, &c, 1);
+        } else if (io->log != NULL) {
+                Iolog_end_of_input(io->log);
+        }
+        return got == 1 ? c : -1;
+}
+
+
+/* FUNCTION:    direct_flush
+ * Purpose:     nothing to write out, every byte has already been written
+ * Arg:         io: a direct device
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void direct_flush(Io_T io)
+{
+        (void)io;
+}
+
+
+/* FUNCTION:    async_drain
+ * Purpose:     hand a full window to the writer and open the next one
+ * Arg:         io: an async device
+ *              c: the byte that did not fit
+ * Returns:     N/A
+ * Effect:      The window ends at the end of the ring, at the bytes the
+ *              writer has not written yet, or after ring_window bytes,
+ *              whichever comes first. Sleeps only if the ring is full, until
+ *              there is room for a whole window
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void async_drain(Io_T io, unsigned char c)
+{
+        Ring *ring = io->ring;
+        publish(io);
+
+        size_t head = ring->head;
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == 
+            ring_size) {
+                await_tail(ring, head - ring_size + ring_window);
+        }
+
+        size_t start = head & (ring_size - 1);
+        size_t room = ring_size - 
+                      (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+        size_t capacity = ring_size - start;
+        if (capacity > room) {
+                capacity = room;
+        }
+        if (capacity > ring_window) {
+                capacity = ring_window;
+        }
+
+        io->out = ring->bytes + start;
+        io->out_capacity = capacity;
+        io->out[io->out_length++] = c;
+}
+
+
+/* FUNCTION:    async_flush
+ * Purpose:     write out everything an async device holds
+ * Arg:         io: an async device
+ * Returns:     N/A
+ * Effect:      Hands the open window to the writer and sleeps until the
+ *              writer has written all of the ring, so output is out before
+ *              the program reads input, halts or fails
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void async_flush(Io_T io)
+{
+        publish(io);
+        await_tail(io->ring, io->ring->head);
+}
+
+
+/* FUNCTION:    publish
+ * Purpose:     hand the bytes in an async device's window to the writer
+ * Arg:         io: an async device
+ * Returns:     N/A
+ * Effect:      Moves the head past them, closes the window, and wakes the
+ *              writer if it is asleep
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void publish(Io_T io)
+{
+        Ring *ring = io->ring;
+
+        if (io->out_length > 0) {
+                if (io->log != NULL) {
+                        Iolog_output(io->log, io->out, io->out_length);
+                }
+                __atomic_store_n(&ring->head, ring->head + io->out_length,
+                                 __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&ring->writer_asleep, __ATOMIC_SEQ_CST)) {
+                        pthread_mutex_lock(&ring->lock);
+                        pthread_cond_signal(&ring->ready);
+                        pthread_mutex_unlock(&ring->lock);
+                }
+        }
+
+        io->out_length = 0;
+        io->out_capacity = 0;
+}
+
+
+/* FUNCTION:    await_tail
+ * Purpose:     wait for the writer of a ring to get somewhere
+ * Arg:         ring: the ring
+ *              target: how many bytes must have been written out
+ * Returns:     N/A
+ * Effect:      Sleeps on ring->drained unless the writer is already there
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void await_tail(Ring *ring, size_t target)
+{
+        if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= target) {
+                return;
+        }
+
+        pthread_mutex_lock(&ring->lock);
+        __atomic_store_n(&ring->reader_asleep, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) < target) {
+                pthread_cond_wait(&ring->drained, &ring->lock);
+        }
+        __atomic_store_n(&ring->reader_asleep, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&ring->lock);
+}
+
+
+/* FUNCTION:    drain_ring
+ * Purpose:     write out what is handed over to a ring, the body of the
+ *              writer thread
+ * Arg:         ring: the Ring
+ * Returns:     NULL
+ * Effect:      Writes everything between the tail and the head with one
+ *              writev(), in two parts if it wraps around the end of the
+ *              ring, then moves the tail and wakes the interpreter if it is
+ *              asleep. Sleeps while the ring is empty, and returns once it
+ *              is empty and the device is closing
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void *drain_ring(void *ring)
+{
+        Ring *r = ring;
+
+        for (;;) {
+                size_t tail = r->tail;
+                size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+                if (head == tail) {
+                        pthread_mutex_lock(&r->lock);
+                        __atomic_store_n(&r->writer_asleep, 1, 
+                                         __ATOMIC_SEQ_CST);
+                        while (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) ==
+                               tail && !r->closing) {
+                                pthread_cond_wait(&r->ready, &r->lock);
+                        }
+                        __atomic_store_n(&r->writer_asleep, 0, 
+                                         __ATOMIC_RELAXED);
+                        bool done = r->closing && 
+                                    __atomic_load_n(&r->head, 
+                                                    __ATOMIC_ACQUIRE) == tail;
+                        pthread_mutex_unlock(&r->lock);
+                        if (done) {
+                                return NULL;
+                        }
+                        continue;
+                }
+
+                /* the second part starts at the start of the ring */
+                size_t start = tail & (ring_size - 1);
+                size_t length = head - tail;
+                size_t first = ring_size - start;
+                if (first > length) {
+                        first = length;
+                }
+                struct iovec parts[2] = {
+                        { r->bytes + start, first },
+                        { r->bytes, length - first }
+                };
+                writev_all(r->out_fd, parts, (first < length) ? 2 : 1);
+
+                __atomic_store_n(&r->tail, head, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&r->reader_asleep, __ATOMIC_SEQ_CST)) {
+                        pthread_mutex_lock(&r->lock);
+                        pthread_cond_signal(&r->drained);
+                        pthread_mutex_unlock(&r->lock);
+                }
+        }
+}
+
+
+/* FUNCTION:    writev_all
+ * Purpose:     write runs of bytes to a file descriptor
+ * Arg:         fd: the descriptor
+ *              parts: the runs, which are used up as they are written
+ *              count: the number of runs
+ * Returns:     N/A
+ * Effect:      Retries short writes and interrupted calls, and gives up
+ *              silently on any other error, like write_all
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void writev_all(int fd, struct iovec *parts, int count)
+{
+        while (count > 0) {
+                ssize_t written = writev(fd, parts, count);
+                if (written < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return;
+                }
+
+                /* skip the runs written in full, then into the next one */
+                while (count > 0 && (size_t)written >= parts->iov_len) {
+                        written -= parts->iov_len;
+                        parts++;
+                        count--;
+                }
+                if (count > 0) {
+                        parts->iov_base = (char *)parts->iov_base + written;
+                        parts->iov_len -= written;
+                }
+        }
+}
+
+
+/* FUNCTION:    map_input
+ * Purpose:     use a regular input file as the input buffer
+ * Arg:         io: a buffered device with an empty input buffer
+ * Returns:     N/A
+ * Effect:      Maps the file, frees the read-ahead buffer and makes the
+ *              mapping the input buffer, starting at the descriptor's
+ *              offset. Does nothing if the input is not a regular file with
+ *              bytes left, or cannot be mapped
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void map_input(Io_T io)
+{
+        struct stat meta_data;
+        off_t offset = lseek(io->in_fd, 0, SEEK_CUR);
+        if (offset < 0 || fstat(io->in_fd, &meta_data) != 0 ||
+            !S_ISREG(meta_data.st_mode) || meta_data.st_size <= offset) {
+                return;
+        }
+
+        size_t length = meta_data.st_size;
+        void *bytes = mmap(NULL, length, PROT_READ, MAP_PRIVATE, io->in_fd,
+                           0);
+        if (bytes == MAP_FAILED) {
+                return;
+        }
+        madvise(bytes, length, MADV_SEQUENTIAL);
+
+        free(io->in);
+        io->in = bytes;
+        io->in_position = offset;
+        io->in_length = length;
+        io->mapped_length = length;
+        io->waits = false;
+}
+
+
+/* FUNCTION:    unmap_input
+ * Purpose:     stop using a mapped input file as the input buffer
+ * Arg:         io: a device whose input buffer is a mapping
+ *              consumed: how many bytes of the file have been read
+ * Returns:     N/A
+ * Effect:      Moves the descriptor's offset to consumed, unmaps the file
+ *              and gives the device an empty read-ahead buffer again
+ * Exported to: N/A
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+static void unmap_input(Io_T io, size_t consumed)
+{
+        lseek(io->in_fd, consumed, SEEK_SET);
+        munmap(io->in, io->mapped_length);
+
+        io->in = malloc(buffer_size);
+        assert(io->in != NULL);
+        io->in_position = io->in_length = 0;
+        io->in_logged = 0;
+        io->mapped_length = 0;
+        io->waits = true;
+}
+
+
+/* FUNCTION:    replay_fill
+ * Purpose:     serve the next piece of logged input
+ * Arg:         io: a replaying device
+ * Returns:     the first byte of the piece, or -1 where the logged run
+ *              found the end of input and once the logged input is used up
+ * Effect:      Makes the piece the input buffer, where the log has it
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static int replay_fill(Io_T io)
+{
+        const unsigned char *bytes;
+        size_t length;
+        if (!Iolog_next_input(io->log, &bytes, &length) || length == 0) {
+                io->in_position = io->in_length = 0;
+                return -1;
+        }
+
+        /* the log is mapped read-only, and the input buffer is only read */
+        io->in = (unsigned char *)bytes;
+        io->in_length = length;
+        io->in_position = 1;
+        return io->in[0];
+}
+
+
+/* FUNCTION:    log_consumed
+ * Purpose:     log the input the program has read since it was last logged
+ * Arg:         io: a recording device
+ * Returns:     N/A
+ * Effect:      Moves in_logged up to in_position
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void log_consumed(Io_T io)
+{
+        if (io->in_position > io->in_logged) {
+                Iolog_input(io->log, io->in + io->in_logged,
+                            io->in_position - io->in_logged);
+        }
+        io->in_logged = io->in_position;
+}
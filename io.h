@@ -0,0 +1,181 @@
+/*****************************************************************************
+ *
+ *                                  io.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our I/O module. This module is the UM's
+ *     I/O device: the input and output instructions read and write single
+ *     bytes through an Io_T, and the Io_T decides where the bytes come from
+ *     and go to. There are three kinds of device:
+ *
+ *        - buffered: output is kept in a large buffer that is written out
+ *          when it fills, before every input and on flush. Input is read
+ *          ahead in large chunks, or mapped if it is a regular file.
+ *        - memory: input comes from a byte array and output is collected in
+ *          memory, for batch and test runs.
+ *        - direct: every byte is a read() or write() on a file descriptor,
+ *          with no buffering and no stdio locking.
+ *        - async: output is handed in large pieces to a thread of its
+ *          own, which writes it while the program runs on, so the program
+ *          only waits for write() when it reads input, halts or fails, or
+ *          gets a whole ring ahead of the writer. Input is read ahead as
+ *          for a buffered device.
+ *
+ *     Any device but a memory one can also be given an I/O log, to record
+ *     what passes through it, or to replay a recorded run.
+ *
+ *     This module is exported to our operations module.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_IO_INCLUDED
+#define UM_IO_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include "iolog.h"
+
+typedef struct Io_T *Io_T;
+
+/* FUNCTION:    Io_new_buffered
+ * Purpose:     create a device that buffers both directions on two file
+ *              descriptors
+ * Arg:         in_fd: the descriptor input is read from
+ *              out_fd: the descriptor output is written to
+ * Returns:     a new Io_T
+ * Effect:      N/A
+ * Exported to: Operation module and main program: the default device
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Io_T Io_new_buffered(int in_fd, int out_fd);
+
+
+/* FUNCTION:    Io_new_memory
+ * Purpose:     create a device that reads from a byte array and collects its
+ *              output in memory
+ * Arg:         input: the bytes the program will read, may be NULL if
+ *                     length is 0
+ *              length: the number of input bytes
+ * Returns:     a new Io_T
+ * Effect:      The input bytes are copied, so the caller may free them
+ * Exported to: Main program and batch runners: used for runs whose input
+ *              and output are not files
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Io_T Io_new_memory(const unsigned char *input, size_t length);
+
+
+/* FUNCTION:    Io_new_direct
+ * Purpose:     create a device that does one read() or write() per byte
+ * Arg:         in_fd: the descriptor input is read from
+ *              out_fd: the descriptor output is written to
+ * Returns:     a new Io_T
+ * Effect:      N/A
+ * Exported to: Main program: used when every byte must leave immediately
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Io_T Io_new_direct(int in_fd, int out_fd);
+
+
+/* FUNCTION:    Io_new_async
+ * Purpose:     create a device whose output is written by a thread of its
+ *              own
+ * Arg:         in_fd: the descriptor input is read from
+ *              out_fd: the descriptor output is written to
+ * Returns:     a new Io_T
+ * Effect:      Starts the writer thread. Input is read ahead as by a
+ *              buffered device. If the thread cannot be started, the device
+ *              is a buffered one instead
+ * Exported to: Main program: used to keep write() off the interpreter's
+ *              thread
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Io_T Io_new_async(int in_fd, int out_fd);
+
+
+/* FUNCTION:    Io_set_log
+ * Purpose:     record a device's input and output in a log, or replay
+ *              them from one
+ * Arg:         io: a buffered, direct or async device that has not been
+ *                  used yet
+ *              log: a recording or replaying log, which the caller keeps
+ *                   and frees after the device
+ * Returns:     N/A
+ * Effect:      A replaying device reads its input from the log instead of
+ *              its input descriptor, and stops flushing output before input
+ * Exported to: Main program: used by --record, --record-input and --replay
+ * Error:       Checked runtime error if an argument is NULL, or io is a
+ *              memory device or already has a log
+ */
+void Io_set_log(Io_T io, Iolog_T log);
+
+
+/* FUNCTION:    Io_free
+ * Purpose:     flush and free a device
+ * Arg:         io: a pointer to an Io_T
+ * Returns:     N/A
+ * Effect:      Writes out any buffered output, then frees the device and
+ *              stops its writer thread if it has one. The file descriptors
+ *              are not closed
+ * Exported to: Operation module: used when freeing an operations struct
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Io_free(Io_T *io);
+
+
+/* FUNCTION:    Io_put
+ * Purpose:     output one byte
+ * Arg:         io: the device
+ *              c: the byte
+ * Returns:     N/A
+ * Effect:      Appends the byte to the output buffer, writing the buffer out
+ *              when it is full
+ * Exported to: Operation module: used in the output instruction
+ * Error:       N/A
+ */
+void Io_put(Io_T io, unsigned char c);
+
+
+/* FUNCTION:    Io_get
+ * Purpose:     input one byte
+ * Arg:         io: the device
+ * Returns:     the byte read, or -1 at the end of input
+ * Effect:      Flushes buffered output first, so a prompt is always seen
+ *              before the program waits for an answer. Input from a mapped
+ *              file never waits, so then the output is left to be written
+ *              in full buffers
+ * Exported to: Operation module: used in the input instruction
+ * Error:       N/A
+ */
+int Io_get(Io_T io);
+
+
+/* FUNCTION:    Io_flush
+ * Purpose:     write out any buffered output
+ * Arg:         io: the device
+ * Returns:     N/A
+ * Effect:      For memory devices the output stays in memory. For async
+ *              devices, returns once the writer thread has written it all
+ * Exported to: Operation module: used when the program halts
+ * Error:       N/A
+ */
+void Io_flush(Io_T io);
+
+
+/* FUNCTION:    Io_output
+ * Purpose:     get the output collected by a memory device
+ * Arg:         io: a device made by Io_new_memory
+ *              length: set to the number of output bytes
+ * Returns:     pointer to the output bytes, owned by the device
+ * Effect:      N/A
+ * Exported to: Main program and batch runners
+ * Error:       Checked runtime error if io is not a memory device
+ */
+const unsigned char *Io_output(Io_T io, size_t *length);
+
+#endif
@@ -0,0 +1,573 @@
+/*****************************************************************************
+ *
+ *                                  iolog.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our I/O log module. A log is
+ *     a header of two words, a magic word and flags, followed by records
+ *     in host byte order. A record is a tag byte, a 32-bit length and that
+ *     many bytes: 'I' for bytes read, 'E' for input instructions that found
+ *     the end of input, with one byte each, and 'O' for bytes written.
+ *     Input and output are logged in whatever pieces the device hands
+ *     over, and a recording log keeps adding them to the record it has
+ *     open until the tag changes or the record reaches pending_size, so a
+ *     direct device's single bytes do not each cost a record. A replay
+ *     reads the input records and the output records with a cursor each,
+ *     so the two need not be interleaved the way the program did it.
+ *
+ *
+ ****************************************************************************/
+
+#include "iolog.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* the first word of a log, "UMl1" as bytes on a little-endian host */
+#define iolog_magic 0x316c4d55
+
+/* the flag set in the second word when the output is logged */
+#define outputs_flag 1
+
+/* the words before the first record */
+#define header_size (2 * sizeof(uint32_t))
+
+/* a record's tag and length */
+#define record_header (1 + sizeof(uint32_t))
+
+/* the longest record a recording log builds up before writing it */
+#define pending_size (1 << 20)
+
+/*
+ * struct definition for our Iolog struct which holds:
+ *      fd: where a recording log is written, -1 when replaying
+ *      outputs: whether output is logged
+ *      failed: set when a write to the log fails
+ *      tag, pending, pending_length: the record being built up, tag 0 if
+ *      there is none
+ *      bytes, length: the mapped file of a replaying log
+ *      next_input, next_output: where to look for the next input and
+ *      output record
+ *      input_ends: end of input results left in the current 'E' record
+ *      expected, expected_left: the rest of the current 'O' record
+ *      checked: the output bytes checked so far
+ *      diverged: whether checked is the first byte that differed
+ */
+struct Iolog_T {
+        int fd;
+        bool outputs;
+        bool failed;
+        unsigned char tag;
+        unsigned char *pending;
+        size_t pending_length;
+        const unsigned char *bytes;
+        size_t length;
+        size_t next_input;
+        size_t next_output;
+        uint32_t input_ends;
+        const unsigned char *expected;
+        size_t expected_left;
+        uint64_t checked;
+        bool diverged;
+};
+
+/* private helper functions, details can be viewed below */
+static Iolog_T new_log       (void);
+static void    append        (Iolog_T log, unsigned char tag,
+                              const unsigned char *bytes, size_t length);
+static void    write_pending (Iolog_T log);
+static void    write_record  (Iolog_T log, unsigned char tag,
+                              const unsigned char *bytes, size_t length);
+static void    write_all     (Iolog_T log, const void *bytes, size_t length);
+static bool    next_record   (Iolog_T log, size_t *position, bool output,
+                              unsigned char *tag, const unsigned char **bytes,
+                              uint32_t *length);
+
+
+/* FUNCTION:    Iolog_record
+ * Purpose:     start a log of a live run
+ * Arg:         path: the file to write the log to, replaced if it exists
+ *              outputs: whether to log the output as well as the input
+ * Returns:     a new Iolog_T, or NULL if path cannot be opened for writing
+ * Effect:      Writes the log's header
+ * Exported to: Main program: used by --record and --record-input
+ * Error:       Checked runtime error if path is NULL, or for unsuccessful
+ *              memory allocation
+ */
+Iolog_T Iolog_record(const char *path, bool outputs)
+{
+        assert(path != NULL);
+
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+                return NULL;
+        }
+
+        Iolog_T log = new_log();
+        log->fd = fd;
+        log->outputs = outputs;
+        log->pending = malloc(pending_size);
+        assert(log->pending != NULL);
+
+        uint32_t header[2] = { iolog_magic, outputs ? outputs_flag : 0 };
+        write_all(log, header, sizeof(header));
+
+        return log;
+}
+
+
+/* FUNCTION:    Iolog_replay
+ * Purpose:     open a log to replay
+ * Arg:         path: a file written by a recording log
+ * Returns:     a new Iolog_T, or NULL if path cannot be opened or is not a
+ *              whole log
+ * Effect:      Maps the file and checks every record before returning
+ * Exported to: Main program: used by --replay
+ * Error:       Checked runtime error if path is NULL, or for unsuccessful
+ *              memory allocation
+ */
+Iolog_T Iolog_replay(const char *path)
+{
+        assert(path != NULL);
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                return NULL;
+        }
+
+        struct stat meta_data;
+        void *bytes = MAP_FAILED;
+        if (fstat(fd, &meta_data) == 0 &&
+            (size_t)meta_data.st_size >= header_size) {
+                bytes = mmap(NULL, meta_data.st_size, PROT_READ, MAP_PRIVATE,
+                             fd, 0);
+        }
+        close(fd);
+        if (bytes == MAP_FAILED) {
+                return NULL;
+        }
+
+        Iolog_T log = new_log();
+        log->bytes = bytes;
+        log->length = meta_data.st_size;
+        log->next_input = log->next_output = header_size;
+
+        /* every record must have a known tag and fit in the file */
+        uint32_t header[2];
+        memcpy(header, bytes, sizeof(header));
+        bool valid = header[0] == iolog_magic &&
+                     (header[1] & ~outputs_flag) == 0;
+        size_t position = header_size;
+        while (valid && position < log->length) {
+                uint32_t length;
+                unsigned char tag = log->bytes[position];
+                valid = log->length - position >= record_header &&
+                        (tag == 'I' || tag == 'E' || tag == 'O');
+                if (valid) {
+                        memcpy(&length, log->bytes + position + 1,
+                               sizeof(length));
+                        position += record_header;
+                        valid = log->length - position >= length;
+                        position += length;
+                }
+        }
+        if (!valid) {
+                Iolog_free(&log);
+                return NULL;
+        }
+
+        log->outputs = (header[1] & outputs_flag) != 0;
+        return log;
+}
+
+
+/* FUNCTION:    Iolog_free
+ * Purpose:     close and free a log
+ * Arg:         log: a pointer to an Iolog_T
+ * Returns:     N/A
+ * Effect:      Writes out the records not written yet and closes the file
+ * Exported to: Main program: used once the device is freed
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Iolog_free(Iolog_T *log)
+{
+        assert(log != NULL && *log != NULL);
+
+        if ((*log)->fd >= 0) {
+                write_pending(*log);
+                close((*log)->fd);
+        }
+        if ((*log)->bytes != NULL) {
+                munmap((void *)(*log)->bytes, (*log)->length);
+        }
+        free((*log)->pending);
+        free(*log);
+        *log = NULL;
+}
+
+
+/* FUNCTION:    Iolog_finish
+ * Purpose:     find out whether a log did its job
+ * Arg:         log: the log, no longer attached to a live device
+ *              offset: set, when replaying, to the first byte of output
+ *                      that differs from the log's, or to how much output
+ *                      there was if it stopped short
+ * Returns:     false if a recording log could not be written in full, or
+ *              the output of a replay differs from the one logged
+ * Effect:      Writes out the records not written yet
+ * Exported to: Main program: used once the device is freed
+ * Error:       Checked runtime error if an argument is NULL
+ */
+bool Iolog_finish(Iolog_T log, uint64_t *offset)
+{
+        assert(log != NULL && offset != NULL);
+
+        if (log->fd >= 0) {
+                write_pending(log);
+                return !log->failed;
+        }
+
+        /* output that stopped short differs at its end */
+        unsigned char tag;
+        const unsigned char *bytes;
+        uint32_t length;
+        if (log->outputs && !log->diverged &&
+            (log->expected_left > 0 ||
+             next_record(log, &log->next_output, true, &tag, &bytes,
+                         &length))) {
+                log->diverged = true;
+        }
+
+        *offset = log->checked;
+        return !log->diverged;
+}
+
+
+/* FUNCTION:    Iolog_replaying
+ * Purpose:     tell a replaying log from a recording one
+ * Arg:         log: the log
+ * Returns:     true if log was opened by Iolog_replay
+ * Effect:      N/A
+ * Exported to: I/O module
+ * Error:       Checked runtime error if log is NULL
+ */
+bool Iolog_replaying(Iolog_T log)
+{
+        assert(log != NULL);
+        return log->fd < 0;
+}
+
+
+/* FUNCTION:    Iolog_input
+ * Purpose:     log bytes the program has read
+ * Arg:         log: a recording log
+ *              bytes: the bytes, in the order they were read
+ *              length: the number of bytes
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: I/O module
+ * Error:       Checked runtime error if log is NULL or replaying
+ */
+void Iolog_input(Iolog_T log, const unsigned char *bytes, size_t length)
+{
+        assert(log != NULL && log->fd >= 0);
+        append(log, 'I', bytes, length);
+}
+
+
+/* FUNCTION:    Iolog_end_of_input
+ * Purpose:     log an input instruction that found the end of input
+ * Arg:         log: a recording log
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: I/O module
+ * Error:       Checked runtime error if log is NULL or replaying
+ */
+void Iolog_end_of_input(Iolog_T log)
+{
+        assert(log != NULL && log->fd >= 0);
+
+        unsigned char end = 0;
+        append(log, 'E', &end, 1);
+}
+
+
+/* FUNCTION:    Iolog_output
+ * Purpose:     log, or check, bytes the program has written
+ * Arg:         log: the log
+ *              bytes: the bytes, in the order they were written
+ *              length: the number of bytes
+ * Returns:     N/A
+ * Effect:      A recording log keeps them if it logs output. A replaying
+ *              log compares them with the logged output and remembers the
+ *              first byte that differs; after that it checks no more
+ * Exported to: I/O module
+ * Error:       Checked runtime error if log is NULL
+ */
+void Iolog_output(Iolog_T log, const unsigned char *bytes, size_t length)
+{
+        assert(log != NULL);
+
+        if (!log->outputs) {
+                return;
+        } else if (log->fd >= 0) {
+                append(log, 'O', bytes, length);
+                return;
+        }
+
+        while (length > 0 && !log->diverged) {
+                if (log->expected_left == 0) {
+                        unsigned char tag;
+                        uint32_t record_length;
+                        if (!next_record(log, &log->next_output, true, &tag,
+                                         &log->expected, &record_length)) {
+                                /* more output than was logged */
+                                log->diverged = true;
+                                return;
+                        }
+                        log->expected_left = record_length;
+                        continue;
+                }
+
+                size_t run = length < log->expected_left ?
+                             length : log->expected_left;
+                if (memcmp(bytes, log->expected, run) != 0) {
+                        while (*bytes == *log->expected) {
+                                bytes++;
+                                log->expected++;
+                                log->checked++;
+                        }
+                        log->diverged = true;
+                        return;
+                }
+                bytes += run;
+                length -= run;
+                log->expected += run;
+                log->expected_left -= run;
+                log->checked += run;
+        }
+}
+
+
+/* FUNCTION:    Iolog_next_input
+ * Purpose:     get the next input of a replay
+ * Arg:         log: a replaying log
+ *              bytes: set to the next bytes read in the logged run, which
+ *                     stay owned by the log
+ *              length: set to the number of them, or to 0 if the next
+ *                      input instruction found the end of input
+ * Returns:     false once the logged input has all been replayed
+ * Effect:      N/A
+ * Exported to: I/O module
+ * Error:       Checked runtime error if an argument is NULL, or log is
+ *              recording
+ */
+bool Iolog_next_input(Iolog_T log, const unsigned char **bytes,
+                      size_t *length)
+{
+        assert(log != NULL && bytes != NULL && length != NULL);
+        assert(log->fd < 0);
+
+        while (log->input_ends == 0) {
+                unsigned char tag;
+                const unsigned char *record;
+                uint32_t record_length;
+                if (!next_record(log, &log->next_input, false, &tag, &record,
+                                 &record_length)) {
+                        return false;
+                }
+                if (tag == 'E') {
+                        log->input_ends = record_length;
+                } else if (record_length > 0) {
+                        *bytes = record;
+                        *length = record_length;
+                        return true;
+                }
+        }
+
+        log->input_ends--;
+        *bytes = NULL;
+        *length = 0;
+        return true;
+}
+
+
+/* FUNCTION:    new_log
+ * Purpose:     allocate a log that is neither recording nor replaying yet
+ * Arg:         N/A
+ * Returns:     a new Iolog_T
+ * Effect:      N/A
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+static Iolog_T new_log(void)
+{
+        Iolog_T log = malloc(sizeof(*log));
+        assert(log != NULL);
+
+        log->fd = -1;
+        log->outputs = false;
+        log->failed = false;
+        log->tag = 0;
+        log->pending = NULL;
+        log->pending_length = 0;
+        log->bytes = NULL;
+        log->length = 0;
+        log->next_input = 0;
+        log->next_output = 0;
+        log->input_ends = 0;
+        log->expected = NULL;
+        log->expected_left = 0;
+        log->checked = 0;
+        log->diverged = false;
+
+        return log;
+}
+
+
+/* FUNCTION:    append
+ * Purpose:     add bytes to a recording log
+ * Arg:         log: a recording log
+ *              tag: the kind of record they belong in
+ *              bytes: the bytes
+ *              length: the number of bytes
+ * Returns:     N/A
+ * Effect:      Adds them to the open record if it has the same tag and
+ *              room for them; otherwise writes that record first. Bytes
+ *              that would not fit in an empty one are written as a record
+ *              of their own
+ * Error:       N/A
+ */
+static void append(Iolog_T log, unsigned char tag,
+                   const unsigned char *bytes, size_t length)
+{
+        if (length == 0) {
+                return;
+        }
+        if (log->tag != tag || log->pending_length + length > pending_size) {
+                write_pending(log);
+        }
+        if (length >= pending_size) {
+                write_record(log, tag, bytes, length);
+                return;
+        }
+
+        log->tag = tag;
+        memcpy(log->pending + log->pending_length, bytes, length);
+        log->pending_length += length;
+}
+
+
+/* FUNCTION:    write_pending
+ * Purpose:     write out the record a recording log has open
+ * Arg:         log: a recording log
+ * Returns:     N/A
+ * Effect:      Leaves no record open
+ * Error:       N/A
+ */
+static void write_pending(Iolog_T log)
+{
+        if (log->pending_length > 0) {
+                write_record(log, log->tag, log->pending,
+                             log->pending_length);
+        }
+        log->tag = 0;
+        log->pending_length = 0;
+}
+
+
+/* FUNCTION:    write_record
+ * Purpose:     write one record to a recording log
+ * Arg:         log: a recording log
+ *              tag: the record's tag
+ *              bytes: its bytes
+ *              length: the number of bytes, which may be more than a
+ *                      record holds, so it is split
+ * Returns:     N/A
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static void write_record(Iolog_T log, unsigned char tag,
+                         const unsigned char *bytes, size_t length)
+{
+        do {
+                uint32_t part = length > UINT32_MAX ? UINT32_MAX : length;
+                unsigned char header[record_header];
+                header[0] = tag;
+                memcpy(header + 1, &part, sizeof(part));
+
+                write_all(log, header, sizeof(header));
+                write_all(log, bytes, part);
+                bytes += part;
+                length -= part;
+        } while (length > 0);
+}
+
+
+/* FUNCTION:    write_all
+ * Purpose:     write bytes to a recording log's file
+ * Arg:         log: a recording log
+ *              bytes: the bytes
+ *              length: the number of bytes
+ * Returns:     N/A
+ * Effect:      Retries short writes and interrupted calls. On any other
+ *              error the log is marked as failed and nothing more is
+ *              written
+ * Error:       N/A
+ */
+static void write_all(Iolog_T log, const void *bytes, size_t length)
+{
+        const unsigned char *next = bytes;
+
+        while (length > 0 && !log->failed) {
+                ssize_t written = write(log->fd, next, length);
+                if (written < 0) {
+                        log->failed = errno != EINTR;
+                        continue;
+                }
+                next += written;
+                length -= written;
+        }
+}
+
+
+/* FUNCTION:    next_record
+ * Purpose:     find the next output record, or input record, of a
+ *              replaying log
+ * Arg:         log: a replaying log
+ *              position: the offset to start looking at, moved past the
+ *                        record found
+ *              output: whether to look for an 'O' record, or for an 'I' or
+ *                      'E' one
+ *              tag: set to the record's tag
+ *              bytes: set to the record's bytes
+ *              length: set to the number of them
+ * Returns:     false if there is no such record left
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static bool next_record(Iolog_T log, size_t *position, bool output,
+                        unsigned char *tag, const unsigned char **bytes,
+                        uint32_t *length)
+{
+        while (*position < log->length) {
+                *tag = log->bytes[*position];
+                memcpy(length, log->bytes + *position + 1, sizeof(*length));
+                *bytes = log->bytes + *position + record_header;
+                *position += record_header + *length;
+
+                if ((*tag == 'O') == output) {
+                        return true;
+                }
+        }
+
+        return false;
+}
@@ -0,0 +1,150 @@
+/*****************************************************************************
+ *
+ *                                  iolog.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our I/O log module. A log holds what
+ *     a run read, and optionally what it wrote, so the run can be repeated
+ *     with exactly the same input at full speed: a recording log is
+ *     attached to the device of a live run and is written as the run goes,
+ *     and a replaying log is attached to the device of a later run, which
+ *     then reads its input from the log instead of its input descriptor
+ *     and has its output checked against the log's. The program still
+ *     runs its own input and output instructions through the same device.
+ *     This module is exported to our I/O module and main program.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_IOLOG_INCLUDED
+#define UM_IOLOG_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct Iolog_T *Iolog_T;
+
+/* FUNCTION:    Iolog_record
+ * Purpose:     start a log of a live run
+ * Arg:         path: the file to write the log to, replaced if it exists
+ *              outputs: whether to log the output as well as the input
+ * Returns:     a new Iolog_T, or NULL if path cannot be opened for writing
+ * Effect:      Writes the log's header
+ * Exported to: Main program: used by --record and --record-input
+ * Error:       Checked runtime error if path is NULL, or for unsuccessful
+ *              memory allocation
+ */
+Iolog_T Iolog_record(const char *path, bool outputs);
+
+
+/* FUNCTION:    Iolog_replay
+ * Purpose:     open a log to replay
+ * Arg:         path: a file written by a recording log
+ * Returns:     a new Iolog_T, or NULL if path cannot be opened or is not a
+ *              whole log
+ * Effect:      Maps the file and checks every record before returning
+ * Exported to: Main program: used by --replay
+ * Error:       Checked runtime error if path is NULL, or for unsuccessful
+ *              memory allocation
+ */
+Iolog_T Iolog_replay(const char *path);
+
+
+/* FUNCTION:    Iolog_free
+ * Purpose:     close and free a log
+ * Arg:         log: a pointer to an Iolog_T
+ * Returns:     N/A
+ * Effect:      Writes out the records not written yet and closes the file
+ * Exported to: Main program: used once the device is freed
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Iolog_free(Iolog_T *log);
+
+
+/* FUNCTION:    Iolog_finish
+ * Purpose:     find out whether a log did its job
+ * Arg:         log: the log, no longer attached to a live device
+ *              offset: set, when replaying, to the first byte of output
+ *                      that differs from the log's, or to how much output
+ *                      there was if it stopped short
+ * Returns:     false if a recording log could not be written in full, or
+ *              the output of a replay differs from the one logged
+ * Effect:      Writes out the records not written yet
+ * Exported to: Main program: used once the device is freed
+ * Error:       Checked runtime error if an argument is NULL
+ */
+bool Iolog_finish(Iolog_T log, uint64_t *offset);
+
+
+/* FUNCTION:    Iolog_replaying
+ * Purpose:     tell a replaying log from a recording one
+ * Arg:         log: the log
+ * Returns:     true if log was opened by Iolog_replay
+ * Effect:      N/A
+ * Exported to: I/O module
+ * Error:       Checked runtime error if log is NULL
+ */
+bool Iolog_replaying(Iolog_T log);
+
+
+/* FUNCTION:    Iolog_input
+ * Purpose:     log bytes the program has read
+ * Arg:         log: a recording log
+ *              bytes: the bytes, in the order they were read
+ *              length: the number of bytes
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: I/O module
+ * Error:       Checked runtime error if log is NULL or replaying
+ */
+void Iolog_input(Iolog_T log, const unsigned char *bytes, size_t length);
+
+
+/* FUNCTION:    Iolog_end_of_input
+ * Purpose:     log an input instruction that found the end of input
+ * Arg:         log: a recording log
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: I/O module
+ * Error:       Checked runtime error if log is NULL or replaying
+ */
+void Iolog_end_of_input(Iolog_T log);
+
+
+/* FUNCTION:    Iolog_output
+ * Purpose:     log, or check, bytes the program has written
+ * Arg:         log: the log
+ *              bytes: the bytes, in the order they were written
+ *              length: the number of bytes
+ * Returns:     N/A
+ * Effect:      A recording log keeps them if it logs output. A replaying
+ *              log compares them with the logged output and remembers the
+ *              first byte that differs; after that it checks no more
+ * Exported to: I/O module
+ * Error:       Checked runtime error if log is NULL
+ */
+void Iolog_output(Iolog_T log, const unsigned char *bytes, size_t length);
+
+
+/* FUNCTION:    Iolog_next_input
+ * Purpose:     get the next input of a replay
+ * Arg:         log: a replaying log
+ *              bytes: set to the next bytes read in the logged run, which
+ *                     stay owned by the log
+ *              length: set to the number of them, or to 0 if the next
+ *                      input instruction found the end of input
+ * Returns:     false once the logged input has all been replayed
+ * Effect:      N/A
+ * Exported to: I/O module
+ * Error:       Checked runtime error if an argument is NULL, or log is
+ *              recording
+ */
+bool Iolog_next_input(Iolog_T log, const unsigned char **bytes,
+                      size_t *length);
+
+#endif
@@ -0,0 +1,1031 @@
+/*****************************************************************************
+ *
+ *                                  jit.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our JIT module. The UM registers
+ *     live in host registers while compiled code runs: r0-r5 in the callee
+ *     saved rbx, rbp and r12-r15, and r6-r7 in r8 and r9, which are pushed
+ *     around the few calls made from compiled code. A block is compiled the
+ *     first time execution reaches its first instruction and is entered
+ *     through code_at, a table with one entry per word of segment 0. A LOADP
+ *     within segment 0 jumps through the same table, so once its target is
+ *     compiled the jump never leaves the code cache. Segmented loads and
+ *     stores index the memory module's segment table directly. A store to
+ *     segment 0 calls back into C to store the word and decode it again;
+ *     if a block was compiled from that word the whole code cache is thrown
+ *     away and the block leaves straight after the store. Stores to words
+ *     still shared with another segment, division by zero, bad unmaps,
+ *     HALT, IN and OUT leave compiled code and are run by the interpreter.
+ *     A new segment 0 also throws the code cache away. An entry the
+ *     operations module fused into a superinstruction is compiled as the
+ *     LV it starts with.
+ *
+ *     Every block starts by taking its length off the step budget, and
+ *     gives back what it did not execute when it leaves early, so budgets
+ *     are exact. A block that does not fit in what is left of the budget is
+ *     not entered at all.
+ *
+ *     Only x86-64 hosts are supported; elsewhere Jit_new returns NULL.
+ *
+ *
+ ****************************************************************************/
+
+#include "jit.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+/* the size of the code cache */
+#define cache_size (16 << 20)
+
+/* the most instructions compiled into one block */
+#define max_block 256
+
+/* the most code one instruction compiles to, its exit stubs included: an
+   SSTORE with extended registers takes 165 bytes */
+#define max_instruction_code 192
+
+/* more than the largest block can take, its entry and exit included */
+#define block_room (max_block * max_instruction_code + 256)
+
+/* returned by compiled code that jumped to a block not compiled yet */
+#define JIT_LOOKUP 2
+
+/* host register numbers, as encoded in instructions */
+enum { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* the host register holding each UM register */
+static const int host_reg[8] = { RBX, RBP, R12, R13, R14, R15, R8, R9 };
+
+/* the UM opcodes, as in the decoded program */
+enum { CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV, NAND, HALT, ACTIVATE,
+       INACTIVATE, OUT, IN, LOADP, LV };
+
+/* condition codes for jcc */
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5 };
+
+/* the trampoline into compiled code: returns the reason it came back */
+typedef int (*Jit_entry)(unsigned char *code);
+
+/*
+ * a place in a block that leaves it to have the interpreter run the
+ * instruction at pc:
+ *      patch: the rel32 fields of the jumps to the stub
+ *      num_patches: how many of them there are
+ *      pc: the instruction to resume at
+ *      refund: how many instructions charged to the budget were not run
+ */
+typedef struct Exit_site {
+        unsigned char *patch[2];
+        int num_patches;
+        uint32_t pc;
+        uint32_t refund;
+} Exit_site;
+
+/*
+ * struct definition for our Jit struct which holds:
+ *      code: the executable code cache, which starts with the trampoline
+ *            and the shared exit stub
+ *      emit: where the next byte of code goes
+ *      first_block: where compiled blocks start in the cache
+ *      exit_stub: where compiled code goes to return to Jit_run
+ *      enter: the trampoline
+ *      op, memory, registers: the machine, its memory and its registers
+ *      program, length: the decoded copy of segment 0
+ *      taken: the jump count of each word of segment 0
+ *      code_at: for each word of segment 0, the block starting there or NULL
+ *      covered: for each word of segment 0, nonzero if a block was compiled
+ *               from it
+ *      flushes: how many times the cache was thrown away
+ *      remaining: the step budget while compiled code runs
+ *      exit_pc: where compiled code stopped, or in a guarded build the
+ *               first instruction of the block it is running
+ *      sites, num_sites: the early exits of the block being compiled
+ */
+struct Jit_T {
+        unsigned char *code;
+        unsigned char *emit;
+        unsigned char *first_block;
+        unsigned char *exit_stub;
+        Jit_entry enter;
+        Operations_T op;
+        Memory_T memory;
+        uint32_t *registers;
+        const Um_decoded *program;
+        uint64_t *taken;
+        uint32_t length;
+        unsigned char **code_at;
+        unsigned char *covered;
+        uint64_t flushes;
+        uint64_t remaining;
+        uint32_t exit_pc;
+        Exit_site sites[2 * max_block + 1];
+        int num_sites;
+};
+
+/* emits a list of bytes */
+#define EMIT(jit, ...)                                                  \
+        emit_bytes((jit), (const unsigned char[]){ __VA_ARGS__ },      \
+                   sizeof((const unsigned char[]){ __VA_ARGS__ }))
+
+/* private helper functions, details can be viewed below */
+static void           flush        (Jit_T jit);
+static void           emit_stubs   (Jit_T jit);
+static unsigned char *compile_block(Jit_T jit, uint32_t start);
+static void           compile_one  (Jit_T jit, Um_decoded ins, uint32_t pc,
+                                    uint32_t refund);
+static void           emit_chain   (Jit_T jit);
+static Exit_site     *new_site     (Jit_T jit, uint32_t pc, uint32_t refund);
+static void           add_patch    (Exit_site *site, unsigned char *patch);
+static int            unmap_checked(Memory_T memory, uint32_t seg_id);
+static int            store_code   (Jit_T jit, uint32_t index,
+                                    uint32_t value);
+static void           emit_bytes   (Jit_T jit, const unsigned char *bytes,
+                                    size_t length);
+static void           emit_imm32   (Jit_T jit, uint32_t value);
+static void           emit_imm64   (Jit_T jit, uint64_t value);
+static void           emit_rex     (Jit_T jit, int w, int reg, int index,
+                                    int base);
+static void           emit_rr      (Jit_T jit, unsigned opcode, int reg,
+                                    int rm);
+static void           mov_ri       (Jit_T jit, int reg, uint32_t value);
+static void           mov_ri64     (Jit_T jit, int reg, uint64_t value);
+static unsigned char *emit_jcc     (Jit_T jit, unsigned cc);
+static unsigned char *emit_jmp_fwd (Jit_T jit);
+static void           emit_jmp     (Jit_T jit, unsigned char *target);
+static void           patch_rel32  (unsigned char *patch,
+                                    unsigned char *target);
+static void           segment_entry(Jit_T jit, int seg_reg);
+
+
+/* FUNCTION:    Jit_new
+ * Purpose:     create a compiler for one machine
+ * Arg:         op: the machine. Compiled loads and stores use its segment
+ *                  table directly, its registers are loaded into host
+ *                  registers when compiled code starts and saved back when
+ *                  it returns, and stores to segment 0 go through
+ *                  Operations_store
+ * Returns:     a new Jit_T, or NULL if this host cannot run generated code
+ * Effect:      Maps the code cache. No program is compiled until Jit_reset
+ * Exported to: Operation module: used the first time the JIT engine runs
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Jit_T Jit_new(Operations_T op)
+{
+        assert(op != NULL);
+
+        /* compiled code scales segment IDs by 16 to index the table */
+        assert(sizeof(Segment) == 16);
+
+        void *code = mmap(NULL, cache_size,
+                          PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+                return NULL;
+        }
+
+        Jit_T jit = malloc(sizeof(*jit));
+        assert(jit != NULL);
+
+        jit->code = code;
+        jit->emit = code;
+        jit->op = op;
+        jit->memory = Operations_memory(op);
+        jit->registers = Operations_registers(op);
+        jit->program = NULL;
+        jit->taken = NULL;
+        jit->length = 0;
+        jit->code_at = NULL;
+        jit->covered = NULL;
+        jit->flushes = 0;
+        jit->remaining = 0;
+        jit->exit_pc = 0;
+        jit->num_sites = 0;
+
+        emit_stubs(jit);
+        jit->first_block = jit->emit;
+
+        return jit;
+}
+
+
+/* FUNCTION:    Jit_free
+ * Purpose:     free a compiler and its code cache
+ * Arg:         jit: a pointer to a Jit_T
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: Operation module: used when freeing an operations struct
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Jit_free(Jit_T *jit)
+{
+        assert(jit != NULL && *jit != NULL);
+
+        munmap((*jit)->code, cache_size);
+        free((*jit)->code_at);
+        free((*jit)->covered);
+        free(*jit);
+        *jit = NULL;
+}
+
+
+/* FUNCTION:    Jit_reset
+ * Purpose:     start over with a new segment 0
+ * Arg:         jit: the compiler
+ *              program: the decoded copy of segment 0, with its INVALID entry
+ *                       past the end
+ *              taken: the jump count of each word, which compiled LOADPs
+ *                     within segment 0 add to
+ *              length: the number of words in segment 0
+ * Returns:     N/A
+ * Effect:      Throws away all generated code
+ * Exported to: Operation module: used whenever segment 0 is decoded again
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+void Jit_reset(Jit_T jit, const Um_decoded *program, uint64_t *taken,
+               uint32_t length)
+{
+        assert(jit != NULL && program != NULL && taken != NULL);
+
+        /* one more entry than words, for the INVALID entry past the end */
+        size_t entries = (size_t)length + 1;
+
+        free(jit->code_at);
+        free(jit->covered);
+        jit->code_at = calloc(entries, sizeof(*jit->code_at));
+        jit->covered = calloc(entries, sizeof(*jit->covered));
+        assert(jit->code_at != NULL && jit->covered != NULL);
+
+        jit->program = program;
+        jit->taken = taken;
+        jit->length = length;
+        jit->emit = jit->first_block;
+}
+
+
+/* FUNCTION:    Jit_invalidate
+ * Purpose:     note that a word of segment 0 was stored to
+ * Arg:         jit: the compiler
+ *              index: the index of the word in segment 0
+ * Returns:     N/A
+ * Effect:      Throws away all generated code if any block was compiled
+ *              from that word
+ * Exported to: Operation module: used after every store to segment 0
+ * Error:       N/A
+ */
+void Jit_invalidate(Jit_T jit, uint32_t index)
+{
+        assert(jit != NULL);
+
+        if (index < jit->length && jit->covered[index]) {
+                flush(jit);
+        }
+}
+
+
+/* FUNCTION:    Jit_run
+ * Purpose:     run compiled code until it needs the interpreter
+ * Arg:         jit: the compiler
+ *              pc: the index in segment 0 to start at, set to where the run
+ *                  stopped
+ *              remaining: the step budget, reduced by the number of
+ *                         instructions executed
+ * Returns:     the reason the run stopped
+ * Effect:      Compiles blocks as they are reached. The machine's registers
+ *              are up to date when it returns
+ * Exported to: Operation module: the JIT engine
+ * Error:       N/A
+ */
+Jit_exit Jit_run(Jit_T jit, uint32_t *pc, uint64_t *remaining)
+{
+        assert(jit != NULL && jit->program != NULL);
+        assert(*pc <= jit->length);
+
+        uint32_t at = *pc;
+        int reason;
+
+        jit->remaining = *remaining;
+        do {
+                unsigned char *code = jit->code_at[at];
+                if (code == NULL) {
+                        code = compile_block(jit, at);
+                }
+                reason = jit->enter(code);
+                at = jit->exit_pc;
+        } while (reason == JIT_LOOKUP);
+
+        *pc = at;
+        *remaining = jit->remaining;
+        return reason;
+}
+
+
+/* FUNCTION:    Jit_fault_pc
+ * Purpose:     find where a run that trapped was
+ * Arg:         jit: the compiler
+ * Returns:     the first instruction of the block compiled code entered
+ *              last, in a build made with GUARDED=1; otherwise the pc
+ *              the last run stopped at
+ * Effect:      N/A
+ * Exported to: Operation module: used when a guarded load or store in
+ *              compiled code traps, since Jit_run does not return then
+ * Error:       Checked runtime error if jit is NULL
+ */
+uint32_t Jit_fault_pc(Jit_T jit)
+{
+        assert(jit != NULL);
+
+        return jit->exit_pc;
+}
+
+
+/* FUNCTION:    Jit_contains
+ * Purpose:     tell whether a host address is in compiled code
+ * Arg:         jit: the compiler
+ *              address: the host address, e.g. of a trapping instruction
+ * Returns:     true if address is in the code cache
+ * Effect:      N/A. Only reads the compiler, so it can be called from a
+ *              signal handler
+ * Exported to: Operation module: used by the SIGSEGV handler of a guarded
+ *              build to tell a trap in compiled code from a bug elsewhere
+ * Error:       N/A
+ */
+bool Jit_contains(Jit_T jit, const void *address)
+{
+        uintptr_t at = (uintptr_t)address;
+        uintptr_t code = (uintptr_t)jit->code;
+
+        return at >= code && at - code < cache_size;
+}
+
+
+/* FUNCTION:    flush
+ * Purpose:     throw away every compiled block
+ * Arg:         jit: the compiler
+ * Returns:     N/A
+ * Effect:      Clears code_at and covered and reuses the cache from the
+ *              first block on. The trampoline and exit stub are kept
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void flush(Jit_T jit)
+{
+        size_t entries = (size_t)jit->length + 1;
+
+        memset(jit->code_at, 0, entries * sizeof(*jit->code_at));
+        memset(jit->covered, 0, entries * sizeof(*jit->covered));
+        jit->emit = jit->first_block;
+        jit->flushes++;
+}
+
+
+/* FUNCTION:    emit_stubs
+ * Purpose:     generate the trampoline into compiled code and the exit stub
+ *              out of it
+ * Arg:         jit: the compiler
+ * Returns:     N/A
+ * Effect:      The trampoline saves the callee-saved registers, loads the
+ *              UM registers and jumps to the block passed in rdi. The exit
+ *              stub takes the pc in eax and the reason in edx, saves the UM
+ *              registers and the pc, and returns the reason
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void emit_stubs(Jit_T jit)
+{
+        unsigned char *enter = jit->emit;
+
+        EMIT(jit, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55,     /* push rbx..r13 */
+                  0x41, 0x56, 0x41, 0x57,                 /* push r14, r15 */
+                  0x48, 0x83, 0xEC, 0x08);                /* sub rsp, 8 */
+        mov_ri64(jit, RCX, (uintptr_t)jit->registers);
+        for (int i = 0; i < 8; i++) {
+                /* mov r32, [rcx + 4 * i] */
+                emit_rex(jit, 0, host_reg[i], 0, RCX);
+                EMIT(jit, 0x8B, 0x40 | (host_reg[i] & 7) << 3 | RCX, 4 * i);
+        }
+        EMIT(jit, 0xFF, 0xE7);                            /* jmp rdi */
+
+        jit->exit_stub = jit->emit;
+        mov_ri64(jit, RCX, (uintptr_t)jit->registers);
+        for (int i = 0; i < 8; i++) {
+                /* mov [rcx + 4 * i], r32 */
+                emit_rex(jit, 0, host_reg[i], 0, RCX);
+                EMIT(jit, 0x89, 0x40 | (host_reg[i] & 7) << 3 | RCX, 4 * i);
+        }
+        mov_ri64(jit, RCX, (uintptr_t)&jit->exit_pc);
+        EMIT(jit, 0x89, 0x01,                             /* mov [rcx], eax */
+                  0x89, 0xD0,                             /* mov eax, edx */
+                  0x48, 0x83, 0xC4, 0x08,                 /* add rsp, 8 */
+                  0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D,     /* pop r15..r13 */
+                  0x41, 0x5C, 0x5D, 0x5B,                 /* pop r12..rbx */
+                  0xC3);                                  /* ret */
+
+        /* object and function pointers do not convert directly in ISO C */
+        memcpy(&jit->enter, &enter, sizeof(jit->enter));
+}
+
+
+/* FUNCTION:    compile_block
+ * Purpose:     compile the block that starts at a word of segment 0
+ * Arg:         jit: the compiler
+ *              start: the index of the block's first instruction
+ * Returns:     the block's code
+ * Effect:      Records the block in code_at and marks the words it was
+ *              compiled from in covered. Flushes the cache first if it is
+ *              nearly full
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static unsigned char *compile_block(Jit_T jit, uint32_t start)
+{
+        if (jit->emit + block_room > jit->code + cache_size) {
+                flush(jit);
+        }
+
+        /* find the end of the block and how many instructions it charges */
+        uint32_t end = start;
+        while (end - start < max_block) {
+                unsigned opcode = UM_PLAIN_OPCODE(jit->program[end]);
+                if (opcode == HALT || opcode == IN || opcode == OUT ||
+                    opcode > LV) {
+                        break;
+                }
+#ifdef UM_CHECKED
+                /* the interpreter checks the bounds of loads and stores */
+                if (opcode == SLOAD || opcode == SSTORE) {
+                        break;
+                }
+#endif
+                end++;
+                if (opcode == LOADP) {
+                        break;
+                }
+        }
+        uint32_t charge = end - start;
+
+        unsigned char *code = jit->emit;
+        jit->code_at[start] = code;
+        memset(jit->covered + start, 1, charge);
+        jit->num_sites = 0;
+
+        if (charge > 0) {
+                /* if (remaining < charge) leave; remaining -= charge */
+                Exit_site *site = new_site(jit, start, 0);
+                mov_ri64(jit, RAX, (uintptr_t)&jit->remaining);
+                EMIT(jit, 0x48, 0x81, 0x38);
+                emit_imm32(jit, charge);
+                add_patch(site, emit_jcc(jit, CC_B));
+                EMIT(jit, 0x48, 0x81, 0x28);
+                emit_imm32(jit, charge);
+
+#ifdef UM_GUARDED
+                /* a trap leaves through the SIGSEGV handler, not the exit
+                   stub, so the block says where it is as it starts */
+                mov_ri64(jit, RAX, (uintptr_t)&jit->exit_pc);
+                EMIT(jit, 0xC7, 0x00);                    /* mov [rax], */
+                emit_imm32(jit, start);                   /* start */
+#endif
+        }
+
+        for (uint32_t pc = start; pc < end; pc++) {
+                compile_one(jit, jit->program[pc], pc, end - pc);
+        }
+
+        Um_decoded last = jit->program[end - (charge > 0)];
+        if (charge == 0 || last.opcode != LOADP) {
+                /* the block stopped at an instruction for the interpreter
+                   or at the size limit: go on at the next instruction */
+                mov_ri(jit, RAX, end);
+                if (charge == max_block) {
+                        emit_chain(jit);
+                } else {
+                        mov_ri(jit, RDX, JIT_INTERPRET);
+                        emit_jmp(jit, jit->exit_stub);
+                }
+        }
+
+        /* the stubs for the early exits go after the block */
+        for (int i = 0; i < jit->num_sites; i++) {
+                Exit_site *site = &jit->sites[i];
+                for (int j = 0; j < site->num_patches; j++) {
+                        patch_rel32(site->patch[j], jit->emit);
+                }
+                if (site->refund > 0) {
+                        mov_ri64(jit, RAX, (uintptr_t)&jit->remaining);
+                        EMIT(jit, 0x48, 0x81, 0x00);
+                        emit_imm32(jit, site->refund);
+                }
+                mov_ri(jit, RAX, site->pc);
+                mov_ri(jit, RDX, (i == 0 && charge > 0) ? JIT_BUDGET
+                                                        : JIT_INTERPRET);
+                emit_jmp(jit, jit->exit_stub);
+        }
+
+        assert(jit->emit <= code + block_room);
+        return code;
+}
+
+
+/* FUNCTION:    compile_one
+ * Purpose:     compile one instruction of a block
+ * Arg:         jit: the compiler
+ *              ins: the decoded instruction
+ *              pc: its index in segment 0
+ *              refund: the instructions of the block not run if it leaves
+ *                      before this one
+ * Returns:     N/A
+ * Effect:      Appends the instruction's code, and its early exits to
+ *              jit->sites
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void compile_one(Jit_T jit, Um_decoded ins, uint32_t pc,
+                        uint32_t refund)
+{
+        int ra = host_reg[ins.a];
+        int rb = host_reg[ins.b];
+        int rc = host_reg[ins.c];
+        Exit_site *site;
+
+        switch (UM_PLAIN_OPCODE(ins)) {
+        case CMOV:
+                emit_rr(jit, 0x85, rc, rc);               /* test rc, rc */
+                emit_rr(jit, 0x0F45, ra, rb);             /* cmovne ra, rb */
+                break;
+        case SLOAD:
+                segment_entry(jit, rb);
+                EMIT(jit, 0x48, 0x8B, 0x00);              /* mov rax, [rax] */
+                emit_rr(jit, 0x89, rc, RCX);              /* mov ecx, rc */
+                emit_rex(jit, 0, ra, RCX, RAX);           /* mov ra, */
+                EMIT(jit, 0x8B, 0x04 | (ra & 7) << 3, 0x88); /* [rax+rcx*4] */
+                break;
+        case SSTORE: {
+                emit_rr(jit, 0x85, ra, ra);               /* test ra, ra */
+                unsigned char *not_code = emit_jcc(jit, CC_NE);
+
+                /* segment 0: store_code(jit, rb, rc), which leaves the
+                   block if the store threw the code cache away */
+                site = new_site(jit, pc + 1, refund - 1);
+                emit_rr(jit, 0x89, rc, RDX);              /* mov edx, rc */
+                emit_rr(jit, 0x89, rb, RSI);              /* mov esi, rb */
+                mov_ri64(jit, RDI, (uintptr_t)jit);
+                mov_ri64(jit, RAX, (uintptr_t)&store_code);
+                EMIT(jit, 0x41, 0x50, 0x41, 0x51,         /* push r8, r9 */
+                          0xFF, 0xD0,                     /* call rax */
+                          0x41, 0x59, 0x41, 0x58,         /* pop r9, r8 */
+                          0x85, 0xC0);                    /* test eax, eax */
+                add_patch(site, emit_jcc(jit, CC_NE));
+                unsigned char *done = emit_jmp_fwd(jit);
+
+                /* other segments: words shared by a LOADP need the
+                   interpreter to copy them first */
+                patch_rel32(not_code, jit->emit);
+                site = new_site(jit, pc, refund);
+                segment_entry(jit, ra);
+                EMIT(jit, 0x83, 0x78, offsetof(Segment, shared), 0x00);
+                add_patch(site, emit_jcc(jit, CC_NE));    /* shared? */
+                EMIT(jit, 0x48, 0x8B, 0x00);              /* mov rax, [rax] */
+                emit_rr(jit, 0x89, rb, RCX);              /* mov ecx, rb */
+                emit_rex(jit, 0, rc, RCX, RAX);           /* mov [rax+rcx*4], */
+                EMIT(jit, 0x89, 0x04 | (rc & 7) << 3, 0x88); /* rc */
+                patch_rel32(done, jit->emit);
+                break;
+        }
+        case ADD:
+        case MUL:
+        case NAND:
+                emit_rr(jit, 0x89, rb, RAX);              /* mov eax, rb */
+                if (ins.opcode == ADD) {
+                        emit_rr(jit, 0x01, rc, RAX);      /* add eax, rc */
+                } else if (ins.opcode == MUL) {
+                        emit_rr(jit, 0x0FAF, RAX, rc);    /* imul eax, rc */
+                } else {
+                        emit_rr(jit, 0x21, rc, RAX);      /* and eax, rc */
+                        EMIT(jit, 0xF7, 0xD0);            /* not eax */
+                }
+                emit_rr(jit, 0x89, RAX, ra);              /* mov ra, eax */
+                break;
+        case DIV:
+                site = new_site(jit, pc, refund);
+                emit_rr(jit, 0x89, rc, RCX);              /* mov ecx, rc */
+                emit_rr(jit, 0x85, RCX, RCX);             /* test ecx, ecx */
+                add_patch(site, emit_jcc(jit, CC_E));
+                emit_rr(jit, 0x89, rb, RAX);              /* mov eax, rb */
+                EMIT(jit, 0x31, 0xD2, 0xF7, 0xF1);        /* xor edx; div */
+                emit_rr(jit, 0x89, RAX, ra);              /* mov ra, eax */
+                break;
+        case ACTIVATE:
+                emit_rr(jit, 0x89, rc, RDI);              /* mov edi, rc */
+                mov_ri64(jit, RSI, (uintptr_t)jit->memory);
+                mov_ri64(jit, RAX, (uintptr_t)&new_segment);
+                EMIT(jit, 0x41, 0x50, 0x41, 0x51,         /* push r8, r9 */
+                          0xFF, 0xD0,                     /* call rax */
+                          0x41, 0x59, 0x41, 0x58);        /* pop r9, r8 */
+                emit_rr(jit, 0x89, RAX, rb);              /* mov rb, eax */
+                break;
+        case INACTIVATE:
+                site = new_site(jit, pc, refund);
+                emit_rr(jit, 0x89, rc, RSI);              /* mov esi, rc */
+                mov_ri64(jit, RDI, (uintptr_t)jit->memory);
+                mov_ri64(jit, RAX, (uintptr_t)&unmap_checked);
+                EMIT(jit, 0x41, 0x50, 0x41, 0x51,         /* push r8, r9 */
+                          0xFF, 0xD0,                     /* call rax */
+                          0x41, 0x59, 0x41, 0x58,         /* pop r9, r8 */
+                          0x85, 0xC0);                    /* test eax, eax */
+                add_patch(site, emit_jcc(jit, CC_E));
+                break;
+        case LOADP:
+                /* a new segment 0 or a bad target needs the interpreter */
+                site = new_site(jit, pc, refund);
+                emit_rr(jit, 0x85, rb, rb);               /* test rb, rb */
+                add_patch(site, emit_jcc(jit, CC_NE));
+                emit_rr(jit, 0x89, rc, RAX);              /* mov eax, rc */
+                EMIT(jit, 0x3D);                          /* cmp eax, */
+                emit_imm32(jit, jit->length);             /* length */
+                add_patch(site, emit_jcc(jit, CC_AE));
+                mov_ri64(jit, RCX, (uintptr_t)&jit->taken[pc]);
+                EMIT(jit, 0x48, 0xFF, 0x01);              /* inc qword [rcx] */
+                emit_chain(jit);
+                break;
+        case LV:
+                mov_ri(jit, ra, ins.value);
+                break;
+        default:
+                /* compile_block ends blocks before every other opcode */
+                assert(0);
+        }
+}
+
+
+/* FUNCTION:    emit_chain
+ * Purpose:     jump to the block for the pc in eax
+ * Arg:         jit: the compiler
+ * Returns:     N/A
+ * Effect:      Emits a jump through code_at that stays in the cache when
+ *              the target is compiled, and returns JIT_LOOKUP to Jit_run
+ *              when it is not
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void emit_chain(Jit_T jit)
+{
+        mov_ri64(jit, RCX, (uintptr_t)jit->code_at);
+        EMIT(jit, 0x48, 0x8B, 0x0C, 0xC1,                 /* mov rcx, */
+                                                          /* [rcx+rax*8] */
+                  0x48, 0x85, 0xC9,                       /* test rcx, rcx */
+                  0x74, 0x02,                             /* jz +2 */
+                  0xFF, 0xE1);                            /* jmp rcx */
+        mov_ri(jit, RDX, JIT_LOOKUP);
+        emit_jmp(jit, jit->exit_stub);
+}
+
+
+/* FUNCTION:    segment_entry
+ * Purpose:     point rax at the segment table entry for a segment ID
+ * Arg:         jit: the compiler
+ *              seg_reg: the host register holding the segment ID
+ * Returns:     N/A
+ * Effect:      Clobbers rax and rcx
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void segment_entry(Jit_T jit, int seg_reg)
+{
+        mov_ri64(jit, RAX, (uintptr_t)segment_table(jit->memory));
+        EMIT(jit, 0x48, 0x8B, 0x00);                      /* mov rax, [rax] */
+        emit_rr(jit, 0x89, seg_reg, RCX);                 /* mov ecx, seg */
+        EMIT(jit, 0x48, 0xC1, 0xE1, 0x04,                 /* shl rcx, 4 */
+                  0x48, 0x01, 0xC8);                      /* add rax, rcx */
+}
+
+
+/* FUNCTION:    new_site
+ * Purpose:     start a new early exit for the block being compiled
+ * Arg:         jit: the compiler
+ *              pc: the instruction the interpreter resumes at
+ *              refund: the instructions charged but not run
+ * Returns:     the exit site, with no jumps to it yet
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static Exit_site *new_site(Jit_T jit, uint32_t pc, uint32_t refund)
+{
+        assert(jit->num_sites < 2 * max_block + 1);
+
+        Exit_site *site = &jit->sites[jit->num_sites++];
+        site->num_patches = 0;
+        site->pc = pc;
+        site->refund = refund;
+
+        return site;
+}
+
+
+/* FUNCTION:    add_patch
+ * Purpose:     record a jump to an exit site
+ * Arg:         site: the exit site
+ *              patch: the rel32 field of the jump
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void add_patch(Exit_site *site, unsigned char *patch)
+{
+        assert(site->num_patches < 2);
+
+        site->patch[site->num_patches++] = patch;
+}
+
+
+/* FUNCTION:    unmap_checked
+ * Purpose:     unmap a segment for compiled code, unless that would fail
+ * Arg:         memory: the machine's memory
+ *              seg_id: the segment to unmap
+ * Returns:     1 if the segment was unmapped, 0 if it is segment 0 or not
+ *              mapped, in which case the interpreter reports the failure
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static int unmap_checked(Memory_T memory, uint32_t seg_id)
+{
+        if (seg_id == 0 || !segment_mapped(seg_id, memory)) {
+                return 0;
+        }
+
+        remove_segment(seg_id, memory);
+        return 1;
+}
+
+
+/* FUNCTION:    store_code
+ * Purpose:     store a word of segment 0 for compiled code
+ * Arg:         jit: the compiler
+ *              index: the index of the word in segment 0
+ *              value: the word to store
+ * Returns:     1 if a block had been compiled from the word, in which case
+ *              all code is thrown away and the caller must leave its block,
+ *              0 otherwise
+ * Effect:      Stores the word through the operations module, which
+ *              decodes it again and calls Jit_invalidate
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static int store_code(Jit_T jit, uint32_t index, uint32_t value)
+{
+        uint64_t flushes = jit->flushes;
+
+        Operations_store(jit->op, 0, index, value);
+
+        return jit->flushes != flushes;
+}
+
+
+/* FUNCTION:    emit_bytes
+ * Purpose:     append bytes to the code cache
+ * Arg:         jit: the compiler
+ *              bytes, length: the bytes
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void emit_bytes(Jit_T jit, const unsigned char *bytes, size_t length)
+{
+        memcpy(jit->emit, bytes, length);
+        jit->emit += length;
+}
+
+
+/* FUNCTION:    emit_imm32 / emit_imm64
+ * Purpose:     append a little-endian immediate to the code cache
+ * Arg:         jit: the compiler
+ *              value: the immediate
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void emit_imm32(Jit_T jit, uint32_t value)
+{
+        memcpy(jit->emit, &value, sizeof(value));
+        jit->emit += sizeof(value);
+}
+
+static void emit_imm64(Jit_T jit, uint64_t value)
+{
+        memcpy(jit->emit, &value, sizeof(value));
+        jit->emit += sizeof(value);
+}
+
+
+/* FUNCTION:    emit_rex
+ * Purpose:     append a REX prefix if the operands need one
+ * Arg:         jit: the compiler
+ *              w: 1 for a 64-bit operation
+ *              reg, index, base: the registers in the reg, SIB index and
+ *                                r/m or SIB base fields
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void emit_rex(Jit_T jit, int w, int reg, int index, int base)
+{
+        unsigned rex = 0x40 | w << 3 | (reg >> 3) << 2 | (index >> 3) << 1 |
+                       base >> 3;
+        if (rex != 0x40) {
+                EMIT(jit, rex);
+        }
+}
+
+
+/* FUNCTION:    emit_rr
+ * Purpose:     append a 32-bit instruction with two register operands
+ * Arg:         jit: the compiler
+ *              opcode: the opcode, with 0x0F in the high byte for two-byte
+ *                      opcodes
+ *              reg: the register in the reg field
+ *              rm: the register in the r/m field
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void emit_rr(Jit_T jit, unsigned opcode, int reg, int rm)
+{
+        emit_rex(jit, 0, reg, 0, rm);
+        if (opcode > 0xFF) {
+                EMIT(jit, opcode >> 8);
+        }
+        EMIT(jit, opcode & 0xFF, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+
+/* FUNCTION:    mov_ri / mov_ri64
+ * Purpose:     append a move of an immediate into a register
+ * Arg:         jit: the compiler
+ *              reg: the register
+ *              value: the immediate
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void mov_ri(Jit_T jit, int reg, uint32_t value)
+{
+        emit_rex(jit, 0, 0, 0, reg);
+        EMIT(jit, 0xB8 | (reg & 7));
+        emit_imm32(jit, value);
+}
+
+static void mov_ri64(Jit_T jit, int reg, uint64_t value)
+{
+        emit_rex(jit, 1, 0, 0, reg);
+        EMIT(jit, 0xB8 | (reg & 7));
+        emit_imm64(jit, value);
+}
+
+
+/* FUNCTION:    emit_jcc
+ * Purpose:     append a conditional jump whose target is set later
+ * Arg:         jit: the compiler
+ *              cc: the condition code
+ * Returns:     the jump's rel32 field, for patch_rel32
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static unsigned char *emit_jcc(Jit_T jit, unsigned cc)
+{
+        EMIT(jit, 0x0F, 0x80 | cc);
+        unsigned char *patch = jit->emit;
+        emit_imm32(jit, 0);
+
+        return patch;
+}
+
+
+/* FUNCTION:    emit_jmp_fwd
+ * Purpose:     append a jump whose target is set later
+ * Arg:         jit: the compiler
+ * Returns:     the jump's rel32 field, for patch_rel32
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static unsigned char *emit_jmp_fwd(Jit_T jit)
+{
+        EMIT(jit, 0xE9);
+        unsigned char *patch = jit->emit;
+        emit_imm32(jit, 0);
+
+        return patch;
+}
+
+
+/* FUNCTION:    emit_jmp
+ * Purpose:     append a jump to code already in the cache
+ * Arg:         jit: the compiler
+ *              target: where to jump
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void emit_jmp(Jit_T jit, unsigned char *target)
+{
+        EMIT(jit, 0xE9);
+        unsigned char *patch = jit->emit;
+        emit_imm32(jit, 0);
+        patch_rel32(patch, target);
+}
+
+
+/* FUNCTION:    patch_rel32
+ * Purpose:     point a jump at its target
+ * Arg:         patch: the jump's rel32 field, the last bytes of the jump
+ *              target: where to jump
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void patch_rel32(unsigned char *patch, unsigned char *target)
+{
+        int32_t rel = (int32_t)(target - (patch + 4));
+        memcpy(patch, &rel, sizeof(rel));
+}
+
+#else
+
+/* other hosts have no JIT; the operations module falls back on the
+   interpreter when Jit_new returns NULL */
+
+Jit_T Jit_new(Operations_T op)
+{
+        (void)op;
+        return NULL;
+}
+
+void Jit_free(Jit_T *jit)
+{
+        (void)jit;
+        assert(0);
+}
+
+void Jit_reset(Jit_T jit, const Um_decoded *program, uint64_t *taken,
+               uint32_t length)
+{
+        (void)jit;
+        (void)program;
+        (void)taken;
+        (void)length;
+        assert(0);
+}
+
+void Jit_invalidate(Jit_T jit, uint32_t index)
+{
+        (void)jit;
+        (void)index;
+        assert(0);
+}
+
+Jit_exit Jit_run(Jit_T jit, uint32_t *pc, uint64_t *remaining)
+{
+        (void)jit;
+        (void)pc;
+        (void)remaining;
+        assert(0);
+        return JIT_INTERPRET;
+}
+
+uint32_t Jit_fault_pc(Jit_T jit)
+{
+        (void)jit;
+        assert(0);
+        return 0;
+}
+
+bool Jit_contains(Jit_T jit, const void *address)
+{
+        (void)jit;
+        (void)address;
+        return false;
+}
+
+#endif
@@ -0,0 +1,137 @@
+/*****************************************************************************
+ *
+ *                                  jit.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our JIT module. This module translates
+ *     the basic blocks of segment 0 into x86-64 machine code and runs them.
+ *     A block runs until the next LOADP, HALT, IN or OUT; the instructions
+ *     it cannot handle itself (HALT, IN, OUT and failures) are handed back
+ *     to the caller, which runs them in the interpreter and then continues
+ *     in compiled code. This module is exported to our operations module.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_JIT_INCLUDED
+#define UM_JIT_INCLUDED
+
+#include <stdint.h>
+#include "memory.h"
+#include "operations.h"
+#include "instruction_packing.h"
+
+typedef struct Jit_T *Jit_T;
+
+/* why Jit_run returned:
+ *      JIT_INTERPRET: the instruction at the returned pc must be run by the
+ *                     interpreter
+ *      JIT_BUDGET: the next block has more instructions than remain in the
+ *                  step budget
+ */
+typedef enum Jit_exit { JIT_INTERPRET = 0, JIT_BUDGET } Jit_exit;
+
+/* FUNCTION:    Jit_new
+ * Purpose:     create a compiler for one machine
+ * Arg:         op: the machine. Compiled loads and stores use its segment
+ *                  table directly, its registers are loaded into host
+ *                  registers when compiled code starts and saved back when
+ *                  it returns, and stores to segment 0 go through
+ *                  Operations_store
+ * Returns:     a new Jit_T, or NULL if this host cannot run generated code
+ * Effect:      Maps the code cache. No program is compiled until Jit_reset
+ * Exported to: Operation module: used the first time the JIT engine runs
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Jit_T Jit_new(Operations_T op);
+
+
+/* FUNCTION:    Jit_free
+ * Purpose:     free a compiler and its code cache
+ * Arg:         jit: a pointer to a Jit_T
+ * Returns:     N/A
+ * Effect:      N/A
+ * Exported to: Operation module: used when freeing an operations struct
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Jit_free(Jit_T *jit);
+
+
+/* FUNCTION:    Jit_reset
+ * Purpose:     start over with a new segment 0
+ * Arg:         jit: the compiler
+ *              program: the decoded copy of segment 0, with its INVALID entry
+ *                       past the end
+ *              taken: the jump count of each word, which compiled LOADPs
+ *                     within segment 0 add to
+ *              length: the number of words in segment 0
+ * Returns:     N/A
+ * Effect:      Throws away all generated code
+ * Exported to: Operation module: used whenever segment 0 is decoded again
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+void Jit_reset(Jit_T jit, const Um_decoded *program, uint64_t *taken,
+               uint32_t length);
+
+
+/* FUNCTION:    Jit_invalidate
+ * Purpose:     note that a word of segment 0 was stored to
+ * Arg:         jit: the compiler
+ *              index: the index of the word in segment 0
+ * Returns:     N/A
+ * Effect:      Throws away all generated code if any block was compiled
+ *              from that word
+ * Exported to: Operation module: used after every store to segment 0
+ * Error:       N/A
+ */
+void Jit_invalidate(Jit_T jit, uint32_t index);
+
+
+/* FUNCTION:    Jit_run
+ * Purpose:     run compiled code until it needs the interpreter
+ * Arg:         jit: the compiler
+ *              pc: the index in segment 0 to start at, set to where the run
+ *                  stopped
+ *              remaining: the step budget, reduced by the number of
+ *                         instructions executed
+ * Returns:     the reason the run stopped
+ * Effect:      Compiles blocks as they are reached. The machine's registers
+ *              are up to date when it returns
+ * Exported to: Operation module: the JIT engine
+ * Error:       N/A
+ */
+Jit_exit Jit_run(Jit_T jit, uint32_t *pc, uint64_t *remaining);
+
+
+/* FUNCTION:    Jit_fault_pc
+ * Purpose:     find where a run that trapped was
+ * Arg:         jit: the compiler
+ * Returns:     the first instruction of the block compiled code entered
+ *              last, in a build made with GUARDED=1; otherwise the pc
+ *              the last run stopped at
+ * Effect:      N/A
+ * Exported to: Operation module: used when a guarded load or store in
+ *              compiled code traps, since Jit_run does not return then
+ * Error:       Checked runtime error if jit is NULL
+ */
+uint32_t Jit_fault_pc(Jit_T jit);
+
+
+/* FUNCTION:    Jit_contains
+ * Purpose:     tell whether a host address is in compiled code
+ * Arg:         jit: the compiler
+ *              address: the host address, e.g. of a trapping instruction
+ * Returns:     true if address is in the code cache
+ * Effect:      N/A. Only reads the compiler, so it can be called from a
+ *              signal handler
+ * Exported to: Operation module: used by the SIGSEGV handler of a guarded
+ *              build to tell a trap in compiled code from a bug elsewhere
+ * Error:       N/A
+ */
+bool Jit_contains(Jit_T jit, const void *address);
+
+#endif
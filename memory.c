@@ -10,41 +10,93 @@
  *     allows the user to load a program into segment 0 of the memory, allocate
  *     and deallocate memory segments, extract values from specific indices of 
  *     memory, get the next instruction from the loaded program, and load a new
- *     program into segment 0. We implement the segmented memory as a Hanson 
- *     sequence of pointers to Hanson UArrays that store each segment. The 
- *     segment ID of each segment is the index of that segment's address in our
- *     sequence. When we remove a segment, we add its index to a stack that 
- *     stores deallocated segment IDs that can be reallocated in the future.
- *     This module is exported to our operations module.
+ *     program into segment 0. We implement the segmented memory as a flat,
+ *     growable array of segment descriptors, each holding a pointer to the
+ *     segment's words and its length, so reaching a word is one indexed load
+ *     and one offset. The segment ID of each segment is the index of its
+ *     descriptor in the array. When we remove a segment, we push its index
+ *     onto an array of free IDs, used last in first out, which always has
+ *     room for every ID in the table, so mapping and unmapping never
+ *     allocate for the IDs. Loading a program from another segment does not copy it:
+ *     segment 0 and the source share one reference-counted block of words
+ *     until either of them is stored to, and only then is a private copy
+ *     made. The words of every segment come from a size-class pool and go
+ *     back to it as soon as the segment is unmapped. Bounds are only
+ *     validated when the module is compiled with UM_CHECKED defined; with
+ *     UM_GUARDED, the pool puts guard pages after large segments, the
+ *     segment table is reserved for every 32-bit ID, and segment_trap
+ *     tells the operations module which segment a trap was in. This
+ *     module is exported to our operations module.
  * 
  *
  ****************************************************************************/
 
 #include "memory.h"
-#include <seq.h>
-#include <uarray.h>
-#include <stack.h>
+#include "pool.h"
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#ifdef UM_GUARDED
+#include <sys/mman.h>
+#endif
 
 /* defines the byte size of a word */
 #define word_size 4
 
+/* number of descriptors the segment table starts with */
+#define initial_capacity 64
+
+/* where a snapshot says an unmapped segment's words are */
+#define snapshot_unmapped UINT32_MAX
+
+#ifdef UM_GUARDED
+/* the bytes a guarded build reserves for the segment table: a descriptor
+   for every 32-bit ID, so no ID can index past the reservation */
+#define table_reserve (((size_t)UINT32_MAX + 1) * sizeof(Segment))
+#endif
+
+/* 
+ * checked_assert validates segment IDs and word indices only in a checked
+ * build (make CHECKED=1); otherwise it compiles to nothing
+ */
+#ifdef UM_CHECKED
+#define checked_assert(e) assert(e)
+#else
+#define checked_assert(e) ((void)0)
+#endif
+
 /* struct definition for our Memory struct which holds:
- *      main_mem: a sequence that stores a pointer to each memory segment
- *      unmap_mem: a stack that stores indices of unmapped segments
+ *      segments: the segment table, indexed by segment ID
+ *      num_segments: the number of IDs that have been handed out
+ *      capacity: the number of descriptors the table has room for, and
+ *                the number of IDs free_ids has room for
+ *      free_ids: the IDs of unmapped segments, the next to be reused last
+ *      num_free: the number of them
+ *      pool: where the words of every segment are allocated from
  *      program_ptr: a pointer to the next instruction of our program
  */
 struct Memory_T {
-        Seq_T main_mem;
-        Stack_T unmap_mem;
+        Segment *segments;
+        uint32_t num_segments;
+        uint32_t capacity;
+        uint32_t *free_ids;
+        uint32_t num_free;
+        Pool_T pool;
         uint32_t *program_ptr;
 };
 
+/* private helper functions, details can be viewed below */
+static uint32_t *new_words    (uint32_t size, Memory_T mem);
+static void      release_words(uint32_t *words, Memory_T mem);
+static void      unshare      (uint32_t seg_id, Memory_T mem);
+static uint32_t  words_owner  (uint32_t seg_id, Memory_T mem);
+static void      grow_table   (uint32_t capacity, Memory_T mem);
+static uint32_t  take_id      (Memory_T mem);
+
 
 /* FUNCTION:    Memory_new
- * Purpose:     Initialize a Hanson sequence to store the main memory, a Hanson
- *              stack to store the segmenets that have been previously mapped
+ * Purpose:     Initialize the segment table that stores the main memory and
+ *              the array of segment IDs that have been previously mapped
  * Arg:         N/A
  * Returns:     An instance of the struct Memory_T that contains our data
  *              structures to represent the memory segments
@@ -58,8 +110,13 @@ Memory_T Memory_new()
         assert(mem != NULL);
 
         /* initialize memory data structures */
-        mem->main_mem = Seq_new(0);
-        mem->unmap_mem = Stack_new();
+        mem->segments = NULL;
+        mem->free_ids = NULL;
+        mem->num_segments = 0;
+        mem->num_free = 0;
+        mem->capacity = 0;
+        grow_table(initial_capacity, mem);
+        mem->pool = Pool_new();
         mem->program_ptr = NULL;
 
         return mem;
@@ -83,16 +140,21 @@ void Memory_free(Memory_T *mem)
         /* checks for null argument */
         assert(mem != NULL && *mem != NULL);
 
-        /* free the uarrays */
-        int seq_size = Seq_length((*mem)->main_mem);
-        for (int i = 0; i < seq_size; i++) {
-                UArray_T seg_remove = Seq_remhi((*mem)->main_mem);
-                UArray_free(&seg_remove);
+        /* free the words of every segment that is still mapped */
+        for (uint32_t i = 0; i < (*mem)->num_segments; i++) {
+                if ((*mem)->segments[i].words != NULL) {
+                        release_words((*mem)->segments[i].words, *mem);
+                }
         }
         
-        /* free the sequence and the stack */
-        Seq_free(&((*mem)->main_mem));
-        Stack_free(&((*mem)->unmap_mem));
+        /* free the segment table, the free IDs and the pool */
+#ifdef UM_GUARDED
+        munmap((*mem)->segments, table_reserve);
+#else
+        free((*mem)->segments);
+#endif
+        free((*mem)->free_ids);
+        Pool_free(&((*mem)->pool));
         free(*mem);
         *mem = NULL;
 }
@@ -104,47 +166,102 @@ void Memory_free(Memory_T *mem)
  	        mem: struct that contains the components of the memory 
                      management unit
  * Returns:     the segment ID of the newly mapped segment 
- * Effect:      Checks if the unmap_mem stack is empty
- *              Adds the segment to the main_mem sequence
+ * Effect:      Reuses the most recently freed ID if there is one, otherwise
+ *              adds the segment to the segment table, growing it if needed
  * Exported to: Operation module: this function is used in the map segment
  *              command
- * Error:       Checked Runtime error if the size of the sequence is 232
- *              Checked Runtime if mem is NULL
+ * Error:       Checked Runtime error if the size of the table is 2^32
+ *              Checked Runtime if mem is NULL or allocation fails
  */
 uint32_t new_segment(uint32_t size, Memory_T mem)
 {
         assert(mem != NULL);
 
-        uint32_t seg_id;
+        uint32_t seg_id = take_id(mem);
 
-        if (Stack_empty(mem->unmap_mem)) { /* if the stack is empty */
+        /* each element is initialize to 0 */
+        mem->segments[seg_id].words = new_words(size, mem);
+        mem->segments[seg_id].length = size;
+        mem->segments[seg_id].shared = 0;
 
-                /* checks if we have run out of memory */ /* check with TA */
-                uint32_t segments_stored = Seq_length(mem->main_mem);
-                assert(segments_stored != (uint32_t)(~0));
-        
-                /* each element is initialize to 0 */
-                UArray_T new_segment = UArray_new(size, word_size);
-                Seq_addhi(mem->main_mem, new_segment);
-                seg_id = segments_stored; 
-                
-        } else { /* if the stack is not empty */
-
-                /* get the top id on the stack and replace the segment at that 
-                   id with a new segmenet */
-                seg_id = (uint64_t)Stack_pop(mem->unmap_mem);
-                UArray_T new_segment = UArray_new(size, word_size);
-                UArray_T remove_seg = Seq_put(mem->main_mem, seg_id, 
-                                              new_segment);
-                
-                /* recycles the old segment */
-                UArray_free(&remove_seg);
-        }
+        return seg_id;
+}
+
+
+/* FUNCTION:    adopt_segment
+ * Purpose:     map a new segment whose words are already in memory
+ * Arg:         words: the segment's words, in a writable MAP_PRIVATE
+ *                     mapping that ends with them and starts on the page
+ *                     holding the three words in front of them
+ *              size: the number of words in the segment
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the segment ID of the newly mapped segment
+ * Effect:      The segment uses the words where they are, and the three
+ *              words in front of them hold its reference count and the
+ *              pool's hidden words. Unmapping the segment unmaps them
+ * Exported to: Operation module: used to load a .umn program
+ * Error:       Checked Runtime if words or mem is NULL, or as new_segment
+ */
+uint32_t adopt_segment(uint32_t *words, uint32_t size, Memory_T mem)
+{
+        assert(words != NULL && mem != NULL);
+
+        uint32_t seg_id = take_id(mem);
+
+        uint32_t *block = Pool_adopt(words - 1, size + 1, mem->pool);
+        block[0] = 1;
+        mem->segments[seg_id].words = block + 1;
+        mem->segments[seg_id].length = size;
+        mem->segments[seg_id].shared = 0;
 
         return seg_id;
 }
 
 
+/* FUNCTION:    grow_segment
+ * Purpose:     add words to the end of a segment
+ * Arg:         seg_id: segment ID of a mapped segment
+ *              size: its new number of words, at least its current one
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     N/A
+ * Effect:      The new words are 0. The words may move, so pointers from
+ *              word_at are no longer good, but the program pointer is moved
+ *              along with them. Words shared with another segment are
+ *              copied first
+ * Exported to: Operation module: used to add the words of a streamed
+ *              program to segment 0 as they arrive
+ * Error:       Checked Runtime if mem is NULL, or the segment is not mapped
+ *              or would get shorter
+ */
+void grow_segment(uint32_t seg_id, uint32_t size, Memory_T mem)
+{
+        assert(mem != NULL);
+        assert(seg_id < mem->num_segments && 
+               mem->segments[seg_id].words != NULL);
+
+        Segment *segment = &mem->segments[seg_id];
+        assert(size >= segment->length);
+
+        if (segment->shared) {
+                unshare(seg_id, mem);
+        }
+
+        /* the block holds the reference count in front of the words */
+        uint32_t *words = segment->words;
+        uint32_t *block = Pool_grow(words - 1, segment->length + 1, size + 1,
+                                    mem->pool);
+        segment->words = block + 1;
+        segment->length = size;
+
+        if (seg_id == 0 && mem->program_ptr != NULL) {
+                mem->program_ptr = segment->words + 
+                                   (mem->program_ptr - words);
+        }
+}
+
+
 /* FUNCTION:    remove_segment
  * Purpose:     unmap a given segment
  * Arg:         seg_id: the index that identifies a specific memory
@@ -152,22 +269,28 @@ uint32_t new_segment(uint32_t size, Memory_T mem)
  *              mem: struct that contains the components of the memory
  *              management unit
  * Returns:     N/A
- * Effect:      Pushes the ID of the unmapped segment onto the unmap_mem 
- *              stack
+ * Effect:      Gives the segment's words back to the pool and pushes the
+ *              ID of the unmapped segment onto the free IDs
  * Exported to: Operation module: this function is used in the unmap 
  *              segment command
- * Error:       Checked runtime if ID is invalid
+ * Error:       Checked runtime if ID is 0, invalid or already unmapped
  *              Checked Runtime if mem is NULL
  */
 void remove_segment(uint32_t seg_id, Memory_T mem)
 {
         assert(mem != NULL);
 
-        /* checks if the ID is valid */
-        assert(seg_id <= (uint32_t)Seq_length(mem->main_mem));
+        /* checks if the ID is valid; an unmapped segment has no words, so
+           unmapping it twice is caught before its ID is freed twice */
+        assert(seg_id != 0 && seg_id < mem->num_segments);
+        assert(mem->segments[seg_id].words != NULL);
 
-        /* casting allows the stack to interpret the ID as a void pointer */
-        Stack_push(mem->unmap_mem, (void *)(uint64_t)seg_id);
+        release_words(mem->segments[seg_id].words, mem);
+        mem->segments[seg_id].words = NULL;
+        mem->segments[seg_id].length = 0;
+
+        /* there is room for every ID in the table */
+        mem->free_ids[mem->num_free++] = seg_id;
 }
 
 
@@ -177,8 +300,9 @@ void remove_segment(uint32_t seg_id, Memory_T mem)
  *              mem: struct that contains the components of the memory
  *              management unit
  * Returns:     N/A
- * Effect:      Replaces the segment at seg_id with an empty segment and frees
- *              the segment previously stored in segment 0
+ * Effect:      Segment 0 shares the words of the segment at seg_id until one
+ *              of them is stored to, and the segment previously stored in
+ *              segment 0 is released
  * Exported to: Operation module: Used in the load program command
  * Error:       Checked Runtime if mem is NULL
  */
@@ -187,15 +311,17 @@ void load_program(uint32_t seg_id, uint32_t offset, Memory_T mem)
         assert(mem != NULL);
         
         if (seg_id != 0) {
-                /* replace segment 0 with the requested segment */
-                UArray_T new_prog = Seq_get(mem->main_mem, seg_id);
-                int new_prog_len = UArray_length(new_prog);
-                UArray_T new_prog_copy = UArray_copy(new_prog, new_prog_len);
+                checked_assert(seg_id < mem->num_segments);
 
-                UArray_T remove_seg = Seq_put(mem->main_mem, 0, new_prog_copy);
+                /* segment 0 shares the words of the requested segment; the
+                   copy is made by whichever of the two is stored to first */
+                Segment *new_prog = &mem->segments[seg_id];
+                new_prog->words[-1]++;
+                new_prog->shared = 1;
 
                 /* recycles the old segment and remove the replaced segment */
-                UArray_free(&remove_seg); 
+                release_words(mem->segments[0].words, mem);
+                mem->segments[0] = *new_prog;
         }
         
         /* update the program pointer */
@@ -212,20 +338,348 @@ void load_program(uint32_t seg_id, uint32_t offset, Memory_T mem)
  *		mem: struct that contains the components of the memory 
  *                   management unit
  * Returns:     Pointer to the requested uint32_t word
- * Effect:      N/A
- * Exported to:	Operation module: used in segmented load and segmented store 
- *              commands
+ * Effect:      Gives the segment a private copy of its words first if they
+ *              are shared, since the word may be written through the pointer
+ * Exported to:	Operation module: used when writing the program into segment
+ *              0
  * Error:       Checked Runtime if mem is NULL
+ *              Checked Runtime if the segment or index is out of bounds, in
+ *              a checked build only
  */
 uint32_t *word_at(uint32_t seg_id, uint32_t word_index, Memory_T mem)
 {
         assert(mem != NULL);
-        
-        /* get the segment that stores the desired word */
-        UArray_T segment = Seq_get(mem->main_mem, seg_id);
+        checked_assert(seg_id < mem->num_segments);
+        checked_assert(word_index < mem->segments[seg_id].length);
+
+        if (mem->segments[seg_id].shared) {
+                unshare(seg_id, mem);
+        }
+
+        /* index the segment table, then offset into the segment's words */
+        return &mem->segments[seg_id].words[word_index];
+}
+
+
+/* FUNCTION:    load_word
+ * Purpose:     returns the word at a given index of a given segment
+ * Arg:         seg_id: segment ID of the given segment
+ *              word_index: a word index that indicates a specific 
+ *              word in that segment
+ *		mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the requested uint32_t word
+ * Effect:      N/A
+ * Exported to:	Operation module: used in the segmented load command
+ * Error:       Checked Runtime if the segment or index is out of bounds, in
+ *              a checked build only
+ */
+uint32_t load_word(uint32_t seg_id, uint32_t word_index, Memory_T mem)
+{
+        checked_assert(mem != NULL);
+        checked_assert(seg_id < mem->num_segments);
+        checked_assert(word_index < mem->segments[seg_id].length);
+
+        return mem->segments[seg_id].words[word_index];
+}
+
+
+/* FUNCTION:    store_word
+ * Purpose:     stores a word at a given index of a given segment
+ * Arg:         seg_id: segment ID of the given segment
+ *              word_index: a word index that indicates a specific 
+ *              word in that segment
+ *              value: the word to store
+ *		mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     N/A
+ * Effect:      Gives the segment a private copy of its words first if they
+ *              are shared, so the store is never seen by another segment
+ * Exported to:	Operation module: used in the segmented store command
+ * Error:       Checked Runtime if the segment or index is out of bounds, in
+ *              a checked build only
+ */
+void store_word(uint32_t seg_id, uint32_t word_index, uint32_t value, 
+                Memory_T mem)
+{
+        checked_assert(mem != NULL);
+        checked_assert(seg_id < mem->num_segments);
+        checked_assert(word_index < mem->segments[seg_id].length);
+
+        Segment *segment = &mem->segments[seg_id];
+        if (segment->shared) {
+                unshare(seg_id, mem);
+        }
+        segment->words[word_index] = value;
+}
+
+
+/* FUNCTION:    segment_length
+ * Purpose:     returns the number of words in a given segment
+ * Arg:         seg_id: segment ID of the given segment
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the length of the segment in words
+ * Effect:      N/A
+ * Exported to:	Operation module: used to size the decoded copy of segment 0
+ * Error:       Checked Runtime if mem is NULL
+ */
+uint32_t segment_length(uint32_t seg_id, Memory_T mem)
+{
+        assert(mem != NULL);
+
+        checked_assert(seg_id < mem->num_segments);
+
+        return mem->segments[seg_id].length;
+}
+
+
+/* FUNCTION:    segment_mapped
+ * Purpose:     tells whether a segment ID names a mapped segment
+ * Arg:         seg_id: segment ID to check
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     true if seg_id is mapped, false otherwise
+ * Effect:      N/A
+ * Exported to:	Operation module: used to report machine failures instead of
+ *              aborting
+ * Error:       Checked Runtime if mem is NULL
+ */
+bool segment_mapped(uint32_t seg_id, Memory_T mem)
+{
+        assert(mem != NULL);
+
+        return seg_id < mem->num_segments && 
+               mem->segments[seg_id].words != NULL;
+}
+
+
+/* FUNCTION:    segment_table
+ * Purpose:     returns where the memory keeps its segment table
+ * Arg:         mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the address of the pointer to the first Segment. The pointer
+ *              itself changes whenever the table grows, its address does not
+ * Effect:      N/A
+ * Exported to:	JIT module: compiled loads and stores read the table
+ *              through this address
+ *              Operation module: used to read segment 0 in place when
+ *              decoding it
+ * Error:       Checked Runtime if mem is NULL
+ */
+Segment **segment_table(Memory_T mem)
+{
+        assert(mem != NULL);
+
+        return &mem->segments;
+}
 
-        /* return the pointer to the element in the UArray */
-        return UArray_at(segment, word_index);
+
+/* FUNCTION:    segment_trap
+ * Purpose:     find the segment a trapped access was meant for
+ * Arg:         address: the address that could not be accessed
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ *              seg_id: set to the segment's ID, or to UINT32_MAX if the
+ *                      access was to the words of an unmapped segment
+ *              index: set to the word index that was accessed, or to 0 if
+ *                     the access was to the descriptor of an ID past the
+ *                     end of the table
+ * Returns:     true if the address is in the guard pages past a segment,
+ *              is a word index from the null words of an unmapped
+ *              segment, or is in the reserved part of the segment table;
+ *              false if the trap has some other cause
+ * Effect:      N/A. Only reads memory, so it can be called from a signal
+ *              handler while no segment is being mapped or unmapped
+ * Exported to:	Operation module: used by the SIGSEGV handler of a guarded
+ *              build
+ * Error:       N/A
+ */
+bool segment_trap(const void *address, Memory_T mem, uint32_t *seg_id,
+                  uint32_t *index)
+{
+        /* every word index of a 32-bit segment is below this offset */
+        const uintptr_t reach = (uintptr_t)1 << 34;
+        uintptr_t at = (uintptr_t)address;
+
+        if (at < reach) {
+                *seg_id = UINT32_MAX;
+                *index = at / word_size;
+                return true;
+        }
+
+#ifdef UM_GUARDED
+        /* the descriptor of an ID the table has no room for yet */
+        uintptr_t table = (uintptr_t)mem->segments;
+        if (at >= table && at - table < table_reserve) {
+                *seg_id = (at - table) / sizeof(Segment);
+                *index = 0;
+                return true;
+        }
+#endif
+
+        for (uint32_t i = 0; i < mem->num_segments; i++) {
+                uintptr_t words = (uintptr_t)mem->segments[i].words;
+                uintptr_t end = words + 
+                                (uintptr_t)mem->segments[i].length * word_size;
+                if (words != 0 && Pool_guarded((uint32_t *)words - 1) &&
+                    at >= end && at - words < reach) {
+                        *seg_id = i;
+                        *index = (at - words) / word_size;
+                        return true;
+                }
+        }
+        return false;
+}
+
+
+/* FUNCTION:    save_segments
+ * Purpose:     write every segment and the free segment IDs to a snapshot
+ * Arg:         out: an open file to write to
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     false if a write failed
+ * Effect:      Writes host-order words: the number of IDs handed out, the
+ *              number of free IDs and the free IDs from the first freed to
+ *              the next to be reused, then for each ID its length and
+ *              where its words are, followed by the words themselves
+ *              unless the ID is unmapped or shares the words of a lower ID
+ * Exported to:	Operation module: used to snapshot the machine
+ * Error:       Checked Runtime if out or mem is NULL, or allocation fails
+ */
+bool save_segments(FILE *out, Memory_T mem)
+{
+        assert(out != NULL && mem != NULL);
+
+        uint32_t num_free = mem->num_free;
+        uint32_t counts[2] = { mem->num_segments, num_free };
+        bool written = fwrite(counts, word_size, 2, out) == 2 &&
+                       fwrite(mem->free_ids, word_size, num_free, out) ==
+                       num_free;
+
+        for (uint32_t i = 0; written && i < mem->num_segments; i++) {
+                Segment *segment = &mem->segments[i];
+                uint32_t owner = (segment->words == NULL) ? 
+                                 snapshot_unmapped : words_owner(i, mem);
+                uint32_t descriptor[2] = { segment->length, owner };
+
+                written = fwrite(descriptor, word_size, 2, out) == 2;
+                if (written && owner == i) {
+                        written = fwrite(segment->words, word_size, 
+                                         segment->length, out) == 
+                                  segment->length;
+                }
+        }
+
+        return written;
+}
+
+
+/* FUNCTION:    restore_segments
+ * Purpose:     rebuild the segments from a snapshot
+ * Arg:         words: the part of a snapshot written by save_segments
+ *              num_words: the number of words available
+ *              mem: struct that contains the components of the memory 
+ *                   management unit, with no segments mapped
+ * Returns:     the number of words used, or 0 if they are not a valid
+ *              snapshot, in which case mem should only be freed
+ * Effect:      Copies each segment's words into a new block from the pool.
+ *              Segments that shared words when the snapshot was written
+ *              share them again
+ * Exported to:	Operation module: used to restore the machine
+ * Error:       Checked Runtime if words or mem is NULL, or if a segment
+ *              has already been mapped, or allocation fails
+ */
+size_t restore_segments(const uint32_t *words, size_t num_words, 
+                        Memory_T mem)
+{
+        assert(words != NULL && mem != NULL);
+        assert(mem->num_segments == 0);
+
+        if (num_words < 2 || words[0] == 0 || 
+            words[1] > words[0] || words[1] > num_words - 2) {
+                return 0;
+        }
+        uint32_t num_segments = words[0];
+        uint32_t num_free = words[1];
+        const uint32_t *free_ids = words + 2;
+        size_t used = 2 + (size_t)num_free;
+
+        /* every segment has at least its length and owner, so a count the
+           words cannot hold is rejected before the table is grown for it */
+        if (num_segments > (num_words - used) / 2) {
+                return 0;
+        }
+
+        uint32_t capacity = mem->capacity;
+        while (capacity < num_segments) {
+                capacity = (2 * (uint64_t)capacity > UINT32_MAX) ? 
+                           UINT32_MAX : 2 * capacity;
+        }
+        grow_table(capacity, mem);
+
+        for (uint32_t i = 0; i < num_segments; i++) {
+                if (num_words - used < 2) {
+                        return 0;
+                }
+                uint32_t length = words[used];
+                uint32_t owner = words[used + 1];
+                used += 2;
+
+                Segment *segment = &mem->segments[i];
+                mem->num_segments = i + 1;
+                segment->words = NULL;
+                segment->length = 0;
+                segment->shared = 0;
+
+                if (owner == i) {
+                        if (num_words - used < length) {
+                                return 0;
+                        }
+                        segment->words = new_words(length, mem);
+                        memcpy(segment->words, words + used, 
+                               (size_t)length * word_size);
+                        segment->length = length;
+                        used += length;
+                } else if (owner != snapshot_unmapped) {
+                        /* shares the words of a lower ID */
+                        if (owner > i || mem->segments[owner].words == NULL ||
+                            mem->segments[owner].length != length) {
+                                return 0;
+                        }
+                        *segment = mem->segments[owner];
+                        segment->words[-1]++;
+                        segment->shared = 1;
+                        mem->segments[owner].shared = 1;
+                }
+        }
+
+        /* segment 0 must exist, and each unmapped ID must be free once;
+           the shared flag of an unmapped segment marks it as seen */
+        if (mem->segments[0].words == NULL) {
+                return 0;
+        }
+        uint32_t num_unmapped = 0;
+        for (uint32_t i = 0; i < num_segments; i++) {
+                num_unmapped += (mem->segments[i].words == NULL);
+        }
+        if (num_unmapped != num_free) {
+                return 0;
+        }
+        for (uint32_t k = 0; k < num_free; k++) {
+                Segment *segment = &mem->segments[free_ids[k] < num_segments ?
+                                                  free_ids[k] : 0];
+                if (segment->words != NULL || segment->shared) {
+                        return 0;
+                }
+                segment->shared = 1;
+                mem->free_ids[mem->num_free++] = free_ids[k];
+        }
+        for (uint32_t k = 0; k < num_free; k++) {
+                mem->segments[free_ids[k]].shared = 0;
+        }
+
+        return used;
 }
 
 
@@ -271,4 +725,188 @@ uint32_t get_next_instruction(Memory_T mem)
         (mem->program_ptr)++;
 
         return instruction;
-}
\ No newline at end of file
+}
+
+
+/* FUNCTION:    new_words
+ * Purpose:     allocate the words of a segment from the pool, all 
+ *              initialized to 0
+ * Arg:         size: the number of words in the segment
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     pointer to the words
+ * Effect:      The word before the returned pointer holds a reference count
+ *              of 1
+ * Exported to: N/A
+ * Error:       Checked Runtime if the allocation fails
+ */
+static uint32_t *new_words(uint32_t size, Memory_T mem)
+{
+        /* one extra word in front holds the reference count */
+        uint32_t *block = Pool_alloc(size + 1, mem->pool);
+
+        block[0] = 1;
+        return block + 1;
+}
+
+
+/* FUNCTION:    release_words
+ * Purpose:     drop one reference to the words of a segment
+ * Arg:         words: pointer returned by new_words
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     N/A
+ * Effect:      Gives the words back to the pool once no segment refers to
+ *              them
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void release_words(uint32_t *words, Memory_T mem)
+{
+        if (--words[-1] == 0) {
+                Pool_release(words - 1, mem->pool);
+        }
+}
+
+
+/* FUNCTION:    unshare
+ * Purpose:     make sure a segment is the only owner of its words before they
+ *              are written
+ * Arg:         seg_id: segment ID of the given segment
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     N/A
+ * Effect:      Copies the words if another segment still refers to them, and
+ *              moves the program pointer along if segment 0 was copied
+ * Exported to: N/A
+ * Error:       Checked Runtime if the allocation fails
+ */
+static void unshare(uint32_t seg_id, Memory_T mem)
+{
+        Segment *segment = &mem->segments[seg_id];
+        segment->shared = 0;
+
+        /* the other segment may have made its own copy already */
+        if (segment->words[-1] == 1) {
+                return;
+        }
+
+        uint32_t *copy = new_words(segment->length, mem);
+        memcpy(copy, segment->words, (size_t)segment->length * word_size);
+
+        if (seg_id == 0 && mem->program_ptr != NULL) {
+                mem->program_ptr = copy + (mem->program_ptr - segment->words);
+        }
+
+        release_words(segment->words, mem);
+        segment->words = copy;
+}
+
+
+/* FUNCTION:    words_owner
+ * Purpose:     find the lowest segment using the same words as a segment
+ * Arg:         seg_id: segment ID of a mapped segment
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the lowest ID whose words are the same block, which is seg_id
+ *              itself unless the words are shared
+ * Exported to: N/A
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static uint32_t words_owner(uint32_t seg_id, Memory_T mem)
+{
+        Segment *segment = &mem->segments[seg_id];
+        if (!segment->shared || segment->words[-1] == 1) {
+                return seg_id;
+        }
+
+        for (uint32_t i = 0; i < seg_id; i++) {
+                if (mem->segments[i].words == segment->words) {
+                        return i;
+                }
+        }
+        return seg_id;
+}
+
+
+/* FUNCTION:    grow_table
+ * Purpose:     make room for more segments
+ * Arg:         capacity: the number of IDs to make room for, no less than
+ *                        the current capacity
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     N/A
+ * Effect:      Grows the segment table and the free IDs together, so every
+ *              ID in the table can be freed without allocating. A guarded
+ *              build reserves the whole table, inaccessible, the first
+ *              time and only makes the part in use accessible, so the
+ *              table never moves and the descriptor of any ID past its
+ *              capacity traps
+ * Exported to: N/A
+ * Error:       Checked Runtime if allocation fails
+ */
+static void grow_table(uint32_t capacity, Memory_T mem)
+{
+#ifdef UM_GUARDED
+        if (mem->segments == NULL) {
+                mem->segments = mmap(NULL, table_reserve, PROT_NONE, 
+                                     MAP_PRIVATE | MAP_ANONYMOUS | 
+                                     MAP_NORESERVE, -1, 0);
+                assert(mem->segments != MAP_FAILED);
+        }
+        if (mprotect(mem->segments, (size_t)capacity * sizeof(*mem->segments),
+                     PROT_READ | PROT_WRITE) != 0) {
+                mem->segments = NULL;
+        }
+#else
+        mem->segments = realloc(mem->segments, 
+                                (size_t)capacity * sizeof(*mem->segments));
+#endif
+        mem->free_ids = realloc(mem->free_ids, 
+                                (size_t)capacity * sizeof(*mem->free_ids));
+        assert(mem->segments != NULL && mem->free_ids != NULL);
+
+        /* an ID not handed out yet has no words, like an unmapped one */
+        memset(mem->segments + mem->capacity, 0, 
+               (size_t)(capacity - mem->capacity) * sizeof(*mem->segments));
+        mem->capacity = capacity;
+}
+
+
+/* FUNCTION:    take_id
+ * Purpose:     pick the ID of a segment about to be mapped
+ * Arg:         mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the most recently freed ID, or the next new one
+ * Effect:      Grows the segment table if it is full
+ * Exported to: N/A
+ * Error:       Checked Runtime error if the size of the table is 2^32
+ */
+static uint32_t take_id(Memory_T mem)
+{
+        uint32_t seg_id;
+
+        if (mem->num_free == 0) { /* if no ID is free */
+
+                /* checks if we have run out of memory */ /* check with TA */
+                seg_id = mem->num_segments;
+                assert(seg_id != (uint32_t)(~0));
+
+                /* double the table when it is full */
+                if (seg_id == mem->capacity) {
+                        grow_table(2 * (uint64_t)mem->capacity > UINT32_MAX ?
+                                   UINT32_MAX : 2 * mem->capacity, mem);
+                }
+                mem->num_segments++;
+                
+        } else { /* if an ID is free */
+
+                /* take the last ID freed; its words were given back to the
+                   pool when it was unmapped */
+                seg_id = mem->free_ids[--mem->num_free];
+                checked_assert(mem->segments[seg_id].words == NULL);
+        }
+
+        return seg_id;
+}
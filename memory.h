@@ -20,12 +20,30 @@
 #define UM_MEMORY_INCLUDED
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 
 typedef struct Memory_T *Memory_T;
 
+/* descriptor for one segment, public so that generated code can index the
+ * segment table directly:
+ *      words: the words of the segment, or NULL once it is unmapped. The
+ *             word just before words[0] holds the number of segments that
+ *             share them
+ *      length: the number of words in the segment
+ *      shared: nonzero if the words may be shared with another segment, in
+ *              which case they are copied before the first store
+ */
+typedef struct Segment {
+        uint32_t *words;
+        uint32_t length;
+        uint32_t shared;
+} Segment;
+
 /* FUNCTION:    Memory_new
- * Purpose:     Initialize a Hanson sequence to store the main memory, a Hanson
- *              stack to store the segmenets that have been previously mapped
+ * Purpose:     Initialize the segment table that stores the main memory and
+ *              the array of segment IDs that have been previously mapped
  * Arg:         N/A
  * Returns:     An instance of the struct Memory_T that contains our data
  *              structures to represent the memory segments
@@ -57,16 +75,53 @@ void Memory_free(Memory_T *mem);
  	        mem: struct that contains the components of the memory 
                      management unit
  * Returns:     the segment ID of the newly mapped segment 
- * Effect:      Checks if the unmap_mem stack is empty
- *              Adds the segment to the main_mem sequence
+ * Effect:      Reuses the most recently freed ID if there is one, otherwise
+ *              adds the segment to the segment table, growing it if needed
  * Exported to: Operation module: this function is used in the map segment 
  *		command
- * Error:       Checked Runtime error if the size of the sequence is 232
- *              Checked Runtime if mem is NULL
+ * Error:       Checked Runtime error if the size of the table is 2^32
+ *              Checked Runtime if mem is NULL or allocation fails
  */
 uint32_t new_segment(uint32_t size, Memory_T mem);
 
 
+/* FUNCTION:    adopt_segment
+ * Purpose:     map a new segment whose words are already in memory
+ * Arg:         words: the segment's words, in a writable MAP_PRIVATE
+ *                     mapping that ends with them and starts on the page
+ *                     holding the three words in front of them
+ *              size: the number of words in the segment
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the segment ID of the newly mapped segment
+ * Effect:      The segment uses the words where they are, and the three
+ *              words in front of them hold its reference count and the
+ *              pool's hidden words. Unmapping the segment unmaps them
+ * Exported to: Operation module: used to load a .umn program
+ * Error:       Checked Runtime if words or mem is NULL, or as new_segment
+ */
+uint32_t adopt_segment(uint32_t *words, uint32_t size, Memory_T mem);
+
+
+/* FUNCTION:    grow_segment
+ * Purpose:     add words to the end of a segment
+ * Arg:         seg_id: segment ID of a mapped segment
+ *              size: its new number of words, at least its current one
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     N/A
+ * Effect:      The new words are 0. The words may move, so pointers from
+ *              word_at are no longer good, but the program pointer is moved
+ *              along with them. Words shared with another segment are
+ *              copied first
+ * Exported to: Operation module: used to add the words of a streamed
+ *              program to segment 0 as they arrive
+ * Error:       Checked Runtime if mem is NULL, or the segment is not mapped
+ *              or would get shorter
+ */
+void grow_segment(uint32_t seg_id, uint32_t size, Memory_T mem);
+
+
 /* FUNCTION:    remove_segment
  * Purpose:     unmap a given segment
  * Arg:         seg_id: the index that identifies a specific memory
@@ -74,11 +129,12 @@ uint32_t new_segment(uint32_t size, Memory_T mem);
  *              mem: struct that contains the components of the memory
  *              management unit
  * Returns:     N/A
- * Effect:      Pushes the ID of the unmapped segment onto the unmap_mem 
- *              stack
+ * Effect:      Gives the segment's words back to the pool and pushes the
+ *              ID of the unmapped segment onto the free IDs, which never
+ *              allocates
  * Exported to: Operation module: this function is used in the unmap 
  *              segment command
- * Error:       Checked runtime if ID is invalid
+ * Error:       Checked runtime if ID is 0, invalid or already unmapped
  *              Checked Runtime if mem is NULL
  */
 void remove_segment(uint32_t seg_id, Memory_T mem);
@@ -90,8 +146,9 @@ void remove_segment(uint32_t seg_id, Memory_T mem);
  *              mem: struct that contains the components of the memory
  *              management unit
  * Returns:     N/A
- * Effect:      Replaces the segment at seg_id with an empty segment and frees
- *              the segment previously stored in segment 0
+ * Effect:      Segment 0 shares the words of the segment at seg_id until one
+ *              of them is stored to, and the segment previously stored in
+ *              segment 0 is released
  * Exported to: Operation module: Used in the load program command
  * Error:       Checked Runtime if mem is NULL
  */
@@ -107,14 +164,52 @@ void load_program(uint32_t seg_id, uint32_t offset, Memory_T mem);
  *		mem: struct that contains the components of the memory 
  *                   management unit
  * Returns:     Pointer to the requested uint32_t word
- * Effect:      N/A
- * Exported to:	Operation module: used in segmented load and segmented store 
- *              commands
+ * Effect:      Gives the segment a private copy of its words first if they
+ *              are shared, since the word may be written through the pointer
+ * Exported to:	Operation module: used when writing the program into segment
+ *              0
  * Error:       Checked Runtime if mem is NULL
+ *              Checked Runtime if the segment or index is out of bounds, in
+ *              a checked build only
  */
 uint32_t *word_at(uint32_t seg_id, uint32_t word_index, Memory_T mem);
 
 
+/* FUNCTION:    load_word
+ * Purpose:     returns the word at a given index of a given segment
+ * Arg:         seg_id: segment ID of the given segment
+ *              word_index: a word index that indicates a specific 
+ *              word in that segment
+ *		mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the requested uint32_t word
+ * Effect:      N/A
+ * Exported to:	Operation module: used in the segmented load command
+ * Error:       Checked Runtime if the segment or index is out of bounds, in
+ *              a checked build only
+ */
+uint32_t load_word(uint32_t seg_id, uint32_t word_index, Memory_T mem);
+
+
+/* FUNCTION:    store_word
+ * Purpose:     stores a word at a given index of a given segment
+ * Arg:         seg_id: segment ID of the given segment
+ *              word_index: a word index that indicates a specific 
+ *              word in that segment
+ *              value: the word to store
+ *		mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     N/A
+ * Effect:      Gives the segment a private copy of its words first if they
+ *              are shared, so the store is never seen by another segment
+ * Exported to:	Operation module: used in the segmented store command
+ * Error:       Checked Runtime if the segment or index is out of bounds, in
+ *              a checked build only
+ */
+void store_word(uint32_t seg_id, uint32_t word_index, uint32_t value, 
+                Memory_T mem);
+
+
 /* FUNCTION:    get_next_instruction
  * Purpose:     returns the next instruction relative to the current program 
  *		counter
@@ -143,4 +238,104 @@ uint32_t get_next_instruction(Memory_T mem);
  */
 void initialize_program_ptr(Memory_T mem);
 
+
+/* FUNCTION:    segment_length
+ * Purpose:     returns the number of words in a given segment
+ * Arg:         seg_id: segment ID of the given segment
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the length of the segment in words
+ * Effect:      N/A
+ * Exported to:	Operation module: used to size the decoded copy of segment 0
+ * Error:       Checked Runtime if mem is NULL
+ */
+uint32_t segment_length(uint32_t seg_id, Memory_T mem);
+
+
+/* FUNCTION:    segment_mapped
+ * Purpose:     tells whether a segment ID names a mapped segment
+ * Arg:         seg_id: segment ID to check
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     true if seg_id is mapped, false otherwise
+ * Effect:      N/A
+ * Exported to:	Operation module: used to report machine failures instead of
+ *              aborting
+ * Error:       Checked Runtime if mem is NULL
+ */
+bool segment_mapped(uint32_t seg_id, Memory_T mem);
+
+
+/* FUNCTION:    segment_table
+ * Purpose:     returns where the memory keeps its segment table
+ * Arg:         mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     the address of the pointer to the first Segment. The pointer
+ *              itself changes whenever the table grows, its address does not
+ * Effect:      N/A
+ * Exported to:	JIT module: compiled loads and stores read the table
+ *              through this address
+ *              Operation module: used to read segment 0 in place when
+ *              decoding it
+ * Error:       Checked Runtime if mem is NULL
+ */
+Segment **segment_table(Memory_T mem);
+
+
+/* FUNCTION:    segment_trap
+ * Purpose:     find the segment a trapped access was meant for
+ * Arg:         address: the address that could not be accessed
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ *              seg_id: set to the segment's ID, or to UINT32_MAX if the
+ *                      access was to an unmapped segment
+ *              index: set to the word index that was accessed
+ * Returns:     true if the address is in the guard pages past a segment,
+ *              or is a word index from the null words of an unmapped
+ *              segment; false if the trap has some other cause
+ * Effect:      N/A. Only reads memory, so it can be called from a signal
+ *              handler while no segment is being mapped or unmapped
+ * Exported to:	Operation module: used by the SIGSEGV handler of a guarded
+ *              build
+ * Error:       N/A
+ */
+bool segment_trap(const void *address, Memory_T mem, uint32_t *seg_id,
+                  uint32_t *index);
+
+
+/* FUNCTION:    save_segments
+ * Purpose:     write every segment and the free segment IDs to a snapshot
+ * Arg:         out: an open file to write to
+ *              mem: struct that contains the components of the memory 
+ *                   management unit
+ * Returns:     false if a write failed
+ * Effect:      Writes host-order words: the number of IDs handed out, the
+ *              number of free IDs and the free IDs from the first freed to
+ *              the next to be reused, then for each ID its length and
+ *              where its words are, followed by the words themselves unless the ID is
+ *              unmapped or shares the words of a lower ID
+ * Exported to:	Operation module: used to snapshot the machine
+ * Error:       Checked Runtime if out or mem is NULL
+ */
+bool save_segments(FILE *out, Memory_T mem);
+
+
+/* FUNCTION:    restore_segments
+ * Purpose:     rebuild the segments from a snapshot
+ * Arg:         words: the part of a snapshot written by save_segments
+ *              num_words: the number of words available
+ *              mem: struct that contains the components of the memory 
+ *                   management unit, with no segments mapped
+ * Returns:     the number of words used, or 0 if they are not a valid
+ *              snapshot, in which case mem should only be freed
+ * Effect:      Copies each segment's words into a new block from the pool.
+ *              Segments that shared words when the snapshot was written
+ *              share them again
+ * Exported to:	Operation module: used to restore the machine
+ * Error:       Checked Runtime if words or mem is NULL, or if a segment
+ *              has already been mapped
+ */
+size_t restore_segments(const uint32_t *words, size_t num_words, 
+                        Memory_T mem);
+
 #endif
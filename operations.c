@@ -14,28 +14,116 @@
  *     instance of our UM memory struct and an array of registers. This module 
  *     uses functions from our instruction packing and memory modules. 
  *     This module is exported to our UM main program.
+ *
+ *     In a guarded build (make GUARDED=1) the threaded and JIT engines do
+ *     not check segmented loads and stores at all. Large segments are
+ *     followed by guard pages and unmapped segments have no words, so a
+ *     bad access traps, and the SIGSEGV handler jumps back to the run it
+ *     happened in, which fails with the segment ID and word index. The
+ *     interpreter notes which instruction it is at during each access;
+ *     the JIT only knows the block, so its faults are reported at the
+ *     block's first instruction. A trap anywhere else, in the emulator's
+ *     own code, is left to kill the process as usual.
  * 
  *
  ****************************************************************************/
 
+#ifdef UM_GUARDED
+/* for REG_RIP, where a trap happened */
+#define _GNU_SOURCE
+#endif
+
 #include "operations.h"
 #include "memory.h"
 #include "instruction_packing.h"
+#include "io.h"
+#include "jit.h"
+#include "cache.h"
+#include "umn.h"
+#include "stream.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef UM_GUARDED
+#include <setjmp.h>
+#include <signal.h>
+#include <ucontext.h>
+#endif
 
 #define num_registers 8
 
+/* the byte size of a word in a program image */
+#define word_size 4
+
+/* the first word of a snapshot file, "UMs1" */
+#define snapshot_magic 0x554d7331
+
+/* the words in a snapshot before the segments: the magic word, the
+   registers and the program counter */
+#define snapshot_header (2 + num_registers)
+
+/* how many bytes the read() fallback asks for at a time */
+#define read_chunk (1 << 16)
+
+/* the longest run of LVs fused into one superinstruction */
+#define max_lv_run 8
+
+/* room for a fault message naming a segment and a word index */
+#define max_fault 96
+
+/* the most instructions the JIT engine interprets between looking for more
+   of a streamed program */
+#define stream_slice (1 << 20)
+
 /* 
  * This struct will be exported to our main program module as a struct pointer.
  * memory: pointer to a struct that stores our data structures representing
  * our memory management.
  * registers: an array of uint32_t of registers in the UM machine
+ * program: a decoded copy of segment 0, with one extra entry past the end
+ * that holds an invalid opcode so running off the program is caught
+ * program_length: the number of words in segment 0
+ * generation: how many times segment 0 has been decoded, so 1 for the
+ * program as loaded and one more for each LOADP from another segment
+ * taken: for each word of segment 0, how many times a LOADP there jumped
+ * within segment 0
+ * io: the I/O device used by the input and output instructions
+ * pc: the index in segment 0 where Operations_run starts or continues
+ * fault: why the last run failed, or NULL
+ * jit: the compiled code of segment 0, NULL until the JIT engine first runs
+ * stats: where Operations_run counts what it does, or NULL
+ * stop_at_input: whether Operations_run stops before an IN
+ * cache: where decoded copies of segment 0 are kept, or NULL
+ * stream: where the rest of a streamed segment 0 is still arriving from, or
+ * NULL once all of it has arrived
+ * trailing: the bytes after the last whole word of a streamed segment 0
+ * that ended after it started running
+ * fault_text: the message of a fault built at run time, in a guarded build
  */
 struct Operations_T {
 	Memory_T memory;
         uint32_t registers[num_registers];
+        Um_decoded *program;
+        uint32_t program_length;
+        uint32_t generation;
+        uint64_t *taken;
+        Io_T io;
+        uint32_t pc;
+        const char *fault;
+        Jit_T jit;
+        Um_stats *stats;
+        bool stop_at_input;
+        Cache_T cache;
+        Stream_T stream;
+        int trailing;
+#ifdef UM_GUARDED
+        char fault_text[max_fault];
+#endif
 };
 
 /* 
@@ -43,9 +131,57 @@ struct Operations_T {
  */
 typedef enum Um_opcode {
         CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
-        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
+        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV, INVALID,
+
+        /* superinstructions, each given to the LV that starts it:
+           LV_RUN: b LVs in a row
+           LV_LOADP: a jump to a constant
+           LV_CMOV_LOADP: a conditional branch
+           LV_OUT: output of a constant */
+        LV_RUN = UM_FUSED, LV_LOADP, LV_CMOV_LOADP, LV_OUT
 } Um_opcode;
 
+#ifdef UM_GUARDED
+/*
+ * what the SIGSEGV handler of the running thread needs:
+ *      env: where the run that is going on returns to
+ *      memory: the memory of the machine that is running
+ *      jit: the compiler whose code is running, or NULL in the interpreter
+ *      at: the load or store the interpreter is in the middle of, or NULL
+ *      armed: whether a run is going on
+ *      seg_id, index: the access that trapped, see segment_trap
+ */
+typedef struct Guard {
+        sigjmp_buf env;
+        Memory_T memory;
+        Jit_T jit;
+        const Um_decoded *volatile at;
+        volatile sig_atomic_t armed;
+        uint32_t seg_id;
+        uint32_t index;
+} Guard;
+
+static __thread Guard guard;
+
+/* GUARD starts catching traps in loads and stores, by the interpreter or
+   by the given compiler's code, making the function it is used in return
+   the fault if one comes; UNGUARD stops */
+#define GUARD(compiler)                                                 \
+        do {                                                            \
+                if (sigsetjmp(guard.env, 0) != 0) {                     \
+                        return guard_fault(op);                         \
+                }                                                       \
+                guard.memory = op->memory;                              \
+                guard.jit = (compiler);                                 \
+                guard.at = NULL;                                        \
+                guard.armed = 1;                                        \
+        } while (0)
+#define UNGUARD() (guard.armed = 0)
+#else
+#define GUARD(compiler) ((void)0)
+#define UNGUARD() ((void)0)
+#endif
+
 
 /* private helper functions, details can be viewed below */
 void load_value(uint32_t instruction, Operations_T op);
@@ -61,6 +197,26 @@ void unmap_seg (uint32_t instruction, Operations_T op);
 void seg_store (uint32_t instruction, Operations_T op);
 void seg_load  (uint32_t instruction, Operations_T op);
 void load_prog (uint32_t instruction, Operations_T op);
+void decode_program(Operations_T op);
+void decode_word   (uint32_t index, Operations_T op);
+void fuse          (uint32_t index, Operations_T op);
+bool well_formed   (const Um_decoded *program, uint32_t length);
+void install_image (const unsigned char *bytes, size_t num_bytes, 
+                    Operations_T op);
+int  install_native(unsigned char *bytes, size_t num_bytes, bool mapped,
+                    Operations_T op);
+int  read_in_fd    (int fd, bool stream, Operations_T op);
+int  start_stream  (int fd, Operations_T op);
+bool stream_more   (Operations_T op, bool wait);
+void extend_program(const unsigned char *bytes, size_t num_bytes,
+                    Operations_T op);
+unsigned char *read_all(int fd, size_t *num_bytes);
+Io_T machine_io     (Operations_T op);
+#ifdef UM_GUARDED
+void      guard_trap (int signal_number, siginfo_t *info, void *context);
+bool      in_access  (const void *context);
+Um_result guard_fault(Operations_T op);
+#endif
 
 /* FUNCTION:    Operations_new
  * Purpose:     Constructor for the operation struct that contains the memory
@@ -82,6 +238,31 @@ Operations_T Operations_new()
         }
 
         op->memory = Memory_new();
+        op->program = NULL;
+        op->program_length = 0;
+        op->generation = 0;
+        op->taken = NULL;
+        op->io = NULL;
+        op->pc = 0;
+        op->fault = NULL;
+        op->jit = NULL;
+        op->stats = NULL;
+        op->stop_at_input = false;
+        op->cache = NULL;
+        op->stream = NULL;
+        op->trailing = 0;
+
+#ifdef UM_GUARDED
+        /* every machine uses the same handler, so installing it again for
+           each one does no harm. SA_NODEFER leaves SIGSEGV unblocked after
+           the handler jumps out of itself */
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = guard_trap;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, NULL);
+#endif
 
         return op;
 }
@@ -92,7 +273,8 @@ Operations_T Operations_new()
  * Arg:         op: a pointer to an operations struct
  * Returns:     N/A
  * Exported to: Our main program module: used in running the command loop
- * Effect:      Frees the memory associated with an operations struct
+ * Effect:      Flushes the I/O device, then frees the memory associated with
+ *              an operations struct
  * Error:       If a NULL pointer or a pointer to a NULL pointer is passed in
  */
 void Operations_free(Operations_T *op)
@@ -101,12 +283,226 @@ void Operations_free(Operations_T *op)
         assert(*op != NULL);
         
         Memory_free(&((*op)->memory));
+        if ((*op)->io != NULL) {
+                Io_free(&((*op)->io));
+        }
+        free((*op)->program);
+        free((*op)->taken);
+        if ((*op)->jit != NULL) {
+                Jit_free(&((*op)->jit));
+        }
+        if ((*op)->cache != NULL) {
+                Cache_free(&((*op)->cache));
+        }
+        if ((*op)->stream != NULL) {
+                Stream_free(&((*op)->stream));
+        }
         free(*op);
 
         *op = NULL;
 }
 
 
+/* FUNCTION:    Operations_set_io
+ * Purpose:     Replace the I/O device used by the input and output
+ *              instructions
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              io: the new device, which the operations struct now owns
+ * Returns:     N/A
+ * Exported to: Our main program module: used to pick the I/O device
+ * Effect:      Flushes and frees the previous device, if there is one
+ * Error:       Checked runtime error if op or io is NULL
+ */
+void Operations_set_io(Operations_T op, Io_T io)
+{
+        assert(op != NULL);
+        assert(io != NULL);
+
+        if (op->io != NULL) {
+                Io_free(&op->io);
+        }
+        op->io = io;
+}
+
+
+/* FUNCTION:    Operations_set_stats
+ * Purpose:     Count what Operations_run does
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *                  structures
+ *              stats: where to add the counts, or NULL to stop counting.
+ *                     The caller keeps ownership
+ * Returns:     N/A
+ * Exported to: Our main program module: used by --stats
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+void Operations_set_stats(Operations_T op, Um_stats *stats)
+{
+        assert(op != NULL);
+
+        op->stats = stats;
+}
+
+
+/* FUNCTION:    Operations_stop_at_input
+ * Purpose:     Make runs stop before the program reads input
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *                  structures
+ *              stop: whether Operations_run stops before an IN
+ * Returns:     N/A
+ * Exported to: Our main program module: used to snapshot a program once it
+ *              has warmed up
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+void Operations_stop_at_input(Operations_T op, bool stop)
+{
+        assert(op != NULL);
+
+        op->stop_at_input = stop;
+}
+
+
+/* FUNCTION:    Operations_set_cache
+ * Purpose:     Keep the decoded form of each segment 0 in a code cache
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *                  structures
+ *              dir: an existing directory to keep it in, which is copied
+ * Returns:     N/A
+ * Exported to: Our main program module: used by --cache
+ * Effect:      N/A
+ * Error:       Checked runtime error if op or dir is NULL, or if a cache was
+ *              already set
+ */
+void Operations_set_cache(Operations_T op, const char *dir)
+{
+        assert(op != NULL && dir != NULL);
+        assert(op->cache == NULL);
+
+        op->cache = Cache_new(dir);
+}
+
+
+/* FUNCTION:    Operations_save
+ * Purpose:     Write the whole machine to a snapshot file
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *                  structures, stopped between two instructions
+ *              file_name: the pathname of the snapshot
+ * Returns:     false if the file cannot be written
+ * Effect:      Flushes the output, then writes the magic word, the
+ *              registers, the program counter and the segments
+ * Exported to: Our main program module: used by --snapshot
+ * Error:       Checked runtime error if op or file_name is NULL
+ */
+bool Operations_save(Operations_T op, const char *file_name)
+{
+        assert(op != NULL && file_name != NULL);
+
+        /* the snapshot holds the whole of segment 0 */
+        while (op->stream != NULL) {
+                stream_more(op, true);
+        }
+        if (op->io != NULL) {
+                Io_flush(op->io);
+        }
+
+        FILE *out = fopen(file_name, "wb");
+        if (out == NULL) {
+                return false;
+        }
+
+        uint32_t header[snapshot_header];
+        header[0] = snapshot_magic;
+        for (int i = 0; i < num_registers; i++) {
+                header[1 + i] = op->registers[i];
+        }
+        header[1 + num_registers] = op->pc;
+
+        bool written = fwrite(header, word_size, snapshot_header, out) == 
+                       snapshot_header &&
+                       save_segments(out, op->memory);
+
+        return (fclose(out) == 0) && written;
+}
+
+
+/* FUNCTION:    Operations_restore
+ * Purpose:     Load a machine from a snapshot file
+ * Arg:         op: a new operations struct with no program
+ *              file_name: the pathname of a snapshot written by
+ *                         Operations_save on a host with the same byte order
+ * Returns:     false if the file cannot be read or is not a snapshot, in
+ *              which case op can only be freed
+ * Effect:      Maps the file like read_in_file, rebuilds the segments from
+ *              it and decodes the new segment 0
+ * Exported to: Our main program module: used by --restore
+ * Error:       Checked runtime error if op or file_name is NULL, or if op
+ *              already has a program
+ */
+bool Operations_restore(Operations_T op, const char *file_name)
+{
+        assert(op != NULL && file_name != NULL);
+        assert(op->program == NULL);
+
+        int fd = open(file_name, O_RDONLY);
+        if (fd < 0) {
+                return false;
+        }
+
+        /* the words are copied into segments, so the mapping is brief */
+        size_t num_bytes = 0;
+        void *bytes = NULL;
+        bool mapped = false;
+        struct stat meta_data;
+        if (fstat(fd, &meta_data) == 0 && S_ISREG(meta_data.st_mode) &&
+            meta_data.st_size > 0) {
+                num_bytes = meta_data.st_size;
+                bytes = mmap(NULL, num_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+                mapped = bytes != MAP_FAILED;
+        }
+        if (!mapped) {
+                bytes = read_all(fd, &num_bytes);
+        }
+        close(fd);
+        if (bytes == NULL) {
+                return false;
+        }
+
+        const uint32_t *words = bytes;
+        size_t num_words = num_bytes / word_size;
+        bool restored = num_bytes % word_size == 0 && 
+                        num_words > snapshot_header &&
+                        words[0] == snapshot_magic &&
+                        restore_segments(words + snapshot_header, 
+                                         num_words - snapshot_header,
+                                         op->memory) == 
+                        num_words - snapshot_header;
+
+        /* the program counter may be one past the end, where runs fail */
+        uint32_t pc = restored ? words[1 + num_registers] : 0;
+        restored = restored && pc <= segment_length(0, op->memory);
+        if (restored) {
+                for (int i = 0; i < num_registers; i++) {
+                        op->registers[i] = words[1 + i];
+                }
+                initialize_program_ptr(op->memory);
+                if (pc < segment_length(0, op->memory)) {
+                        load_program(0, pc, op->memory);
+                }
+                decode_program(op);
+                op->pc = pc;
+        }
+
+        if (mapped) {
+                munmap(bytes, num_bytes);
+        } else {
+                free(bytes);
+        }
+        return restored;
+}
+
+
 /* FUNCTION:    read_in_program
  * Purpose:     Reads the file, packs the content into different words, and
  *              put them into segment 0
@@ -142,6 +538,458 @@ void read_in_program(FILE *input, uint32_t num_words, Operations_T op)
         }
 
         initialize_program_ptr(op->memory);
+        decode_program(op);
+        op->pc = 0;
+}
+
+
+/* FUNCTION:    read_in_words
+ * Purpose:     Puts a program that is already in host words into segment 0
+ * Arg:         words: the words of the program
+ *              num_words: the number of words
+ *              op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     N/A
+ * Exported to: Programs translated by um2c: used to load their embedded
+ *              image
+ * Effect:      Copies the words into a new segment 0 and decodes them
+ * Error:       Runtime error if the operation struct is NULL
+ */
+void read_in_words(const uint32_t *words, uint32_t num_words, 
+                   Operations_T op)
+{
+        assert(op != NULL);
+        assert(words != NULL || num_words == 0);
+
+        new_segment(num_words, op->memory);
+        if (num_words > 0) {
+                memcpy(word_at(0, 0, op->memory), words, 
+                       (size_t)num_words * word_size);
+        }
+
+        initialize_program_ptr(op->memory);
+        decode_program(op);
+        op->pc = 0;
+}
+
+
+/* FUNCTION:    read_in_file
+ * Purpose:     Reads a program image from a file into segment 0
+ * Arg:         file_name: the pathname of the program image
+ *              op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     -1 if the file cannot be opened or read, -2 if it starts
+ *              like a .umn image but is not a valid one, otherwise the
+ *              number of trailing bytes (0 to 3) that did not make up a
+ *              whole word
+ * Exported to: Our main program module: used to load the program
+ * Effect:      Maps the file into memory and converts its big-endian words
+ *              straight into segment 0. A .umn image, whose words are
+ *              already in host order, is instead mapped copy-on-write and
+ *              its words become segment 0 where they are, so processes
+ *              running the same image share its pages until they write
+ *              them. Files that cannot be mapped, such as pipes, are read
+ *              with large read() calls instead. Trailing bytes are not
+ *              loaded
+ * Error:       Runtime error if file_name or the operation struct is NULL
+ */
+int read_in_file(const char *file_name, Operations_T op)
+{
+        assert(file_name != NULL);
+        assert(op != NULL);
+
+        int fd = open(file_name, O_RDONLY);
+        if (fd < 0) {
+                return -1;
+        }
+        return read_in_fd(fd, false, op);
+}
+
+
+/* FUNCTION:    stream_in_file
+ * Purpose:     Reads a program image into segment 0 like read_in_file, but
+ *              lets it run before all of it has arrived
+ * Arg:         file_name: the pathname of the program image, which may be a
+ *                         pipe or a terminal of unknown length
+ *              op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     as read_in_file. A streamed image that has not ended yet
+ *              gives 0, and Operations_trailing counts its trailing bytes
+ *              once it ends
+ * Exported to: Our main program module: used to load the program
+ * Effect:      A file that can be mapped is loaded exactly as by
+ *              read_in_file. Any other file is read by a thread of its own:
+ *              segment 0 starts out as the words that arrived first, and
+ *              Operations_run and Operations_run_jit add the words that
+ *              have arrived since whenever the program needs a word past
+ *              the end of segment 0, by running there, jumping there or
+ *              loading or storing there, and wait for more if none have.
+ *              Only once the image has ended does running or jumping past
+ *              its end fail. A .umn image is read to its end before it is
+ *              checked
+ * Error:       Runtime error if file_name or the operation struct is NULL
+ */
+int stream_in_file(const char *file_name, Operations_T op)
+{
+        assert(file_name != NULL);
+        assert(op != NULL);
+
+        int fd = open(file_name, O_RDONLY);
+        if (fd < 0) {
+                return -1;
+        }
+        return read_in_fd(fd, true, op);
+}
+
+
+/* FUNCTION:    read_in_fd
+ * Purpose:     load a program image from an open file into segment 0
+ * Arg:         fd: the file descriptor, which is closed or handed to the
+ *                  stream
+ *              stream: whether a file that cannot be mapped is streamed
+ *              op: pointer to the operations struct storing our UM’s data
+ *                  structures
+ * Returns:     as read_in_file
+ * Exported to: N/A
+ * Effect:      The body of read_in_file and stream_in_file
+ * Error:       N/A
+ */
+int read_in_fd(int fd, bool stream, Operations_T op)
+{
+
+        /* map regular files, the size comes from the same descriptor */
+        struct stat meta_data;
+        if (fstat(fd, &meta_data) == 0 && S_ISREG(meta_data.st_mode) &&
+            meta_data.st_size > 0) {
+                size_t num_bytes = meta_data.st_size;
+
+                /* a .umn image is mapped writable, its words in place */
+                Umn_header header;
+                if (pread(fd, &header, sizeof(header), 0) == 
+                    (ssize_t)sizeof(header) && header.magic == UMN_MAGIC) {
+                        void *image = mmap(NULL, num_bytes, 
+                                           PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE, fd, 0);
+                        close(fd);
+                        if (image == MAP_FAILED) {
+                                return -1;
+                        }
+                        int status = install_native(image, num_bytes, true, 
+                                                    op);
+                        if (status < 0) {
+                                munmap(image, num_bytes);
+                        }
+                        return status;
+                }
+
+                void *bytes = mmap(NULL, num_bytes, PROT_READ, MAP_PRIVATE, 
+                                   fd, 0);
+                if (bytes != MAP_FAILED) {
+                        close(fd);
+                        madvise(bytes, num_bytes, MADV_SEQUENTIAL);
+                        install_image(bytes, num_bytes, op);
+                        munmap(bytes, num_bytes);
+                        return num_bytes % word_size;
+                }
+        }
+
+        /* otherwise stream the file, or read all of it in bulk */
+        if (stream) {
+                return start_stream(fd, op);
+        }
+        size_t num_bytes;
+        unsigned char *bytes = read_all(fd, &num_bytes);
+        close(fd);
+        if (bytes == NULL) {
+                return -1;
+        }
+
+        int status = num_bytes % word_size;
+        if (num_bytes >= sizeof(Umn_header) && 
+            ((Umn_header *)bytes)->magic == UMN_MAGIC) {
+                status = install_native(bytes, num_bytes, false, op);
+        } else {
+                install_image(bytes, num_bytes, op);
+        }
+        free(bytes);
+        return status;
+}
+
+
+/* FUNCTION:    install_image
+ * Purpose:     put the words of a program image into a new segment 0
+ * Arg:         bytes: the program image
+ *              num_bytes: the number of bytes in the image
+ *              op: pointer to the operations struct storing our UM’s data
+ *              structures
+ * Returns:     N/A
+ * Exported to: N/A
+ * Effect:      Maps segment 0, converts every whole word of the image into it
+ *              and decodes the program
+ * Error:       N/A
+ */
+void install_image(const unsigned char *bytes, size_t num_bytes, 
+                   Operations_T op)
+{
+        uint32_t num_words = num_bytes / word_size;
+
+        new_segment(num_words, op->memory);
+        if (num_words > 0) {
+                unpack_words(word_at(0, 0, op->memory), bytes, num_words);
+        }
+
+        initialize_program_ptr(op->memory);
+        decode_program(op);
+        op->pc = 0;
+}
+
+
+/* FUNCTION:    install_native
+ * Purpose:     make the words of a .umn image the new segment 0
+ * Arg:         bytes: the image, aligned for words
+ *              num_bytes: the number of bytes in the image
+ *              mapped: true if bytes is a writable MAP_PRIVATE mapping of
+ *                      exactly the image, which segment 0 then owns
+ *              op: pointer to the operations struct storing our UM’s data
+ *                  structures
+ * Returns:     0, or -2 if the image is not valid, in which case nothing
+ *              has changed and the caller keeps bytes
+ * Exported to: N/A
+ * Effect:      Checks the header and checksum, then maps segment 0 on the
+ *              words where they are, or a copy of them if the image is not
+ *              mapped, and decodes the program
+ * Error:       N/A
+ */
+int install_native(unsigned char *bytes, size_t num_bytes, bool mapped,
+                   Operations_T op)
+{
+        if (!Umn_valid(bytes, num_bytes)) {
+                return -2;
+        }
+
+        Umn_header *header = (Umn_header *)bytes;
+        uint32_t *words = (uint32_t *)(header + 1);
+        uint32_t num_words = header->num_words;
+
+        if (mapped) {
+                adopt_segment(words, num_words, op->memory);
+        } else {
+                new_segment(num_words, op->memory);
+                if (num_words > 0) {
+                        memcpy(word_at(0, 0, op->memory), words,
+                               (size_t)num_words * word_size);
+                }
+        }
+
+        initialize_program_ptr(op->memory);
+        decode_program(op);
+        op->pc = 0;
+        return 0;
+}
+
+
+/* FUNCTION:    start_stream
+ * Purpose:     load the start of a program image from a file of unknown
+ *              length and keep reading the rest in the background
+ * Arg:         fd: the file descriptor, which the stream then owns
+ *              op: pointer to the operations struct storing our UM’s data
+ *                  structures
+ * Returns:     -2 for a .umn image that is not valid, the number of
+ *              trailing bytes if the file has already ended, otherwise 0
+ * Exported to: N/A
+ * Effect:      Waits for the first word, or the end of the file, and makes
+ *              what has arrived by then segment 0. op->stream is set unless
+ *              the file has already ended. A .umn image is read to its end
+ *              and installed like any other
+ * Error:       N/A
+ */
+int start_stream(int fd, Operations_T op)
+{
+        Stream_T stream = Stream_new(fd);
+        size_t num_bytes;
+        bool ended;
+        unsigned char *bytes = Stream_take(stream, true, &num_bytes, &ended);
+
+        uint32_t magic = 0;
+        if (num_bytes > 0) {
+                memcpy(&magic, bytes, sizeof(magic));
+        }
+
+        /* a .umn image can only be checked once all of it is there */
+        if (magic == UMN_MAGIC) {
+                while (!ended) {
+                        size_t more_bytes;
+                        unsigned char *more = Stream_take(stream, true, 
+                                                          &more_bytes, 
+                                                          &ended);
+                        if (more != NULL) {
+                                bytes = realloc(bytes, 
+                                                num_bytes + more_bytes);
+                                assert(bytes != NULL);
+                                memcpy(bytes + num_bytes, more, more_bytes);
+                                num_bytes += more_bytes;
+                                free(more);
+                        }
+                }
+                Stream_free(&stream);
+                int status = install_native(bytes, num_bytes, false, op);
+                free(bytes);
+                return status;
+        }
+
+        /* set first, so the partial segment 0 is not cached */
+        op->stream = ended ? NULL : stream;
+        install_image(bytes, num_bytes, op);
+        free(bytes);
+        int trailing = 0;
+        if (ended) {
+                trailing = Stream_trailing(stream);
+                Stream_free(&stream);
+        }
+        return trailing;
+}
+
+
+/* FUNCTION:    stream_more
+ * Purpose:     add the words of a streamed program that have arrived to
+ *              segment 0
+ * Arg:         op: pointer to the operations struct storing our UM’s data
+ *                  structures, with a stream
+ *              wait: whether to wait until a word arrives or the stream
+ *                    ends
+ * Returns:     true if segment 0 grew
+ * Effect:      Frees the stream and sets op->stream to NULL once the last
+ *              word has been added, counting the bytes after it in
+ *              op->trailing. The decoded program may move
+ * Error:       N/A
+ */
+bool stream_more(Operations_T op, bool wait)
+{
+        size_t num_bytes;
+        bool ended;
+        unsigned char *bytes = Stream_take(op->stream, wait, &num_bytes, 
+                                           &ended);
+        if (bytes != NULL) {
+                extend_program(bytes, num_bytes, op);
+                free(bytes);
+        }
+        if (ended) {
+                op->trailing = Stream_trailing(op->stream);
+                Stream_free(&op->stream);
+        }
+
+        return bytes != NULL;
+}
+
+
+/* FUNCTION:    extend_program
+ * Purpose:     add words to the end of segment 0 and of its decoded copy
+ * Arg:         bytes: the words, most significant byte first
+ *              num_bytes: the number of bytes, a multiple of 4
+ *              op: pointer to the operations struct storing our UM’s data
+ *                  structures
+ * Returns:     N/A
+ * Effect:      Decodes only the new words, and fuses again the entries
+ *              before the old end whose sequences may now go on into them.
+ *              The generation stays the same, since the program is the same
+ *              one, only longer
+ * Error:       Checked runtime error if allocation fails
+ */
+void extend_program(const unsigned char *bytes, size_t num_bytes,
+                    Operations_T op)
+{
+        uint32_t old_length = op->program_length;
+        uint32_t added = num_bytes / word_size;
+        uint32_t length = old_length + added;
+
+        grow_segment(0, length, op->memory);
+        unpack_words(word_at(0, old_length, op->memory), bytes, added);
+
+        Um_decoded *program = realloc(op->program, 
+                                      ((size_t)length + 1) * sizeof(*program));
+        uint64_t *taken = realloc(op->taken, 
+                                  ((size_t)length + 1) * sizeof(*taken));
+        assert(program != NULL && taken != NULL);
+        memset(taken + old_length + 1, 0, (size_t)added * sizeof(*taken));
+
+        const uint32_t *words = (*segment_table(op->memory))[0].words;
+        for (uint32_t i = old_length; i < length; i++) {
+                program[i] = decode_instruction(words[i]);
+        }
+        program[length] = (Um_decoded){ INVALID, 0, 0, 0, 0 };
+
+        op->program = program;
+        op->taken = taken;
+        op->program_length = length;
+
+        uint32_t first = (old_length > max_lv_run + 2) ? 
+                         old_length - (max_lv_run + 2) : 0;
+        for (uint32_t i = length; i-- > first; ) {
+                fuse(i, op);
+        }
+
+        if (op->jit != NULL) {
+                Jit_reset(op->jit, program, taken, length);
+        }
+}
+
+
+/* FUNCTION:    read_all
+ * Purpose:     read everything left on a file descriptor
+ * Arg:         fd: the file descriptor to read
+ *              num_bytes: set to the number of bytes read
+ * Returns:     a malloc'd buffer with the bytes, or NULL if reading fails
+ * Exported to: N/A
+ * Effect:      N/A
+ * Error:       Checked runtime error if allocation fails
+ */
+unsigned char *read_all(int fd, size_t *num_bytes)
+{
+        size_t capacity = read_chunk;
+        size_t length = 0;
+        unsigned char *bytes = malloc(capacity);
+        assert(bytes != NULL);
+
+        for (;;) {
+                if (length == capacity) {
+                        capacity *= 2;
+                        bytes = realloc(bytes, capacity);
+                        assert(bytes != NULL);
+                }
+
+                ssize_t got = read(fd, bytes + length, capacity - length);
+                if (got == 0) {
+                        break;
+                } else if (got < 0) {
+                        free(bytes);
+                        return NULL;
+                }
+                length += got;
+        }
+
+        *num_bytes = length;
+        return bytes;
+}
+
+
+/* FUNCTION:    machine_io
+ * Purpose:     get the device the input and output instructions use
+ * Arg:         op: pointer to the operations struct storing our UM’s data
+ *                  structures
+ * Returns:     the Io_T owned by op
+ * Exported to: N/A
+ * Effect:      Makes a buffered device on stdin and stdout the first time
+ *              it is needed, if none was set. Left until then, so a
+ *              machine given its own device never touches stdin, which
+ *              the buffered device maps when it is a file
+ * Error:       Checked runtime error if allocation fails
+ */
+Io_T machine_io(Operations_T op)
+{
+        if (op->io == NULL) {
+                op->io = Io_new_buffered(STDIN_FILENO, STDOUT_FILENO);
+        }
+        return op->io;
 }
 
 
@@ -178,6 +1026,9 @@ bool do_instruction(uint32_t instruction, Operations_T op)
         
         Um_opcode operation = get_operation(instruction);
         if (operation == HALT) {
+                if (op->io != NULL) {
+                        Io_flush(op->io);
+                }
                 return false;
         } if (operation == LV) {
                 load_value(instruction, op);
@@ -211,6 +1062,1011 @@ bool do_instruction(uint32_t instruction, Operations_T op)
 }
 
 
+/*
+ * The direct-threaded engine needs the address of each handler label. Taking
+ * a label's address and jumping through a pointer are GNU extensions, so they
+ * are wrapped in __extension__ to keep -pedantic quiet.
+ */
+#define LABEL(name) (__extension__ &&name)
+#define DISPATCH(table, opcode) __extension__ ({ goto *table[opcode]; })
+
+/* 
+ * NEXT moves on to the following instruction, stopping first if the step
+ * budget has run out. JUMP does the same for the instruction at target.
+ * Both dispatch through table, the handler table the run started with
+ */
+#define NEXT()                                                          \
+        do {                                                            \
+                ip++;                                                   \
+                if (--budget == 0) goto out_of_steps;                   \
+                DISPATCH(table, ip->opcode);                            \
+        } while (0)
+
+#define JUMP(target)                                                    \
+        do {                                                            \
+                ip = program + (target);                                \
+                if (--budget == 0) goto out_of_steps;                   \
+                DISPATCH(table, ip->opcode);                            \
+        } while (0)
+
+#define FAULT(reason)                                                   \
+        do {                                                            \
+                op->fault = (reason);                                   \
+                goto fault;                                             \
+        } while (0)
+
+
+/* FUNCTION:    run_program
+ * Purpose:     run the loaded program until it reaches a HALT instruction,
+ *              using the direct-threaded engine of Operations_run
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     N/A
+ * Exported to: Our main program module: the default execution engine
+ * Effect:      Executes every instruction of the program
+ * Error:       Checked runtime error if op is NULL or the machine fails
+ */
+void run_program(Operations_T op)
+{
+        assert(op != NULL);
+
+        Um_result result = Operations_run(op, 0);
+        assert(result.status == UM_HALTED);
+}
+
+
+/* FUNCTION:    Operations_run
+ * Purpose:     run the loaded program until it halts, fails or has executed
+ *              a given number of instructions
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              max_steps: the most instructions to execute, 0 for no limit
+ * Returns:     a Um_result with the reason the run stopped and the number of
+ *              instructions executed
+ * Exported to: Our main program module and batch runners
+ * Effect:      Executes instructions from the decoded copy of segment 0,
+ *              starting at the saved program counter. Each handler ends by
+ *              jumping straight to the next handler through a label table,
+ *              so there is one indirect branch per instruction and no call
+ *              or decode per instruction. The registers and program counter
+ *              live in locals while the loop runs and are saved back when it
+ *              stops, so a run that used up its budget can be continued by
+ *              calling Operations_run again. A fused sequence runs as one
+ *              handler unless fewer steps are left in the budget than it
+ *              has instructions, in which case it runs one at a time.
+ *              With stats set, dispatch goes through a second table whose
+ *              entries count the instruction and then run its handler, so
+ *              a run without stats pays nothing for them. While segment 0
+ *              streams in, loads and stores go through a copy of the table
+ *              that waits for more of it, see stream_in_file
+ * Error:       Checked runtime error if op is NULL or has no program. Machine
+ *              failures are reported as UM_FAULT, see Operations_fault
+ */
+Um_result Operations_run(Operations_T op, uint64_t max_steps)
+{
+        assert(op != NULL);
+        assert(op->program != NULL);
+
+        /* handler for each opcode, indexed by the decoded opcode */
+        static void *const dispatch[UM_FUSED + 4] = {
+                LABEL(do_cmov),    LABEL(do_sload),   LABEL(do_sstore),
+                LABEL(do_add),     LABEL(do_mul),     LABEL(do_div),
+                LABEL(do_nand),    LABEL(do_halt),    LABEL(do_map),
+                LABEL(do_unmap),   LABEL(do_out),     LABEL(do_in),
+                LABEL(do_loadp),   LABEL(do_lv),      LABEL(do_invalid),
+                LABEL(do_invalid),
+                LABEL(do_lv_run),  LABEL(do_lv_loadp), 
+                LABEL(do_lv_cmov_loadp), LABEL(do_lv_out)
+        };
+
+        /* the same, counting each instruction first. A fused sequence is
+           counted and run as the plain instructions it is made of */
+        static void *const counting[UM_FUSED + 4] = {
+                LABEL(count_cmov), LABEL(count_sload), LABEL(count_sstore),
+                LABEL(count_add),  LABEL(count_mul),   LABEL(count_div),
+                LABEL(count_nand), LABEL(count_halt),  LABEL(count_map),
+                LABEL(count_unmap), LABEL(count_out),  LABEL(count_in),
+                LABEL(count_loadp), LABEL(count_lv),   LABEL(do_invalid),
+                LABEL(do_invalid),
+                LABEL(count_lv),   LABEL(count_lv),   LABEL(count_lv),
+                LABEL(count_lv)
+        };
+
+        uint32_t registers[num_registers];
+        for (int i = 0; i < num_registers; i++) {
+                registers[i] = op->registers[i];
+        }
+
+        Memory_T memory = op->memory;
+        Io_T io = machine_io(op);
+        Um_decoded *program = op->program;
+        uint64_t *taken = op->taken;
+        const Um_decoded *ip = program + op->pc;
+        uint64_t budget = (max_steps == 0) ? UINT64_MAX : max_steps;
+        Um_stats *stats = op->stats;
+        void *const *base = (stats == NULL) ? dispatch : counting;
+        void *const *table = base;
+        Um_status status;
+
+        /* while segment 0 streams in, loads and stores go through handlers
+           that wait for the words past its end first */
+        void *streaming[UM_FUSED + 4];
+        if (op->stream != NULL) {
+                memcpy(streaming, base, sizeof(streaming));
+                streaming[SLOAD] = LABEL(stream_sload);
+                streaming[SSTORE] = LABEL(stream_sstore);
+                table = streaming;
+        }
+
+        op->fault = NULL;
+        GUARD(NULL);
+        DISPATCH(table, ip->opcode);
+
+do_cmov:
+        if (registers[ip->c] != 0) {
+                registers[ip->a] = registers[ip->b];
+        }
+        NEXT();
+
+do_sload:
+#ifdef UM_CHECKED
+        if (!segment_mapped(registers[ip->b], memory) ||
+            registers[ip->c] >= segment_length(registers[ip->b], memory)) {
+                FAULT("segmented load out of bounds");
+        }
+#endif
+#ifdef UM_GUARDED
+        guard.at = ip;
+#endif
+        registers[ip->a] = load_word(registers[ip->b], registers[ip->c], 
+                                     memory);
+#ifdef UM_GUARDED
+        guard.at = NULL;
+#endif
+        NEXT();
+
+do_sstore: {
+        uint32_t seg_id = registers[ip->a];
+        uint32_t index = registers[ip->b];
+
+#ifdef UM_CHECKED
+        if (!segment_mapped(seg_id, memory) ||
+            index >= segment_length(seg_id, memory)) {
+                FAULT("segmented store out of bounds");
+        }
+#endif
+#ifdef UM_GUARDED
+        guard.at = ip;
+#endif
+        store_word(seg_id, index, registers[ip->c], memory);
+#ifdef UM_GUARDED
+        guard.at = NULL;
+#endif
+
+        /* keep the decoded copy of segment 0 in step with the store */
+        if (seg_id == 0) {
+                decode_word(index, op);
+        }
+        NEXT();
+}
+
+do_add:
+        registers[ip->a] = registers[ip->b] + registers[ip->c];
+        NEXT();
+
+do_mul:
+        registers[ip->a] = registers[ip->b] * registers[ip->c];
+        NEXT();
+
+do_div:
+        if (registers[ip->c] == 0) {
+                FAULT("division by zero");
+        }
+        registers[ip->a] = registers[ip->b] / registers[ip->c];
+        NEXT();
+
+do_nand:
+        registers[ip->a] = ~(registers[ip->b] & registers[ip->c]);
+        NEXT();
+
+do_map:
+        registers[ip->b] = new_segment(registers[ip->c], memory);
+        NEXT();
+
+do_unmap:
+        if (registers[ip->c] == 0 || 
+            !segment_mapped(registers[ip->c], memory)) {
+                FAULT("unmap of segment 0 or of an unmapped segment");
+        }
+        remove_segment(registers[ip->c], memory);
+        NEXT();
+
+do_out:
+        if (registers[ip->c] > 255) {
+                FAULT("output of a value greater than 255");
+        }
+        Io_put(io, registers[ip->c]);
+        NEXT();
+
+do_in: {
+        if (op->stop_at_input) {
+                status = UM_INPUT;
+                goto done;
+        }
+        int value = Io_get(io);
+        registers[ip->c] = (value == -1) ? ~0u : (uint32_t)value;
+        NEXT();
+}
+
+do_loadp: {
+        uint32_t seg_id = registers[ip->b];
+        uint32_t target = registers[ip->c];
+
+        /* 
+         * A jump within segment 0. The value field of a LOADP entry caches
+         * the last target jumped to from there, which is known to be in
+         * bounds, so only a new target needs checking
+         */
+        if (seg_id == 0) {
+                uint32_t site = ip - program;
+                if (target != ip->value) {
+                        if (target >= op->program_length) {
+                                if (op->stream != NULL) {
+                                        goto stream_wait;
+                                }
+                                FAULT("load program past the end of the "
+                                      "segment");
+                        }
+                        program[site].value = target;
+                }
+                taken[site]++;
+                JUMP(target);
+        }
+
+        /* a load from another segment replaces the decoded program, and
+           the rest of a streamed one is no longer needed */
+        if (!segment_mapped(seg_id, memory)) {
+                FAULT("load program from an unmapped segment");
+        }
+        if (op->stream != NULL) {
+                Stream_free(&op->stream);
+                table = base;
+        }
+        load_program(seg_id, target, memory);
+        decode_program(op);
+        program = op->program;
+        taken = op->taken;
+
+        if (target >= op->program_length) {
+                FAULT("load program past the end of the segment");
+        }
+        JUMP(target);
+}
+
+do_lv:
+        registers[ip->a] = ip->value;
+        NEXT();
+
+        /* 
+         * The fused handlers. Each runs its whole sequence only if the
+         * budget covers every instruction in it, and otherwise runs just
+         * the LV it starts with. The budget is charged for all but the last
+         * instruction here, and for the last one by NEXT or by the LOADP
+         */
+do_lv_run: {
+        uint32_t count = ip->b;
+        if (budget < count) {
+                goto do_lv;
+        }
+        for (uint32_t k = 0; k < count; k++) {
+                registers[ip[k].a] = ip[k].value;
+        }
+        ip += count - 1;
+        budget -= count - 1;
+        NEXT();
+}
+
+do_lv_loadp:
+        if (budget < 2) {
+                goto do_lv;
+        }
+        registers[ip->a] = ip->value;
+        ip++;
+        budget--;
+        goto do_loadp;
+
+do_lv_cmov_loadp:
+        if (budget < 3) {
+                goto do_lv;
+        }
+        registers[ip->a] = ip->value;
+        if (registers[ip[1].c] != 0) {
+                registers[ip[1].a] = registers[ip[1].b];
+        }
+        ip += 2;
+        budget -= 2;
+        goto do_loadp;
+
+do_lv_out:
+        if (budget < 2) {
+                goto do_lv;
+        }
+        registers[ip->a] = ip->value;
+        Io_put(io, ip->value);
+        ip++;
+        budget--;
+        NEXT();
+
+do_invalid:
+        /* opcodes 14 and 15 are not part of the UM instruction set, and the
+           entry after the end of segment 0 is marked with one of them */
+        if (ip == program + op->program_length && op->stream != NULL) {
+                goto stream_wait;
+        }
+        FAULT(ip == program + op->program_length ?
+              "ran past the end of segment 0" : "invalid opcode");
+
+do_halt:
+        Io_flush(io);
+        status = UM_HALTED;
+        budget--;
+        goto done;
+
+        /* 
+         * The counting handlers, used only when the run has stats. Each
+         * counts its instruction and goes on to the handler that runs it
+         */
+count_cmov:
+        stats->opcodes[CMOV]++;
+        goto do_cmov;
+
+count_sload:
+        stats->opcodes[SLOAD]++;
+        goto do_sload;
+
+count_sstore:
+        stats->opcodes[SSTORE]++;
+        goto do_sstore;
+
+count_add:
+        stats->opcodes[ADD]++;
+        goto do_add;
+
+count_mul:
+        stats->opcodes[MUL]++;
+        goto do_mul;
+
+count_div:
+        stats->opcodes[DIV]++;
+        goto do_div;
+
+count_nand:
+        stats->opcodes[NAND]++;
+        goto do_nand;
+
+count_halt:
+        stats->opcodes[HALT]++;
+        goto do_halt;
+
+count_map: {
+        uint32_t size = registers[ip->c];
+        int bits = 0;
+        while (bits < 32 && (size >> bits) != 0) {
+                bits++;
+        }
+        stats->opcodes[ACTIVATE]++;
+        stats->maps++;
+        stats->map_sizes[bits]++;
+        if (++stats->live > stats->peak_live) {
+                stats->peak_live = stats->live;
+        }
+        goto do_map;
+}
+
+count_unmap:
+        stats->opcodes[INACTIVATE]++;
+        stats->unmaps++;
+        stats->live--;
+        goto do_unmap;
+
+count_out:
+        stats->opcodes[OUT]++;
+        stats->bytes_out++;
+        goto do_out;
+
+count_in: {
+        /* counted after the read, which may find the end of input */
+        if (op->stop_at_input) {
+                goto do_in;
+        }
+        int value = Io_get(io);
+        stats->opcodes[IN]++;
+        stats->bytes_in += (value != -1);
+        registers[ip->c] = (value == -1) ? ~0u : (uint32_t)value;
+        NEXT();
+}
+
+count_loadp:
+        stats->opcodes[LOADP]++;
+        if (registers[ip->b] == 0) {
+                stats->jumps++;
+        } else {
+                stats->loads++;
+                if (segment_mapped(registers[ip->b], memory)) {
+                        stats->words_loaded += 
+                                segment_length(registers[ip->b], memory);
+                }
+        }
+        goto do_loadp;
+
+count_lv:
+        stats->opcodes[LV]++;
+        goto do_lv;
+
+        /* 
+         * The streaming handlers, used only while segment 0 streams in. A
+         * load or store past its end, like running or jumping past it,
+         * waits for more of it and then runs the instruction again
+         */
+stream_sload:
+        if (registers[ip->b] == 0 && 
+            registers[ip->c] >= op->program_length) {
+                goto stream_wait;
+        }
+        DISPATCH(base, SLOAD);
+
+stream_sstore:
+        if (registers[ip->a] == 0 && 
+            registers[ip->b] >= op->program_length) {
+                goto stream_wait;
+        }
+        DISPATCH(base, SSTORE);
+
+stream_wait: {
+        /* output is not held back while the rest of the program arrives,
+           and the decoded program moves as it grows */
+        uint32_t pc = ip - program;
+        Io_flush(io);
+        stream_more(op, true);
+        program = op->program;
+        taken = op->taken;
+        ip = program + pc;
+        if (op->stream == NULL) {
+                table = base;
+        }
+        DISPATCH(table, ip->opcode);
+}
+
+out_of_steps:
+        status = UM_BUDGET;
+        goto done;
+
+fault:
+        Io_flush(io);
+        status = UM_FAULT;
+
+done:
+        UNGUARD();
+
+        /* save the machine state for the caller or the next run */
+        for (int i = 0; i < num_registers; i++) {
+                op->registers[i] = registers[i];
+        }
+        op->pc = ip - program;
+
+        Um_result result = { status, 
+                             ((max_steps == 0) ? UINT64_MAX : max_steps) - 
+                             budget };
+        return result;
+}
+
+
+/* FUNCTION:    Operations_run_jit
+ * Purpose:     run the loaded program like Operations_run, but with the
+ *              blocks of segment 0 compiled to native code
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              max_steps: the most instructions to execute, 0 for no limit
+ * Returns:     a Um_result, exactly as Operations_run would return it
+ * Exported to: Our main program module: the --engine=jit execution engine
+ * Effect:      Alternates between compiled code and Operations_run: the JIT
+ *              hands back each instruction it cannot run, which the
+ *              interpreter runs as a one-step budget, and a block too long
+ *              for the rest of the budget, which the interpreter finishes.
+ *              A segment 0 that is still streaming in is only interpreted,
+ *              and compiled once all of it has arrived
+ * Error:       Checked runtime error if op is NULL or has no program. Machine
+ *              failures are reported as UM_FAULT, see Operations_fault
+ */
+Um_result Operations_run_jit(Operations_T op, uint64_t max_steps)
+{
+        assert(op != NULL);
+        assert(op->program != NULL);
+
+        uint64_t limit = (max_steps == 0) ? UINT64_MAX : max_steps;
+        uint64_t remaining = limit;
+        Um_result result = { UM_BUDGET, 0 };
+
+        /* a program still streaming in is interpreted in slices, taking
+           what has arrived after each, until all of it is there */
+        while (op->stream != NULL && remaining > 0) {
+                result = Operations_run(op, (remaining < stream_slice) ? 
+                                            remaining : stream_slice);
+                remaining -= result.steps;
+                if (result.status != UM_BUDGET) {
+                        result.steps = limit - remaining;
+                        return result;
+                }
+                if (op->stream != NULL) {
+                        stream_more(op, false);
+                }
+        }
+
+        if (op->jit == NULL && remaining > 0) {
+                op->jit = Jit_new(op);
+                if (op->jit == NULL) {
+                        result = Operations_run(op, remaining);
+                        result.steps += limit - remaining;
+                        return result;
+                }
+                Jit_reset(op->jit, op->program, op->taken, 
+                          op->program_length);
+        }
+
+        while (remaining > 0) {
+                GUARD(op->jit);
+                Jit_exit exit = Jit_run(op->jit, &op->pc, &remaining);
+                UNGUARD();
+                if (remaining == 0) {
+                        break;
+                }
+
+                result = Operations_run(op, (exit == JIT_BUDGET) ? 
+                                            remaining : 1);
+                remaining -= result.steps;
+                if (result.status != UM_BUDGET) {
+                        break;
+                }
+        }
+
+        result.steps = limit - remaining;
+        return result;
+}
+
+
+/* FUNCTION:    Operations_fault
+ * Purpose:     describe why the last run failed
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     a short description of the failure, or NULL if the last call
+ *              to Operations_run did not fail
+ * Exported to: Our main program module: used to report machine failures
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+const char *Operations_fault(Operations_T op)
+{
+        assert(op != NULL);
+
+        return op->fault;
+}
+
+
+/* FUNCTION:    Operations_trailing
+ * Purpose:     get the trailing bytes of a streamed program
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     the number of bytes (0 to 3) after the last whole word of a
+ *              streamed image that ended after stream_in_file returned, or
+ *              0 if it has not ended, even if segment 0 does not hold all
+ *              of its words yet
+ * Exported to: Our main program module: used to report them like those of
+ *              a file that was read whole
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+int Operations_trailing(Operations_T op)
+{
+        assert(op != NULL);
+
+        /* a stream may have ended with words the program never needed */
+        if (op->stream != NULL) {
+                return Stream_trailing(op->stream);
+        }
+        return op->trailing;
+}
+
+
+/* FUNCTION:    Operations_pc
+ * Purpose:     get the saved program counter
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     the index in segment 0 of the next instruction to execute, or
+ *              of the instruction that failed
+ * Exported to: Our main program module: used to report machine failures
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+uint32_t Operations_pc(Operations_T op)
+{
+        assert(op != NULL);
+
+        return op->pc;
+}
+
+
+/* FUNCTION:    Operations_taken
+ * Purpose:     get how often a LOADP jumped within segment 0
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              pc: the index of the LOADP in segment 0
+ * Returns:     the number of jumps made from pc by the threaded and JIT
+ *              engines since segment 0 was last replaced, or 0 if pc is
+ *              past the end of segment 0
+ * Exported to: Our main program module and other engines: used to find the
+ *              hot branches of a program
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+uint64_t Operations_taken(Operations_T op, uint32_t pc)
+{
+        assert(op != NULL);
+
+        if (op->taken == NULL || pc >= op->program_length) {
+                return 0;
+        }
+        return op->taken[pc];
+}
+
+
+/* FUNCTION:    Operations_generation
+ * Purpose:     tell apart the programs that have been segment 0
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     1 for the program as loaded, and one more for each LOADP from
+ *              another segment since, or 0 if no program is loaded
+ * Exported to: Profiler module: used to tell which
+ *              program a program counter belongs to
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+uint32_t Operations_generation(Operations_T op)
+{
+        assert(op != NULL);
+
+        return op->generation;
+}
+
+
+/* FUNCTION:    Operations_set_pc
+ * Purpose:     set the program counter the next run starts at
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              pc: the index in segment 0 of the next instruction
+ * Returns:     N/A
+ * Exported to: Programs translated by um2c: used to hand execution back to
+ *              the interpreter
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+void Operations_set_pc(Operations_T op, uint32_t pc)
+{
+        assert(op != NULL);
+
+        op->pc = pc;
+}
+
+
+/* FUNCTION:    Operations_registers
+ * Purpose:     get the saved registers
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     pointer to the 8 registers, which a run loads when it starts
+ *              and saves when it stops
+ * Exported to: Programs translated by um2c: used to hand registers to and
+ *              from the interpreter. JIT module: compiled code loads and
+ *              saves them
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+uint32_t *Operations_registers(Operations_T op)
+{
+        assert(op != NULL);
+
+        return op->registers;
+}
+
+
+/* FUNCTION:    Operations_memory
+ * Purpose:     get the machine's memory
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     the Memory_T owned by op
+ * Exported to: Programs translated by um2c and the JIT module: their
+ *              loads, stores, maps and unmaps use the memory module directly
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+Memory_T Operations_memory(Operations_T op)
+{
+        assert(op != NULL);
+
+        return op->memory;
+}
+
+
+/* FUNCTION:    Operations_io
+ * Purpose:     get the machine's I/O device
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     the Io_T owned by op
+ * Exported to: Programs translated by um2c: used by their input and output
+ *              instructions
+ * Effect:      Makes the default device if op has none yet, see machine_io
+ * Error:       Checked runtime error if op is NULL
+ */
+Io_T Operations_io(Operations_T op)
+{
+        assert(op != NULL);
+
+        return machine_io(op);
+}
+
+
+/* FUNCTION:    Operations_store
+ * Purpose:     store a word the way the segmented store instruction does
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              seg_id, index: where to store
+ *              value: the word to store
+ * Returns:     N/A
+ * Exported to: Programs translated by um2c and the JIT module: used for
+ *              stores to segment 0
+ * Effect:      Keeps the decoded copy of segment 0, and any compiled code,
+ *              in step with the store
+ * Error:       Checked runtime error if op is NULL
+ */
+void Operations_store(Operations_T op, uint32_t seg_id, uint32_t index,
+                      uint32_t value)
+{
+        assert(op != NULL);
+
+        store_word(seg_id, index, value, op->memory);
+        if (seg_id == 0) {
+                decode_word(index, op);
+        }
+}
+
+
+/* FUNCTION:    decode_program
+ * Purpose:     rebuild the decoded copy of segment 0
+ * Arg:         op: pointer to the operations struct storing our UM’s data
+ *              structures
+ * Returns:     N/A
+ * Exported to: N/A
+ * Effect:      Replaces op->program with one decoded entry per word of
+ *              segment 0, followed by an INVALID entry, starts a new
+ *              generation, clears the jump counts, fuses the sequences
+ *              Operations_run has superinstructions for, and throws away any
+ *              compiled code. A segment 0 that is still streaming in is not
+ *              looked up in the cache or added to it
+ * Error:       Checked runtime error if op is NULL or allocation fails
+ */
+void decode_program(Operations_T op)
+{
+        assert(op != NULL);
+
+        uint32_t length = segment_length(0, op->memory);
+        Um_decoded *program = realloc(op->program, 
+                                      ((size_t)length + 1) * sizeof(*program));
+        assert(program != NULL);
+
+        /* the counts of the old segment 0 do not apply to the new one */
+        free(op->taken);
+        op->taken = calloc((size_t)length + 1, sizeof(*op->taken));
+        assert(op->taken != NULL);
+
+        /* read in place, so words shared with another segment stay shared.
+           A cached copy is already fused, and is only used if it could
+           have come from fuse, since the file may have been altered */
+        const uint32_t *words = (*segment_table(op->memory))[0].words;
+        bool caching = op->cache != NULL && length > 0 && op->stream == NULL;
+        bool cached = caching && 
+                      Cache_load(op->cache, words, length, program) &&
+                      well_formed(program, length);
+        if (!cached) {
+                for (uint32_t i = 0; i < length; i++) {
+                        program[i] = decode_instruction(words[i]);
+                }
+        }
+
+        /* the extra entry stops a program that runs off its end */
+        program[length] = (Um_decoded){ INVALID, 0, 0, 0, 0 };
+
+        op->program = program;
+        op->program_length = length;
+        op->generation++;
+
+        /* backwards, so each run of LVs knows what follows it */
+        if (!cached) {
+                for (uint32_t i = length; i-- > 0; ) {
+                        fuse(i, op);
+                }
+                if (caching) {
+                        Cache_store(op->cache, words, length, program);
+                }
+        }
+
+        /* any code compiled from the old segment 0 is now wrong */
+        if (op->jit != NULL) {
+                Jit_reset(op->jit, program, op->taken, length);
+        }
+}
+
+
+/* FUNCTION:    decode_word
+ * Purpose:     decode one word of segment 0 again after it was stored to
+ * Arg:         index: the index of the word in segment 0
+ *              op: pointer to the operations struct storing our UM’s data
+ *              structures
+ * Returns:     N/A
+ * Exported to: N/A
+ * Effect:      Updates the entry of op->program at index, fuses again the
+ *              entries before it that a sequence through it could start at,
+ *              and drops any compiled code built from the old word
+ * Error:       Checked runtime error if op is NULL
+ */
+void decode_word(uint32_t index, Operations_T op)
+{
+        assert(op != NULL);
+
+        Um_decoded *program = op->program;
+        unsigned before = UM_PLAIN_OPCODE(program[index]);
+
+        program[index] = decode_instruction(load_word(0, index, op->memory));
+
+        /* 
+         * A word that is an LV neither before nor after the store can only
+         * be the second word of a sequence starting just before it, or the
+         * third word of a conditional branch. A run of LVs reaching back
+         * from where the sequences through index start is fused again too,
+         * since a run stops at the start of a longer sequence
+         */
+        unsigned after = program[index].opcode;
+        uint32_t first = index;
+        bool refuse = (before == LV || after == LV);
+        if (index >= 1 && UM_PLAIN_OPCODE(program[index - 1]) == LV) {
+                first = index - 1;
+                refuse = true;
+        } else if (index >= 2 && program[index - 1].opcode == CMOV &&
+                   UM_PLAIN_OPCODE(program[index - 2]) == LV) {
+                first = index - 2;
+                refuse = true;
+        }
+
+        if (refuse) {
+                while (first > 0 && index - first < max_lv_run + 2 &&
+                       UM_PLAIN_OPCODE(program[first - 1]) == LV) {
+                        first--;
+                }
+                for (uint32_t i = index + 1; i-- > first; ) {
+                        fuse(i, op);
+                }
+        }
+
+        if (op->jit != NULL) {
+                Jit_invalidate(op->jit, index);
+        }
+}
+
+
+/* FUNCTION:    fuse
+ * Purpose:     decide whether an entry of the decoded program starts a
+ *              fused sequence
+ * Arg:         index: the index of the entry in segment 0
+ *              op: pointer to the operations struct storing our UM’s data
+ *              structures
+ * Returns:     N/A
+ * Exported to: N/A
+ * Effect:      An LV entry gets the opcode of the superinstruction its
+ *              sequence matches, or LV again if none does. The entries after
+ *              it are left alone, so a jump into the middle of a sequence
+ *              still runs it one instruction at a time. A run of LVs stops
+ *              before an LV that starts a longer pattern, so the entries
+ *              after index must be fused already
+ * Error:       N/A
+ */
+void fuse(uint32_t index, Operations_T op)
+{
+        Um_decoded *ins = op->program + index;
+        uint32_t left = op->program_length - index;
+
+        if (UM_PLAIN_OPCODE(ins[0]) != LV) {
+                return;
+        }
+        ins->opcode = LV;
+        ins->b = 0;
+
+        if (left >= 3 && ins[1].opcode == CMOV && ins[2].opcode == LOADP) {
+                ins->opcode = LV_CMOV_LOADP;
+        } else if (left >= 2 && ins[1].opcode == LOADP) {
+                ins->opcode = LV_LOADP;
+        } else if (left >= 2 && ins[1].opcode == OUT && ins[1].c == ins->a &&
+                   ins->value <= 255) {
+                ins->opcode = LV_OUT;
+        } else {
+                uint32_t count = 1;
+                while (count < max_lv_run && count < left &&
+                       (ins[count].opcode == LV || 
+                        ins[count].opcode == LV_RUN)) {
+                        count++;
+                }
+                if (count > 1) {
+                        ins->opcode = LV_RUN;
+                        ins->b = count;
+                }
+        }
+}
+
+
+/* FUNCTION:    well_formed
+ * Purpose:     check a decoded program that was not decoded here
+ * Arg:         program: the decoded entries, one per word of segment 0
+ *              length: the number of entries
+ * Returns:     true if every entry is safe to run: its opcode has a
+ *              handler, its registers are below num_registers, a LOADP's
+ *              cached target is in segment 0, and a fused LV is followed
+ *              by the entries its superinstruction runs
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+bool well_formed(const Um_decoded *program, uint32_t length)
+{
+        for (uint32_t i = 0; i < length; i++) {
+                const Um_decoded *ins = program + i;
+                uint32_t left = length - i;
+
+                if (ins->opcode > LV_OUT || ins->a >= num_registers ||
+                    ins->c >= num_registers ||
+                    (ins->b >= num_registers && ins->opcode != LV_RUN)) {
+                        return false;
+                }
+
+                bool fits;
+                switch (ins->opcode) {
+                case LOADP:
+                        fits = ins->value < length;
+                        break;
+                case LV_RUN:
+                        fits = ins->b >= 2 && ins->b <= max_lv_run && 
+                               ins->b <= left;
+                        for (uint32_t k = 1; fits && k < ins->b; k++) {
+                                fits = UM_PLAIN_OPCODE(ins[k]) == LV;
+                        }
+                        break;
+                case LV_LOADP:
+                        fits = left >= 2 && ins[1].opcode == LOADP;
+                        break;
+                case LV_CMOV_LOADP:
+                        fits = left >= 3 && ins[1].opcode == CMOV && 
+                               ins[2].opcode == LOADP;
+                        break;
+                case LV_OUT:
+                        fits = left >= 2 && ins[1].opcode == OUT &&
+                               ins[1].c == ins->a && ins->value <= 255;
+                        break;
+                default:
+                        fits = true;
+                }
+                if (!fits) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+
 /* FUNCTION:    load_value
  * Purpose:     load value into a given register a
  * Arg:         instruction: the instruction to be executed
@@ -256,7 +2112,7 @@ void output(uint32_t instruction, Operations_T op)
         
         /* check for range and output */
         assert(value < 256);
-        fputc(value, stdout);
+        Io_put(machine_io(op), value);
 }
 
 /* FUNCTION:    input
@@ -276,7 +2132,7 @@ void input(uint32_t instruction, Operations_T op)
         /* get the register we are inputting */
         uint32_t register_num = get_register(instruction, 'c');
 
-        int value = fgetc(stdin);
+        int value = Io_get(machine_io(op));
         
         if (value == -1) {
                 value = ~0;
@@ -513,7 +2369,12 @@ void seg_store(uint32_t instruction, Operations_T op)
         uint32_t value_c = op->registers[registerc_num];
         
         /* store the value in register c in the requested location */
-        *(word_at(value_a, value_b, op->memory)) = value_c;
+        store_word(value_a, value_b, value_c, op->memory);
+
+        /* keep the decoded copy of segment 0 in step with the store */
+        if (value_a == 0) {
+                decode_word(value_b, op);
+        }
 }
 
 
@@ -540,7 +2401,7 @@ void seg_load(uint32_t instruction, Operations_T op)
         uint32_t value_b = op->registers[registerb_num];
         uint32_t value_c = op->registers[registerc_num];
         
-        op->registers[registera_num] = *(word_at(value_b, value_c, op->memory));
+        op->registers[registera_num] = load_word(value_b, value_c, op->memory);
 }
 
 
@@ -570,4 +2431,114 @@ void load_prog(uint32_t instruction, Operations_T op)
         uint32_t value_c = op->registers[registerc_num];
 
         load_program(value_b, value_c, op->memory);
+
+        /* a new segment 0 needs a new decoded copy */
+        if (value_b != 0) {
+                decode_program(op);
+        }
+}
+
+
+#ifdef UM_GUARDED
+/* FUNCTION:    guard_trap
+ * Purpose:     the SIGSEGV handler of a guarded build
+ * Arg:         signal_number: SIGSEGV
+ *              info: the address that could not be accessed
+ *              context: the registers when it trapped
+ * Returns:     N/A
+ * Exported to: N/A
+ * Effect:      Jumps back to the run going on in this thread if the trap
+ *              was a bad segmented access. Otherwise it puts back the
+ *              default action and returns, so the access traps again and
+ *              the process dies as it would have without the handler
+ * Error:       N/A
+ */
+void guard_trap(int signal_number, siginfo_t *info, void *context)
+{
+        if (guard.armed && in_access(context) &&
+            segment_trap(info->si_addr, guard.memory, 
+                         &guard.seg_id, &guard.index)) {
+                guard.armed = 0;
+                siglongjmp(guard.env, 1);
+        }
+        signal(signal_number, SIG_DFL);
+}
+
+
+/* FUNCTION:    in_access
+ * Purpose:     tell a trap in a segmented load or store from any other
+ * Arg:         context: the registers when the trap happened
+ * Returns:     true if the interpreter is in the middle of a load or
+ *              store, or the trap happened in compiled code
+ * Exported to: N/A
+ * Effect:      N/A
+ * Error:       N/A
+ */
+bool in_access(const void *context)
+{
+        if (guard.at != NULL) {
+                unsigned opcode = UM_PLAIN_OPCODE(*guard.at);
+                return opcode == SLOAD || opcode == SSTORE;
+        }
+        if (guard.jit == NULL) {
+                return false;
+        }
+#if defined(__x86_64__) && defined(__linux__)
+        const ucontext_t *registers = context;
+        return Jit_contains(guard.jit, 
+                            (const void *)registers->uc_mcontext.gregs[REG_RIP]);
+#else
+        (void)context;
+        return false;
+#endif
+}
+
+
+/* FUNCTION:    guard_fault
+ * Purpose:     end a run after guard_trap jumped back to it
+ * Arg:         op: pointer to the operations struct storing our UM’s data
+ *                  structures
+ * Returns:     a Um_result with status UM_FAULT. Its step count is 0, as
+ *              the run's count is lost in the jump
+ * Exported to: N/A
+ * Effect:      Sets the program counter to the instruction that trapped,
+ *              or in compiled code to the first instruction of its block,
+ *              and the fault to a message naming the segment and the
+ *              word index. Flushes the I/O device, if there is one. The
+ *              registers are left as the run found them
+ * Error:       N/A
+ */
+Um_result guard_fault(Operations_T op)
+{
+        const char *access = "access";
+        if (guard.at != NULL) {
+                op->pc = guard.at - op->program;
+                access = (UM_PLAIN_OPCODE(*guard.at) == SSTORE) ? "store" : 
+                                                                  "load";
+        } else if (op->jit != NULL) {
+                op->pc = Jit_fault_pc(op->jit);
+        }
+
+        if (guard.seg_id == UINT32_MAX) {
+                snprintf(op->fault_text, sizeof(op->fault_text), 
+                         "segmented %s in an unmapped segment, word %u",
+                         access, guard.index);
+        } else if (!segment_mapped(guard.seg_id, op->memory)) {
+                /* an ID the segment table has no room for */
+                snprintf(op->fault_text, sizeof(op->fault_text), 
+                         "segmented %s in unmapped segment %u",
+                         access, guard.seg_id);
+        } else {
+                snprintf(op->fault_text, sizeof(op->fault_text), 
+                         "segmented %s out of bounds, word %u of segment %u",
+                         access, guard.index, guard.seg_id);
+        }
+        op->fault = op->fault_text;
+        if (op->io != NULL) {
+                Io_flush(op->io);
+        }
+
+        Um_result result = { UM_FAULT, 0 };
+        return result;
 }
+#endif
@@ -22,9 +22,57 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include "io.h"
+#include "memory.h"
 
 typedef struct Operations_T *Operations_T;
 
+/* 
+ * why Operations_run stopped:
+ * UM_HALTED: the program executed a HALT instruction
+ * UM_BUDGET: the program executed as many instructions as it was allowed
+ * UM_FAULT: the machine failed, see Operations_fault
+ * UM_INPUT: the next instruction is an IN, and the run was asked to stop
+ *           before input with Operations_stop_at_input
+ */
+typedef enum Um_status { 
+        UM_HALTED = 0, UM_BUDGET, UM_FAULT, UM_INPUT 
+} Um_status;
+
+/* the reason a run stopped and the number of instructions it executed */
+typedef struct Um_result {
+        Um_status status;
+        uint64_t steps;
+} Um_result;
+
+/* 
+ * what the machine did, counted by Operations_run when it is given a
+ * Um_stats with Operations_set_stats:
+ *      opcodes: the instructions retired with each opcode
+ *      jumps: the LOADPs within segment 0
+ *      loads: the LOADPs from another segment
+ *      words_loaded: the words in the segments loaded by those LOADPs
+ *      maps, unmaps: the MAPs and the UNMAPs
+ *      map_sizes: the MAPs by the bit length of the size asked for, so
+ *                 entry k counts sizes from 2^(k-1) up to 2^k - 1
+ *      live, peak_live: the segments mapped by MAP and not yet unmapped,
+ *                       now and at most
+ *      bytes_in, bytes_out: the bytes read by IN and written by OUT
+ */
+typedef struct Um_stats {
+        uint64_t opcodes[16];
+        uint64_t jumps;
+        uint64_t loads;
+        uint64_t words_loaded;
+        uint64_t maps;
+        uint64_t unmaps;
+        uint64_t map_sizes[33];
+        uint64_t live;
+        uint64_t peak_live;
+        uint64_t bytes_in;
+        uint64_t bytes_out;
+} Um_stats;
+
 /* FUNCTION:    Operations_new
  * Purpose:     Constructor for the operation struct that contains the memory
  *              segments
@@ -41,11 +89,106 @@ Operations_T Operations_new();
  * Arg:         op: a pointer to an operations struct
  * Returns:     N/A
  * Exported to: Our main program module: used in running the command loop
- * Effect:      Frees the memory associated with an operations struct
+ * Effect:      Flushes the I/O device, then frees the memory associated with
+ *              an operations struct
  * Error:       If a NULL pointer or a pointer to a NULL pointer is passed in
  */
 void Operations_free(Operations_T *op);
 
+/* FUNCTION:    Operations_set_io
+ * Purpose:     Replace the I/O device used by the input and output
+ *              instructions
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              io: the new device, which the operations struct now owns
+ * Returns:     N/A
+ * Exported to: Our main program module: used to pick the I/O device
+ * Effect:      Flushes and frees the previous device, if there is one. A
+ *              new operations struct has none, and makes a buffered device
+ *              on stdin and stdout the first time it runs or does I/O
+ *              without one
+ * Error:       Checked runtime error if op or io is NULL
+ */
+void Operations_set_io(Operations_T op, Io_T io);
+
+/* FUNCTION:    Operations_set_stats
+ * Purpose:     Count what Operations_run does
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *                  structures
+ *              stats: where to add the counts, or NULL to stop counting.
+ *                     The caller keeps ownership
+ * Returns:     N/A
+ * Exported to: Our main program module: used by --stats
+ * Effect:      Operations_run counts through a second handler table while
+ *              stats is set, running fused sequences one instruction at a
+ *              time so every instruction is counted. Without stats it runs
+ *              as before, at no cost. Other engines do not count
+ * Error:       Checked runtime error if op is NULL
+ */
+void Operations_set_stats(Operations_T op, Um_stats *stats);
+
+/* FUNCTION:    Operations_stop_at_input
+ * Purpose:     Make runs stop before the program reads input
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *                  structures
+ *              stop: whether Operations_run stops before an IN
+ * Returns:     N/A
+ * Exported to: Our main program module: used to snapshot a program once it
+ *              has warmed up
+ * Effect:      While stop is set, a run that reaches an IN returns UM_INPUT
+ *              without executing it, so nothing has been read yet
+ * Error:       Checked runtime error if op is NULL
+ */
+void Operations_stop_at_input(Operations_T op, bool stop);
+
+/* FUNCTION:    Operations_set_cache
+ * Purpose:     Keep the decoded form of each segment 0 in a code cache
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *                  structures
+ *              dir: an existing directory to keep it in, which is copied
+ * Returns:     N/A
+ * Exported to: Our main program module: used by --cache
+ * Effect:      Every segment 0 decoded from then on is looked up in the
+ *              cache by its words, and written to it in the background if
+ *              it is not there. Call it before loading the program so the
+ *              program itself is cached. Operations_free waits for the
+ *              writes. Compiled code is not cached
+ * Error:       Checked runtime error if op or dir is NULL, or if a cache was
+ *              already set
+ */
+void Operations_set_cache(Operations_T op, const char *dir);
+
+/* FUNCTION:    Operations_save
+ * Purpose:     Write the whole machine to a snapshot file
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *                  structures, stopped between two instructions
+ *              file_name: the pathname of the snapshot
+ * Returns:     false if the file cannot be written
+ * Effect:      Flushes the output, then writes the registers, the program
+ *              counter, every segment and the free segment IDs in host byte
+ *              order. Words shared by two segments are written once. Input
+ *              the device has read ahead is not saved
+ * Exported to: Our main program module: used by --snapshot
+ * Error:       Checked runtime error if op or file_name is NULL
+ */
+bool Operations_save(Operations_T op, const char *file_name);
+
+/* FUNCTION:    Operations_restore
+ * Purpose:     Load a machine from a snapshot file
+ * Arg:         op: a new operations struct with no program
+ *              file_name: the pathname of a snapshot written by
+ *                         Operations_save on a host with the same byte order
+ * Returns:     false if the file cannot be read or is not a snapshot, in
+ *              which case op can only be freed
+ * Effect:      Maps the file and rebuilds the segments, registers and
+ *              program counter from it, so the next run continues where the
+ *              saved machine stopped
+ * Exported to: Our main program module: used by --restore
+ * Error:       Checked runtime error if op or file_name is NULL, or if op
+ *              already has a program
+ */
+bool Operations_restore(Operations_T op, const char *file_name);
+
 /* FUNCTION:    read_in_program
  * Purpose:     Reads the file, packs the content into different words, and
  *              put them into segment 0
@@ -60,6 +203,68 @@ void Operations_free(Operations_T *op);
  */
 void read_in_program(FILE *input, uint32_t num_words, Operations_T op);
 
+/* FUNCTION:    read_in_file
+ * Purpose:     Reads a program image from a file into segment 0
+ * Arg:         file_name: the pathname of the program image
+ *              op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     -1 if the file cannot be opened or read, -2 if it starts
+ *              like a .umn image but is not a valid one, otherwise the
+ *              number of trailing bytes (0 to 3) that did not make up a
+ *              whole word
+ * Exported to: Our main program module: used to load the program
+ * Effect:      Maps the file into memory and converts its big-endian words
+ *              straight into segment 0. A .umn image, whose words are
+ *              already in host order, is instead mapped copy-on-write and
+ *              its words become segment 0 where they are, so processes
+ *              running the same image share its pages until they write
+ *              them. Files that cannot be mapped, such as pipes, are read
+ *              with large read() calls instead. Trailing bytes are not
+ *              loaded
+ * Error:       Runtime error if file_name or the operation struct is NULL
+ */
+int read_in_file(const char *file_name, Operations_T op);
+
+/* FUNCTION:    stream_in_file
+ * Purpose:     Reads a program image into segment 0 like read_in_file, but
+ *              lets it run before all of it has arrived
+ * Arg:         file_name: the pathname of the program image, which may be a
+ *                         pipe or a terminal of unknown length
+ *              op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     as read_in_file. A streamed image that has not ended yet
+ *              gives 0, and Operations_trailing counts its trailing bytes
+ *              once it ends
+ * Exported to: Our main program module: used to load the program
+ * Effect:      A file that can be mapped is loaded exactly as by
+ *              read_in_file. Any other file is read by a thread of its own:
+ *              segment 0 starts out as the words that arrived first, and
+ *              Operations_run and Operations_run_jit add the words that
+ *              have arrived since whenever the program needs a word past
+ *              the end of segment 0, by running there, jumping there or
+ *              loading or storing there, and wait for more if none have.
+ *              Only once the image has ended does running or jumping past
+ *              its end fail. A .umn image is read to its end before it is
+ *              checked
+ * Error:       Runtime error if file_name or the operation struct is NULL
+ */
+int stream_in_file(const char *file_name, Operations_T op);
+
+/* FUNCTION:    read_in_words
+ * Purpose:     Puts a program that is already in host words into segment 0
+ * Arg:         words: the words of the program
+ *              num_words: the number of words
+ *              op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     N/A
+ * Exported to: Programs translated by um2c: used to load their embedded
+ *              image
+ * Effect:      Copies the words into a new segment 0 and decodes them
+ * Error:       Runtime error if the operation struct is NULL
+ */
+void read_in_words(const uint32_t *words, uint32_t num_words, 
+                   Operations_T op);
+
 /* FUNCTION:    next_instruction
  * Purpose:     get the next instruction in the program provided by the user
  * Arg:         op: an instance of the operations struct storing our UM’s data
@@ -83,4 +288,188 @@ uint32_t next_instruction(Operations_T op);
  */
 bool do_instruction(uint32_t instruction, Operations_T op);
 
+/* FUNCTION:    run_program
+ * Purpose:     run the loaded program until it reaches a HALT instruction,
+ *              using the direct-threaded engine of Operations_run
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     N/A
+ * Exported to: Our main program module
+ * Effect:      Executes every instruction of the program
+ * Error:       Checked runtime error if op is NULL or the machine fails
+ */
+void run_program(Operations_T op);
+
+/* FUNCTION:    Operations_run
+ * Purpose:     run the loaded program until it halts, fails or has executed
+ *              a given number of instructions
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              max_steps: the most instructions to execute, 0 for no limit
+ * Returns:     a Um_result with the reason the run stopped and the number of
+ *              instructions executed
+ * Exported to: Our main program module and batch runners: the default
+ *              execution engine, run in place of the
+ *              next_instruction/do_instruction loop
+ * Effect:      Executes instructions from the saved program counter with a
+ *              direct-threaded dispatch loop. A run that used up its budget
+ *              can be continued by calling Operations_run again. A run of a
+ *              program that is still streaming in waits for the words it
+ *              needs, see stream_in_file
+ * Error:       Checked runtime error if op is NULL or has no program. Machine
+ *              failures are reported as UM_FAULT, see Operations_fault
+ */
+Um_result Operations_run(Operations_T op, uint64_t max_steps);
+
+/* FUNCTION:    Operations_run_jit
+ * Purpose:     run the loaded program like Operations_run, but with the
+ *              blocks of segment 0 compiled to native code
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              max_steps: the most instructions to execute, 0 for no limit
+ * Returns:     a Um_result, exactly as Operations_run would return it
+ * Exported to: Our main program module: the --engine=jit execution engine
+ * Effect:      Compiles blocks as they are first reached. HALT, IN, OUT and
+ *              failing instructions are run by Operations_run. On hosts
+ *              without a JIT this is the same as Operations_run
+ * Error:       Checked runtime error if op is NULL or has no program. Machine
+ *              failures are reported as UM_FAULT, see Operations_fault
+ */
+Um_result Operations_run_jit(Operations_T op, uint64_t max_steps);
+
+/* FUNCTION:    Operations_fault
+ * Purpose:     describe why the last run failed
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     a short description of the failure, or NULL if the last call
+ *              to Operations_run did not fail. It may be kept in op, so it
+ *              is only valid until op runs again or is freed
+ * Exported to: Our main program module: used to report machine failures
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+const char *Operations_fault(Operations_T op);
+
+/* FUNCTION:    Operations_trailing
+ * Purpose:     get the trailing bytes of a streamed program
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     the number of bytes (0 to 3) after the last whole word of a
+ *              streamed image that ended after stream_in_file returned, or
+ *              0 if it has not ended, even if segment 0 does not hold all
+ *              of its words yet
+ * Exported to: Our main program module: used to report them like those of
+ *              a file that was read whole
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+int Operations_trailing(Operations_T op);
+
+/* FUNCTION:    Operations_pc
+ * Purpose:     get the saved program counter
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     the index in segment 0 of the next instruction to execute, or
+ *              of the instruction that failed
+ * Exported to: Our main program module: used to report machine failures
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+uint32_t Operations_pc(Operations_T op);
+
+/* FUNCTION:    Operations_taken
+ * Purpose:     get how often a LOADP jumped within segment 0
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              pc: the index of the LOADP in segment 0
+ * Returns:     the number of jumps made from pc by the threaded and JIT
+ *              engines since segment 0 was last replaced, or 0 if pc is
+ *              past the end of segment 0
+ * Exported to: Our main program module and other engines: used to find the
+ *              hot branches of a program
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+uint64_t Operations_taken(Operations_T op, uint32_t pc);
+
+/* FUNCTION:    Operations_generation
+ * Purpose:     tell apart the programs that have been segment 0
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     1 for the program as loaded, and one more for each LOADP from
+ *              another segment since, or 0 if no program is loaded
+ * Exported to: Profiler module: used to tell which
+ *              program a program counter belongs to
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+uint32_t Operations_generation(Operations_T op);
+
+/* FUNCTION:    Operations_set_pc
+ * Purpose:     set the program counter the next run starts at
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              pc: the index in segment 0 of the next instruction
+ * Returns:     N/A
+ * Exported to: Programs translated by um2c: used to hand execution back to
+ *              the interpreter
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+void Operations_set_pc(Operations_T op, uint32_t pc);
+
+/* FUNCTION:    Operations_registers
+ * Purpose:     get the saved registers
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     pointer to the 8 registers, which a run loads when it starts
+ *              and saves when it stops
+ * Exported to: Programs translated by um2c: used to hand registers to and
+ *              from the interpreter. JIT module: compiled code loads and
+ *              saves them
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+uint32_t *Operations_registers(Operations_T op);
+
+/* FUNCTION:    Operations_memory
+ * Purpose:     get the machine's memory
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     the Memory_T owned by op
+ * Exported to: Programs translated by um2c and the JIT module: their
+ *              loads, stores, maps and unmaps use the memory module directly
+ * Effect:      N/A
+ * Error:       Checked runtime error if op is NULL
+ */
+Memory_T Operations_memory(Operations_T op);
+
+/* FUNCTION:    Operations_io
+ * Purpose:     get the machine's I/O device
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ * Returns:     the Io_T owned by op
+ * Exported to: Programs translated by um2c: used by their input and output
+ *              instructions
+ * Effect:      Makes the default device if op has none yet
+ * Error:       Checked runtime error if op is NULL
+ */
+Io_T Operations_io(Operations_T op);
+
+/* FUNCTION:    Operations_store
+ * Purpose:     store a word the way the segmented store instruction does
+ * Arg:         op: an instance of the operations struct storing our UM’s data
+ *              structures
+ *              seg_id, index: where to store
+ *              value: the word to store
+ * Returns:     N/A
+ * Exported to: Programs translated by um2c and the JIT module: used for
+ *              stores to segment 0
+ * Effect:      Keeps the decoded copy of segment 0, and any compiled code,
+ *              in step with the store
+ * Error:       Checked runtime error if op is NULL
+ */
+void Operations_store(Operations_T op, uint32_t seg_id, uint32_t index,
+                      uint32_t value);
+
 #endif
\ No newline at end of file
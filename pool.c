@@ -0,0 +1,483 @@
+/*****************************************************************************
+ *
+ *                                  pool.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our segment pool module. Every
+ *     block starts with one hidden word holding its size class, followed by
+ *     the words handed out. Class k holds blocks of 2^k words, hidden word
+ *     included. A released block is pushed onto the free list of its class,
+ *     linked through its own first words, and is zeroed again only when it
+ *     is reused. Blocks larger than the biggest class come straight from
+ *     calloc and go straight back to free. A block adopted from a mapped
+ *     file has the same two hidden words as a guarded block, below, with
+ *     mapped_flag in the class word, and goes back with munmap. This module
+ *     is exported to our memory module.
+ *
+ *     In a guarded build (make GUARDED=1), blocks of guard_class and up get
+ *     a mapping of their own instead: the block ends exactly where the
+ *     mapping's writable pages end, and is followed by guard_span bytes
+ *     reserved with no access, so any 32-bit word index past the end of
+ *     the block traps. Such a block has a second hidden word, in front of
+ *     its class, holding how many words were asked for, and the class word
+ *     has guarded_flag set. Guarded blocks of a class are kept on a free
+ *     list of their own, linked through the start of their mappings.
+ *
+ *
+ ****************************************************************************/
+
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* defines the byte size of a word */
+#define word_size 4
+
+/* the smallest class holds 4 words, enough for the free list link */
+#define min_class 2
+
+/* the largest class holds 2^20 words (4 MB); larger blocks are not pooled */
+#define max_class 20
+
+/* class recorded in the hidden word of blocks that are not pooled */
+#define unpooled (max_class + 1)
+
+/* set in the class word of a block adopted with Pool_adopt */
+#define mapped_flag 0x200
+
+#ifdef UM_GUARDED
+/* the smallest class that is guarded, blocks of 2^14 words (64 KB) */
+#define guard_class 14
+
+/* the bytes reserved past a guarded block: a 32-bit word index reaches
+   at most 2^34 - 4 bytes past the start of the block */
+#define guard_span ((size_t)1 << 34)
+
+/* set in the class word of a guarded block */
+#define guarded_flag 0x100
+#endif
+
+/*
+ * struct definition for our Pool struct which holds:
+ *      free_lists: for each size class, the most recently released block,
+ *      or NULL if the class has no free blocks
+ *      guarded_lists: the same for guarded blocks, each the start of its
+ *      mapping, in a guarded build
+ *      page_size: the host's page size
+ */
+struct Pool_T {
+        uint32_t *free_lists[max_class + 1];
+#ifdef UM_GUARDED
+        uint32_t *guarded_lists[max_class + 1];
+#endif
+        size_t page_size;
+};
+
+/* private helper functions, details can be viewed below */
+static unsigned  size_class(uint32_t num_words);
+static uint32_t *next_free (uint32_t *block);
+#ifdef UM_GUARDED
+static uint32_t *guarded_alloc  (uint32_t num_words, unsigned k, Pool_T pool);
+static void      guarded_release(uint32_t *words, Pool_T pool);
+static size_t    guarded_size   (uint32_t num_words, unsigned k, 
+                                 Pool_T pool);
+#endif
+
+
+/* FUNCTION:    Pool_new
+ * Purpose:     Initialize an empty pool with no free blocks
+ * Arg:         N/A
+ * Returns:     An instance of the struct Pool_T
+ * Effect:      N/A
+ * Exported to: Memory module. Used when initializing the memory module
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Pool_T Pool_new()
+{
+        Pool_T pool = malloc(sizeof(*pool));
+        assert(pool != NULL);
+
+        for (unsigned k = 0; k <= max_class; k++) {
+                pool->free_lists[k] = NULL;
+        }
+#ifdef UM_GUARDED
+        for (unsigned k = 0; k <= max_class; k++) {
+                pool->guarded_lists[k] = NULL;
+        }
+#endif
+        pool->page_size = sysconf(_SC_PAGESIZE);
+
+        return pool;
+}
+
+
+/* FUNCTION:    Pool_free
+ * Purpose:     free every block held by the pool and the pool itself
+ * Arg:         pool: A pointer to a Pool_T
+ * Returns:     N/A
+ * Effect:      Blocks still handed out are not freed and must not be
+ *              released afterwards
+ * Exported to: Memory module. Used when freeing the memory module
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Pool_free(Pool_T *pool)
+{
+        assert(pool != NULL && *pool != NULL);
+
+        for (unsigned k = min_class; k <= max_class; k++) {
+                uint32_t *block = (*pool)->free_lists[k];
+                while (block != NULL) {
+                        uint32_t *next = next_free(block);
+                        free(block);
+                        block = next;
+                }
+        }
+#ifdef UM_GUARDED
+        for (unsigned k = guard_class; k <= max_class; k++) {
+                uint32_t *area = (*pool)->guarded_lists[k];
+                while (area != NULL) {
+                        uint32_t *next;
+                        memcpy(&next, area, sizeof(next));
+                        munmap(area, guarded_size(0, k, *pool) + guard_span);
+                        area = next;
+                }
+        }
+#endif
+
+        free(*pool);
+        *pool = NULL;
+}
+
+
+/* FUNCTION:    Pool_alloc
+ * Purpose:     get a block of words that are all 0
+ * Arg:         num_words: the number of words needed
+ *              pool: the pool to allocate from
+ * Returns:     pointer to the first of num_words zeroed words
+ * Effect:      Reuses a free block of the right size class when there is
+ *              one, and only zeroes the words that were asked for. In a
+ *              guarded build a large block is followed by guard pages, or
+ *              is an ordinary block if they cannot be mapped
+ * Exported to: Memory module: used when mapping a segment
+ * Error:       Checked Runtime if pool is NULL or the allocation fails
+ */
+uint32_t *Pool_alloc(uint32_t num_words, Pool_T pool)
+{
+        assert(pool != NULL);
+
+        unsigned k = size_class(num_words);
+        uint32_t *block;
+
+#ifdef UM_GUARDED
+        /* the class is found again with room for the second hidden word */
+        if (k >= guard_class && num_words < UINT32_MAX) {
+                uint32_t *words = guarded_alloc(num_words, 
+                                                size_class(num_words + 1),
+                                                pool);
+                if (words != NULL) {
+                        return words;
+                }
+        }
+#endif
+
+        if (k == unpooled) {
+                block = calloc((size_t)num_words + 1, word_size);
+                assert(block != NULL);
+        } else if (pool->free_lists[k] != NULL) {
+                /* pop the class's free list and zero what will be used */
+                block = pool->free_lists[k];
+                pool->free_lists[k] = next_free(block);
+                memset(block + 1, 0, (size_t)num_words * word_size);
+        } else {
+                block = calloc((size_t)1 << k, word_size);
+                assert(block != NULL);
+        }
+
+        block[0] = k;
+        return block + 1;
+}
+
+
+/* FUNCTION:    Pool_release
+ * Purpose:     give a block back to the pool
+ * Arg:         words: pointer returned by Pool_alloc
+ *              pool: the pool the block came from
+ * Returns:     N/A
+ * Effect:      Puts the block on the free list of its size class. Blocks
+ *              that are too large for any class are freed right away, and
+ *              adopted blocks are unmapped
+ * Exported to: Memory module: used when unmapping a segment
+ * Error:       Checked Runtime if pool is NULL
+ */
+void Pool_release(uint32_t *words, Pool_T pool)
+{
+        assert(pool != NULL);
+
+        uint32_t *block = words - 1;
+        unsigned k = block[0];
+
+        if (k & mapped_flag) {
+                /* the mapping starts on the page of the hidden words */
+                uintptr_t start = (uintptr_t)(words - 2) & 
+                                  ~(uintptr_t)(pool->page_size - 1);
+                munmap((void *)start, 
+                       (uintptr_t)(words + words[-2]) - start);
+                return;
+        }
+#ifdef UM_GUARDED
+        if (k & guarded_flag) {
+                guarded_release(words, pool);
+                return;
+        }
+#endif
+        if (k == unpooled) {
+                free(block);
+                return;
+        }
+
+        /* link the block in front of its class's free list */
+        memcpy(block + 1, &pool->free_lists[k], sizeof(uint32_t *));
+        pool->free_lists[k] = block;
+}
+
+
+/* FUNCTION:    Pool_grow
+ * Purpose:     make a block longer, keeping its words
+ * Arg:         words: pointer returned by Pool_alloc
+ *              old_words: the number of words asked for so far
+ *              num_words: the number of words needed now, at least
+ *                         old_words
+ *              pool: the pool the block came from
+ * Returns:     pointer to the first of num_words words, the old ones
+ *              unchanged and the new ones 0, which may be words itself
+ * Effect:      A block whose size class still has room grows where it is,
+ *              and a block too large for any class is reallocated, so
+ *              growing a block a little at a time copies it only as often
+ *              as its size doubles. Otherwise the words move to a new block
+ *              and the old one is released
+ * Exported to: Memory module: used to lengthen a segment
+ * Error:       Checked Runtime if words or pool is NULL, or the allocation
+ *              fails
+ */
+uint32_t *Pool_grow(uint32_t *words, uint32_t old_words, uint32_t num_words,
+                    Pool_T pool)
+{
+        assert(words != NULL && pool != NULL);
+        assert(num_words >= old_words);
+
+        unsigned k = words[-1];
+        size_t added = (size_t)(num_words - old_words) * word_size;
+
+        /* the class holds 2^k words, the hidden word included */
+        if (k < unpooled && num_words < ((uint32_t)1 << k)) {
+                memset(words + old_words, 0, added);
+                return words;
+        }
+        if (k == unpooled) {
+                uint32_t *block = realloc(words - 1, 
+                                          ((size_t)num_words + 1) * 
+                                          word_size);
+                assert(block != NULL);
+                memset(block + 1 + old_words, 0, added);
+                return block + 1;
+        }
+
+        uint32_t *grown = Pool_alloc(num_words, pool);
+        memcpy(grown, words, (size_t)old_words * word_size);
+        Pool_release(words, pool);
+        return grown;
+}
+
+
+/* FUNCTION:    Pool_adopt
+ * Purpose:     take over words in a private mapping as a block
+ * Arg:         words: the first of the words, which are in a writable
+ *                     MAP_PRIVATE mapping that starts on the page holding
+ *                     the two words in front of them and ends with them
+ *              num_words: the number of words
+ *              pool: the pool the block will be released to
+ * Returns:     words, now a block that Pool_release unmaps
+ * Effect:      Writes the two hidden words in front of the words, which
+ *              gives the process a private copy of that page only
+ * Exported to: Memory module: used to make a segment of a mapped program
+ * Error:       Checked Runtime if words or pool is NULL
+ */
+uint32_t *Pool_adopt(uint32_t *words, uint32_t num_words, Pool_T pool)
+{
+        assert(words != NULL && pool != NULL);
+
+        words[-1] = mapped_flag;
+        words[-2] = num_words;
+        return words;
+}
+
+
+/* FUNCTION:    Pool_guarded
+ * Purpose:     tell whether a block is followed by guard pages
+ * Arg:         words: pointer returned by Pool_alloc and not released
+ * Returns:     true if every word index past the end of the block traps,
+ *              always false unless the build is guarded
+ * Effect:      N/A
+ * Exported to: Memory module: used to tell a trap past a segment's end
+ *              from any other
+ * Error:       N/A
+ */
+bool Pool_guarded(const uint32_t *words)
+{
+#ifdef UM_GUARDED
+        return (words[-1] & guarded_flag) != 0;
+#else
+        (void)words;
+        return false;
+#endif
+}
+
+
+/* FUNCTION:    size_class
+ * Purpose:     find the class of the block that holds a number of words
+ * Arg:         num_words: the number of words handed out
+ * Returns:     the smallest k such that 2^k words hold num_words and the
+ *              hidden word, or unpooled if no class is large enough
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static unsigned size_class(uint32_t num_words)
+{
+        uint64_t total = (uint64_t)num_words + 1;
+
+        if (total > ((uint64_t)1 << max_class)) {
+                return unpooled;
+        }
+        if (total <= ((uint64_t)1 << min_class)) {
+                return min_class;
+        }
+
+        /* round up to the next power of two */
+        return 64 - __builtin_clzll(total - 1);
+}
+
+
+/* FUNCTION:    next_free
+ * Purpose:     follow the free list link stored in a released block
+ * Arg:         block: a block on a free list
+ * Returns:     the next block on the same free list, or NULL
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static uint32_t *next_free(uint32_t *block)
+{
+        uint32_t *next;
+        memcpy(&next, block + 1, sizeof(next));
+
+        return next;
+}
+
+
+#ifdef UM_GUARDED
+/* FUNCTION:    guarded_alloc
+ * Purpose:     get a zeroed block followed by guard pages
+ * Arg:         num_words: the number of words needed
+ *              k: the class of a block of num_words and two hidden words
+ *              pool: the pool to allocate from
+ * Returns:     pointer to the first of num_words zeroed words, which end
+ *              where the guard pages start, or NULL if they cannot be
+ *              mapped
+ * Effect:      Reuses a free guarded block of class k when there is one.
+ *              Blocks larger than every class get a mapping of their own
+ *              size
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static uint32_t *guarded_alloc(uint32_t num_words, unsigned k, Pool_T pool)
+{
+        size_t size = guarded_size(num_words, k, pool);
+        uint32_t *area;
+        bool reused = (k != unpooled && pool->guarded_lists[k] != NULL);
+
+        if (reused) {
+                area = pool->guarded_lists[k];
+                memcpy(&pool->guarded_lists[k], area, sizeof(area));
+        } else {
+                /* the guard pages are reserved but never backed */
+                area = mmap(NULL, size + guard_span, PROT_NONE, 
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, 
+                            -1, 0);
+                if (area == MAP_FAILED) {
+                        return NULL;
+                }
+                if (mprotect(area, size, PROT_READ | PROT_WRITE) != 0) {
+                        munmap(area, size + guard_span);
+                        return NULL;
+                }
+        }
+
+        uint32_t *words = area + size / sizeof(*area) - num_words;
+        if (reused) {
+                memset(words, 0, (size_t)num_words * word_size);
+        }
+        words[-1] = k | guarded_flag;
+        words[-2] = num_words;
+
+        return words;
+}
+
+
+/* FUNCTION:    guarded_release
+ * Purpose:     give a guarded block back to the pool
+ * Arg:         words: pointer returned by guarded_alloc
+ *              pool: the pool the block came from
+ * Returns:     N/A
+ * Effect:      Puts the block on the guarded free list of its class, or
+ *              unmaps it if it is too large for any class
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void guarded_release(uint32_t *words, Pool_T pool)
+{
+        unsigned k = words[-1] & ~guarded_flag;
+        uint32_t num_words = words[-2];
+        size_t size = guarded_size(num_words, k, pool);
+        uint32_t *area = words + num_words - size / sizeof(*area);
+
+        if (k == unpooled) {
+                munmap(area, size + guard_span);
+                return;
+        }
+
+        memcpy(area, &pool->guarded_lists[k], sizeof(area));
+        pool->guarded_lists[k] = area;
+}
+
+
+/* FUNCTION:    guarded_size
+ * Purpose:     find the writable bytes of a guarded block's mapping
+ * Arg:         num_words: the number of words handed out
+ *              k: the block's class
+ *              pool: the pool the block comes from
+ * Returns:     2^k words for a class, which is a whole number of pages,
+ *              or num_words and the hidden words rounded up to whole pages
+ *              if the block is not pooled
+ * Effect:      N/A
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static size_t guarded_size(uint32_t num_words, unsigned k, Pool_T pool)
+{
+        if (k != unpooled) {
+                return ((size_t)1 << k) * word_size;
+        }
+
+        size_t size = ((size_t)num_words + 2) * word_size;
+        return (size + pool->page_size - 1) / pool->page_size * 
+               pool->page_size;
+}
+#endif
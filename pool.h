@@ -0,0 +1,131 @@
+/*****************************************************************************
+ *
+ *                                  pool.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our segment pool module. This module
+ *     hands out zeroed blocks of words for segments and takes them back when
+ *     the segments are unmapped. Blocks are grouped into power-of-two size
+ *     classes, and a released block is kept on the free list of its class so
+ *     the next segment of a similar size reuses it instead of calling malloc.
+ *     This module is exported to our memory module.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_POOL_INCLUDED
+#define UM_POOL_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct Pool_T *Pool_T;
+
+/* FUNCTION:    Pool_new
+ * Purpose:     Initialize an empty pool with no free blocks
+ * Arg:         N/A
+ * Returns:     An instance of the struct Pool_T
+ * Effect:      N/A
+ * Exported to: Memory module. Used when initializing the memory module
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+Pool_T Pool_new();
+
+
+/* FUNCTION:    Pool_free
+ * Purpose:     free every block held by the pool and the pool itself
+ * Arg:         pool: A pointer to a Pool_T
+ * Returns:     N/A
+ * Effect:      Blocks still handed out are not freed and must not be
+ *              released afterwards
+ * Exported to: Memory module. Used when freeing the memory module
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Pool_free(Pool_T *pool);
+
+
+/* FUNCTION:    Pool_alloc
+ * Purpose:     get a block of words that are all 0
+ * Arg:         num_words: the number of words needed
+ *              pool: the pool to allocate from
+ * Returns:     pointer to the first of num_words zeroed words
+ * Effect:      Reuses a free block of the right size class when there is
+ *              one, and only zeroes the words that were asked for. In a
+ *              guarded build a large block is followed by guard pages, or
+ *              is an ordinary block if they cannot be mapped
+ * Exported to: Memory module: used when mapping a segment
+ * Error:       Checked Runtime if pool is NULL or the allocation fails
+ */
+uint32_t *Pool_alloc(uint32_t num_words, Pool_T pool);
+
+
+/* FUNCTION:    Pool_release
+ * Purpose:     give a block back to the pool
+ * Arg:         words: pointer returned by Pool_alloc
+ *              pool: the pool the block came from
+ * Returns:     N/A
+ * Effect:      Puts the block on the free list of its size class. Blocks
+ *              that are too large for any class are freed right away, and
+ *              adopted blocks are unmapped
+ * Exported to: Memory module: used when unmapping a segment
+ * Error:       Checked Runtime if pool is NULL
+ */
+void Pool_release(uint32_t *words, Pool_T pool);
+
+
+/* FUNCTION:    Pool_grow
+ * Purpose:     make a block longer, keeping its words
+ * Arg:         words: pointer returned by Pool_alloc
+ *              old_words: the number of words asked for so far
+ *              num_words: the number of words needed now, at least
+ *                         old_words
+ *              pool: the pool the block came from
+ * Returns:     pointer to the first of num_words words, the old ones
+ *              unchanged and the new ones 0, which may be words itself
+ * Effect:      A block whose size class still has room grows where it is,
+ *              and a block too large for any class is reallocated, so
+ *              growing a block a little at a time copies it only as often
+ *              as its size doubles. Otherwise the words move to a new block
+ *              and the old one is released
+ * Exported to: Memory module: used to lengthen a segment
+ * Error:       Checked Runtime if words or pool is NULL, or the allocation
+ *              fails
+ */
+uint32_t *Pool_grow(uint32_t *words, uint32_t old_words, uint32_t num_words,
+                    Pool_T pool);
+
+
+/* FUNCTION:    Pool_adopt
+ * Purpose:     take over words in a private mapping as a block
+ * Arg:         words: the first of the words, which are in a writable
+ *                     MAP_PRIVATE mapping that starts on the page holding
+ *                     the two words in front of them and ends with them
+ *              num_words: the number of words
+ *              pool: the pool the block will be released to
+ * Returns:     words, now a block that Pool_release unmaps
+ * Effect:      Writes the two hidden words in front of the words, which
+ *              gives the process a private copy of that page only
+ * Exported to: Memory module: used to make a segment of a mapped program
+ * Error:       Checked Runtime if words or pool is NULL
+ */
+uint32_t *Pool_adopt(uint32_t *words, uint32_t num_words, Pool_T pool);
+
+
+/* FUNCTION:    Pool_guarded
+ * Purpose:     tell whether a block is followed by guard pages
+ * Arg:         words: pointer returned by Pool_alloc and not released
+ * Returns:     true if every word index past the end of the block traps.
+ *              Only a guarded build (make GUARDED=1) guards blocks, and
+ *              only those of 2^14 words and up
+ * Effect:      N/A
+ * Exported to: Memory module: used to tell a trap past a segment's end
+ *              from any other
+ * Error:       N/A
+ */
+bool Pool_guarded(const uint32_t *words);
+
+#endif
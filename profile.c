@@ -0,0 +1,195 @@
+/*****************************************************************************
+ *
+ *                                  profile.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our profiler module. It keeps a
+ *     count for each word of segment 0, used only at the words that start a
+ *     block, so adding a sample is a walk to the ends of its block and one
+ *     increment. The blocks are found from the words of segment 0 when the
+ *     sample is taken, so a program that writes its own code is profiled as
+ *     it is at that moment. This module is exported to our UM main program.
+ *
+ *
+ ****************************************************************************/
+
+#include "profile.h"
+#include "memory.h"
+#include "instruction_packing.h"
+#include <stdlib.h>
+#include <assert.h>
+
+/* the opcodes that end a block */
+#define HALT 7
+#define LOADP 12
+
+/*
+ * struct definition for our Profile struct which holds:
+ *      out: where the folded stacks are written
+ *      name: the root of every stack
+ *      generation: the generation of segment 0 the counts are for, 0 before
+ *                  the first sample
+ *      length: the number of words in that segment 0
+ *      counts: the samples in the block starting at each word
+ *      ends: the last word of the block starting at each word
+ */
+struct Profile_T {
+        FILE *out;
+        const char *name;
+        uint32_t generation;
+        uint32_t length;
+        uint64_t *counts;
+        uint32_t *ends;
+};
+
+/* private helper functions, details can be viewed below */
+static void write_counts(Profile_T profile);
+static bool ends_block  (uint32_t index, Memory_T memory);
+
+
+/* FUNCTION:    Profile_new
+ * Purpose:     start a profile with no samples
+ * Arg:         out: where the folded stacks are written, which the caller
+ *                   keeps ownership of
+ *              name: the name of the program, the root of every stack
+ * Returns:     a new Profile_T
+ * Effect:      N/A
+ * Exported to: Our main program module: used by --profile
+ * Error:       Checked runtime error if out or name is NULL, or for
+ *              unsuccessful memory allocation
+ */
+Profile_T Profile_new(FILE *out, const char *name)
+{
+        assert(out != NULL && name != NULL);
+
+        Profile_T profile = malloc(sizeof(*profile));
+        assert(profile != NULL);
+
+        profile->out = out;
+        profile->name = name;
+        profile->generation = 0;
+        profile->length = 0;
+        profile->counts = NULL;
+        profile->ends = NULL;
+
+        return profile;
+}
+
+
+/* FUNCTION:    Profile_sample
+ * Purpose:     add a sample of where a machine is running
+ * Arg:         profile: the profile
+ *              op: the machine, stopped between two instructions
+ * Returns:     N/A
+ * Effect:      Adds one to the block holding the machine's program counter.
+ *              When segment 0 has been replaced since the last sample, the
+ *              counts of the old program are written out first, since its
+ *              blocks can no longer be found
+ * Exported to: Our main program module: used after every sampling interval
+ * Error:       Checked runtime error if profile or op is NULL, or for
+ *              unsuccessful memory allocation
+ */
+void Profile_sample(Profile_T profile, Operations_T op)
+{
+        assert(profile != NULL && op != NULL);
+
+        Memory_T memory = Operations_memory(op);
+
+        if (Operations_generation(op) != profile->generation) {
+                write_counts(profile);
+                free(profile->counts);
+                free(profile->ends);
+
+                profile->generation = Operations_generation(op);
+                profile->length = segment_length(0, memory);
+                profile->counts = calloc((size_t)profile->length + 1,
+                                         sizeof(*profile->counts));
+                profile->ends = calloc((size_t)profile->length + 1,
+                                       sizeof(*profile->ends));
+                assert(profile->counts != NULL && profile->ends != NULL);
+        }
+
+        /* a program counter past the end has no block */
+        uint32_t pc = Operations_pc(op);
+        if (pc >= profile->length) {
+                return;
+        }
+
+        uint32_t start = pc;
+        while (start > 0 && !ends_block(start - 1, memory)) {
+                start--;
+        }
+        uint32_t end = pc;
+        while (end < profile->length - 1 && !ends_block(end, memory)) {
+                end++;
+        }
+
+        profile->counts[start]++;
+        profile->ends[start] = end;
+}
+
+
+/* FUNCTION:    Profile_free
+ * Purpose:     finish a profile
+ * Arg:         profile: a pointer to a Profile_T
+ * Returns:     N/A
+ * Effect:      Writes the counts not yet written and flushes out
+ * Exported to: Our main program module: used when the program stops
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Profile_free(Profile_T *profile)
+{
+        assert(profile != NULL && *profile != NULL);
+
+        write_counts(*profile);
+        fflush((*profile)->out);
+
+        free((*profile)->counts);
+        free((*profile)->ends);
+        free(*profile);
+        *profile = NULL;
+}
+
+
+/* FUNCTION:    write_counts
+ * Purpose:     write a folded stack for each block that was sampled
+ * Arg:         profile: the profile
+ * Returns:     N/A
+ * Effect:      Writes one line per block, in the order of segment 0:
+ *              name;g<generation>;<first word>-<last word> <samples>
+ * Exported to: N/A
+ * Error:       N/A
+ */
+static void write_counts(Profile_T profile)
+{
+        for (uint32_t i = 0; i < profile->length; i++) {
+                if (profile->counts[i] != 0) {
+                        fprintf(profile->out, "%s;g%u;%u-%u %llu\n",
+                                profile->name, profile->generation, i,
+                                profile->ends[i],
+                                (unsigned long long)profile->counts[i]);
+                }
+        }
+}
+
+
+/* FUNCTION:    ends_block
+ * Purpose:     tell whether a word of segment 0 ends a block
+ * Arg:         index: the index of the word in segment 0
+ *              memory: the machine's memory
+ * Returns:     true if the word is a LOADP or HALT
+ * Exported to: N/A
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static bool ends_block(uint32_t index, Memory_T memory)
+{
+        unsigned opcode = decode_instruction(load_word(0, index, memory))
+                          .opcode;
+
+        return opcode == LOADP || opcode == HALT;
+}
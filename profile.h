@@ -0,0 +1,73 @@
+/*****************************************************************************
+ *
+ *                                  profile.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our profiler module. This module
+ *     samples where a UM program is running, as an index into segment 0
+ *     together with the generation of segment 0, and adds each sample to
+ *     the basic block it falls in. A basic block here runs from the word
+ *     after a LOADP or HALT up to and including the next LOADP or HALT.
+ *     The counts are written as folded stacks, one line per block:
+ *
+ *        program.um;g1;1234-1240 57
+ *
+ *     which flamegraph.pl and speedscope read directly. This module is
+ *     exported to our UM main program.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_PROFILE_INCLUDED
+#define UM_PROFILE_INCLUDED
+
+#include <stdio.h>
+#include "operations.h"
+
+typedef struct Profile_T *Profile_T;
+
+/* FUNCTION:    Profile_new
+ * Purpose:     start a profile with no samples
+ * Arg:         out: where the folded stacks are written, which the caller
+ *                   keeps ownership of
+ *              name: the name of the program, the root of every stack
+ * Returns:     a new Profile_T
+ * Effect:      N/A
+ * Exported to: Our main program module: used by --profile
+ * Error:       Checked runtime error if out or name is NULL, or for
+ *              unsuccessful memory allocation
+ */
+Profile_T Profile_new(FILE *out, const char *name);
+
+
+/* FUNCTION:    Profile_sample
+ * Purpose:     add a sample of where a machine is running
+ * Arg:         profile: the profile
+ *              op: the machine, stopped between two instructions
+ * Returns:     N/A
+ * Effect:      Adds one to the block holding the machine's program counter.
+ *              When segment 0 has been replaced since the last sample, the
+ *              counts of the old program are written out first, since its
+ *              blocks can no longer be found
+ * Exported to: Our main program module: used after every sampling interval
+ * Error:       Checked runtime error if profile or op is NULL, or for
+ *              unsuccessful memory allocation
+ */
+void Profile_sample(Profile_T profile, Operations_T op);
+
+
+/* FUNCTION:    Profile_free
+ * Purpose:     finish a profile
+ * Arg:         profile: a pointer to a Profile_T
+ * Returns:     N/A
+ * Effect:      Writes the counts not yet written and flushes out
+ * Exported to: Our main program module: used when the program stops
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Profile_free(Profile_T *profile);
+
+#endif
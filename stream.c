@@ -0,0 +1,271 @@
+/*****************************************************************************
+ *
+ *                                  stream.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our program stream module. The
+ *     reading thread reads read_chunk bytes at a time and appends them to a
+ *     buffer under a lock, waking a taker that waits for them. A take hands
+ *     the whole buffer over and starts a new one with the bytes of a word
+ *     that is not complete yet, so the bytes are copied once on their way
+ *     to the taker. A stream that is freed before its end cancels the
+ *     thread, which can only be stopped while it waits in read().
+ *
+ *
+ ****************************************************************************/
+
+#include "stream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* defines the byte size of a word */
+#define word_size 4
+
+/* how many bytes the thread asks read() for at a time */
+#define read_chunk (1 << 16)
+
+/*
+ * struct definition for our Stream struct which holds:
+ *      fd: the file descriptor being read
+ *      reader: the thread reading it
+ *      threaded: whether that thread was started and not yet joined
+ *      lock: held while bytes, length, capacity and ended change
+ *      arrived: signalled when bytes arrive or the stream ends
+ *      chunk: where the thread reads to
+ *      bytes: the bytes that have arrived and not been taken
+ *      length: the number of them
+ *      capacity: the size of bytes
+ *      ended: whether read() has found the end or failed
+ */
+struct Stream_T {
+        int fd;
+        pthread_t reader;
+        bool threaded;
+        pthread_mutex_t lock;
+        pthread_cond_t arrived;
+        unsigned char *chunk;
+        unsigned char *bytes;
+        size_t length;
+        size_t capacity;
+        bool ended;
+};
+
+/* private helper functions, details can be viewed below */
+static void *read_stream(void *stream);
+static void  append     (Stream_T stream, const unsigned char *bytes,
+                         size_t num_bytes);
+
+
+/* FUNCTION:    Stream_new
+ * Purpose:     start reading a file descriptor to its end
+ * Arg:         fd: an open file descriptor, which the stream then owns
+ * Returns:     a new Stream_T
+ * Effect:      Starts the thread that reads fd, or reads all of fd right
+ *              away if no thread can be started
+ * Exported to: Operation module: used to load a streamed program
+ * Error:       Checked runtime error if fd is negative, or for unsuccessful
+ *              memory allocation
+ */
+Stream_T Stream_new(int fd)
+{
+        assert(fd >= 0);
+
+        Stream_T stream = malloc(sizeof(*stream));
+        assert(stream != NULL);
+
+        stream->fd = fd;
+        pthread_mutex_init(&stream->lock, NULL);
+        pthread_cond_init(&stream->arrived, NULL);
+        stream->chunk = malloc(read_chunk);
+        stream->capacity = read_chunk;
+        stream->bytes = malloc(stream->capacity);
+        assert(stream->chunk != NULL && stream->bytes != NULL);
+        stream->length = 0;
+        stream->ended = false;
+
+        stream->threaded = pthread_create(&stream->reader, NULL, read_stream,
+                                          stream) == 0;
+        if (!stream->threaded) {
+                read_stream(stream);
+        }
+
+        return stream;
+}
+
+
+/* FUNCTION:    Stream_free
+ * Purpose:     stop reading and free a stream
+ * Arg:         stream: a pointer to a Stream_T
+ * Returns:     N/A
+ * Effect:      Stops the reading thread if it is still waiting for bytes,
+ *              closes the file descriptor and drops the bytes not taken
+ * Exported to: Operation module: used when the rest of a program is no
+ *              longer wanted
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Stream_free(Stream_T *stream)
+{
+        assert(stream != NULL && *stream != NULL);
+
+        Stream_T s = *stream;
+        if (s->threaded) {
+                pthread_mutex_lock(&s->lock);
+                bool ended = s->ended;
+                pthread_mutex_unlock(&s->lock);
+                if (!ended) {
+                        pthread_cancel(s->reader);
+                }
+                pthread_join(s->reader, NULL);
+        }
+
+        close(s->fd);
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->arrived);
+        free(s->chunk);
+        free(s->bytes);
+        free(s);
+
+        *stream = NULL;
+}
+
+
+/* FUNCTION:    Stream_take
+ * Purpose:     take the words that have arrived since the last take
+ * Arg:         stream: the stream
+ *              wait: whether to block until at least one word has arrived
+ *                    or the stream has ended
+ *              num_bytes: set to the number of bytes returned, a multiple
+ *                         of 4
+ *              ended: set to true once the last word has been taken
+ * Returns:     a malloc'd buffer holding the bytes, which the caller frees,
+ *              or NULL if there are none
+ * Effect:      Bytes at the end of the stream that do not make up a whole
+ *              word are dropped, as they are when a program file is read
+ * Exported to: Operation module: used to grow segment 0
+ * Error:       Checked runtime error if an argument is NULL
+ */
+unsigned char *Stream_take(Stream_T stream, bool wait, size_t *num_bytes,
+                           bool *ended)
+{
+        assert(stream != NULL && num_bytes != NULL && ended != NULL);
+
+        pthread_mutex_lock(&stream->lock);
+        while (wait && !stream->ended && stream->length < word_size) {
+                pthread_cond_wait(&stream->arrived, &stream->lock);
+        }
+
+        size_t whole = stream->length - stream->length % word_size;
+        unsigned char *bytes = NULL;
+        if (whole > 0) {
+                /* the buffer goes to the taker, the partial word stays */
+                bytes = stream->bytes;
+                stream->capacity = read_chunk;
+                stream->bytes = malloc(stream->capacity);
+                assert(stream->bytes != NULL);
+                stream->length -= whole;
+                memcpy(stream->bytes, bytes + whole, stream->length);
+        }
+
+        *num_bytes = whole;
+        *ended = stream->ended;
+        pthread_mutex_unlock(&stream->lock);
+
+        return bytes;
+}
+
+
+/* FUNCTION:    Stream_trailing
+ * Purpose:     count the bytes a stream dropped at its end
+ * Arg:         stream: the stream
+ * Returns:     the number of bytes (0 to 3) after the last whole word, or
+ *              0 if the stream has not ended
+ * Effect:      N/A
+ * Exported to: Operation module: used to report them once the last word
+ *              has been taken
+ * Error:       Checked runtime error if stream is NULL
+ */
+int Stream_trailing(Stream_T stream)
+{
+        assert(stream != NULL);
+
+        pthread_mutex_lock(&stream->lock);
+        int trailing = stream->ended ? (int)(stream->length % word_size) : 0;
+        pthread_mutex_unlock(&stream->lock);
+
+        return trailing;
+}
+
+
+/* FUNCTION:    read_stream
+ * Purpose:     read the stream's file descriptor to its end, the body of
+ *              the reading thread
+ * Arg:         stream: the Stream_T
+ * Returns:     NULL
+ * Effect:      Appends everything read and marks the stream ended when
+ *              read() finds the end or fails. Cancellation is only allowed
+ *              while waiting in read(), so the lock is never left held
+ * Error:       N/A
+ */
+static void *read_stream(void *stream)
+{
+        Stream_T s = stream;
+        int state;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+        for (;;) {
+                pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+                ssize_t got = read(s->fd, s->chunk, read_chunk);
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+                if (got < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (got <= 0) {
+                        break;
+                }
+                append(s, s->chunk, got);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        s->ended = true;
+        pthread_cond_signal(&s->arrived);
+        pthread_mutex_unlock(&s->lock);
+        return NULL;
+}
+
+
+/* FUNCTION:    append
+ * Purpose:     add bytes that have arrived to a stream
+ * Arg:         stream: the stream
+ *              bytes: the bytes
+ *              num_bytes: how many there are
+ * Returns:     N/A
+ * Effect:      Grows the buffer by doubling, and wakes a waiting taker
+ * Error:       Checked runtime error for unsuccessful memory allocation
+ */
+static void append(Stream_T stream, const unsigned char *bytes,
+                   size_t num_bytes)
+{
+        pthread_mutex_lock(&stream->lock);
+
+        if (stream->length + num_bytes > stream->capacity) {
+                while (stream->length + num_bytes > stream->capacity) {
+                        stream->capacity *= 2;
+                }
+                stream->bytes = realloc(stream->bytes, stream->capacity);
+                assert(stream->bytes != NULL);
+        }
+        memcpy(stream->bytes + stream->length, bytes, num_bytes);
+        stream->length += num_bytes;
+
+        pthread_cond_signal(&stream->arrived);
+        pthread_mutex_unlock(&stream->lock);
+}
@@ -0,0 +1,85 @@
+/*****************************************************************************
+ *
+ *                                  stream.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our program stream module. A stream
+ *     reads a program image from a file descriptor of unknown length, such
+ *     as a pipe, in a thread of its own, and hands the bytes that have
+ *     arrived to whoever asks, a whole number of words at a time. The
+ *     operations module uses it to start running a program before all of
+ *     it has arrived. This module is exported to our operations module.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_STREAM_INCLUDED
+#define UM_STREAM_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct Stream_T *Stream_T;
+
+/* FUNCTION:    Stream_new
+ * Purpose:     start reading a file descriptor to its end
+ * Arg:         fd: an open file descriptor, which the stream then owns
+ * Returns:     a new Stream_T
+ * Effect:      Starts the thread that reads fd, or reads all of fd right
+ *              away if no thread can be started
+ * Exported to: Operation module: used to load a streamed program
+ * Error:       Checked runtime error if fd is negative, or for unsuccessful
+ *              memory allocation
+ */
+Stream_T Stream_new(int fd);
+
+
+/* FUNCTION:    Stream_free
+ * Purpose:     stop reading and free a stream
+ * Arg:         stream: a pointer to a Stream_T
+ * Returns:     N/A
+ * Effect:      Stops the reading thread if it is still waiting for bytes,
+ *              closes the file descriptor and drops the bytes not taken
+ * Exported to: Operation module: used when the rest of a program is no
+ *              longer wanted
+ * Error:       Checked Runtime Error if a NULL pointer or a pointer to a NULL
+ *              pointer is passed in
+ */
+void Stream_free(Stream_T *stream);
+
+
+/* FUNCTION:    Stream_take
+ * Purpose:     take the words that have arrived since the last take
+ * Arg:         stream: the stream
+ *              wait: whether to block until at least one word has arrived
+ *                    or the stream has ended
+ *              num_bytes: set to the number of bytes returned, a multiple
+ *                         of 4
+ *              ended: set to true once the last word has been taken
+ * Returns:     a malloc'd buffer holding the bytes, which the caller frees,
+ *              or NULL if there are none
+ * Effect:      Bytes at the end of the stream that do not make up a whole
+ *              word are dropped, as they are when a program file is read
+ * Exported to: Operation module: used to grow segment 0
+ * Error:       Checked runtime error if an argument is NULL
+ */
+unsigned char *Stream_take(Stream_T stream, bool wait, size_t *num_bytes,
+                           bool *ended);
+
+
+/* FUNCTION:    Stream_trailing
+ * Purpose:     count the bytes a stream dropped at its end
+ * Arg:         stream: the stream
+ * Returns:     the number of bytes (0 to 3) after the last whole word, or
+ *              0 if the stream has not ended
+ * Effect:      N/A
+ * Exported to: Operation module: used to report them once the last word
+ *              has been taken
+ * Error:       Checked runtime error if stream is NULL
+ */
+int Stream_trailing(Stream_T stream);
+
+#endif
@@ -0,0 +1,289 @@
+/*****************************************************************************
+ *
+ *                                   um2c.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary: This is the main function of our ahead-of-time translator. It
+ *     reads a .um program and writes a C file that runs the same program,
+ *     to be compiled with the host compiler and linked with aot.o and the
+ *     UM modules:
+ *
+ *        um2c midmark.um > midmark.aot.c
+ *
+ *     A basic block starts at word 0, after every LOADP and HALT, and at
+ *     every LV constant that is a valid index in segment 0, since those are
+ *     the values jumps are made from. Each block start gets a label and a
+ *     slot in the label table that translated LOADPs jump through; words
+ *     that cannot be reached from a block start are left out. A jump to a
+ *     word without a label is still correct: the interpreter runs until it
+ *     reaches one. The image is embedded in the output, together with
+ *     bitmaps of the words that were translated and of the block starts, so
+ *     a store that changes a translated word can send its block back to the
+ *     interpreter.
+ *
+ *
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "instruction_packing.h"
+
+/* the opcodes, as in the decoded program */
+enum { CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV, NAND, HALT, ACTIVATE,
+       INACTIVATE, OUT, IN, LOADP, LV };
+
+static uint32_t *read_image(const char *file_name, uint32_t *num_words);
+static void      write_program(FILE *out, const char *file_name,
+                               const uint32_t *image, uint32_t num_words);
+static void      write_bitmap (FILE *out, const char *name, const bool *bits,
+                               uint32_t num_words);
+static void      write_instruction(FILE *out, Um_decoded ins, uint32_t pc,
+                                   uint32_t block);
+
+int main(int argc, char *argv[])
+{
+        if (argc != 2) {
+                fprintf(stderr, "Incorrect number of arguments provided\n");
+                fprintf(stderr, "Usage: %s program.um > program.aot.c\n",
+                        argv[0]);
+                exit(EXIT_FAILURE);
+        }
+
+        uint32_t num_words;
+        uint32_t *image = read_image(argv[1], &num_words);
+        if (image == NULL) {
+                fprintf(stderr, "Provided file cannot be opened for reading\n");
+                exit(EXIT_FAILURE);
+        }
+
+        write_program(stdout, argv[1], image, num_words);
+        free(image);
+
+        return EXIT_SUCCESS;
+}
+
+
+/* FUNCTION:    read_image
+ * Purpose:     read a program image into host words
+ * Arg:         file_name: the pathname of the .um file
+ *              num_words: set to the number of words read
+ * Returns:     the words, which the caller frees, or NULL if the file cannot
+ *              be read
+ * Effect:      Trailing bytes that do not make up a whole word are ignored
+ * Error:       Exits if memory allocation fails
+ */
+static uint32_t *read_image(const char *file_name, uint32_t *num_words)
+{
+        FILE *input = fopen(file_name, "rb");
+        if (input == NULL) {
+                return NULL;
+        }
+
+        size_t capacity = 1024, length = 0;
+        uint32_t *image = malloc(capacity * sizeof(*image));
+        unsigned char bytes[4];
+
+        while (image != NULL && fread(bytes, 1, 4, input) == 4) {
+                if (length == capacity) {
+                        capacity *= 2;
+                        uint32_t *bigger = realloc(image,
+                                                   capacity * sizeof(*image));
+                        if (bigger == NULL) {
+                                free(image);
+                        }
+                        image = bigger;
+                        if (image == NULL) {
+                                break;
+                        }
+                }
+                image[length++] = pack_instruction(bytes[0], bytes[1],
+                                                   bytes[2], bytes[3]);
+        }
+        fclose(input);
+
+        if (image == NULL) {
+                fprintf(stderr, "um2c: out of memory\n");
+                exit(EXIT_FAILURE);
+        }
+
+        *num_words = length;
+        return image;
+}
+
+
+/* FUNCTION:    write_program
+ * Purpose:     write the C translation of a program
+ * Arg:         out: where to write it
+ *              file_name: the program's name, for the header comment
+ *              image, num_words: the program
+ * Returns:     N/A
+ * Effect:      Finds the block starts and the reachable words, then writes
+ *              the image, the bitmaps, the translated function and main
+ * Error:       Exits if memory allocation fails
+ */
+static void write_program(FILE *out, const char *file_name,
+                          const uint32_t *image, uint32_t num_words)
+{
+        bool *leader = calloc((size_t)num_words + 1, sizeof(*leader));
+        bool *reached = calloc((size_t)num_words + 1, sizeof(*reached));
+        if (leader == NULL || reached == NULL) {
+                fprintf(stderr, "um2c: out of memory\n");
+                exit(EXIT_FAILURE);
+        }
+
+        /* block starts: word 0, after each jump or halt, and LV targets */
+        leader[0] = true;
+        for (uint32_t i = 0; i < num_words; i++) {
+                Um_decoded ins = decode_instruction(image[i]);
+                if (ins.opcode == LOADP || ins.opcode == HALT) {
+                        leader[i + 1] = true;
+                } else if (ins.opcode == LV && ins.value < num_words) {
+                        leader[ins.value] = true;
+                }
+        }
+
+        /* a word is translated if control can fall into it from a start */
+        for (uint32_t i = 0; i < num_words; i++) {
+                if (leader[i]) {
+                        reached[i] = true;
+                } else if (i > 0 && reached[i - 1]) {
+                        unsigned previous = decode_instruction(image[i - 1])
+                                            .opcode;
+                        reached[i] = previous != LOADP && previous != HALT &&
+                                     previous <= LV;
+                }
+        }
+
+        fprintf(out, "/* translated from %s by um2c, do not edit */\n\n",
+                file_name);
+        fprintf(out, "#include <stddef.h>\n#include \"aot.h\"\n\n");
+        fprintf(out, "#define AOT_NUM_WORDS %uu\n\n", num_words);
+
+        fprintf(out, "static const uint32_t aot_image[%u] = {",
+                num_words + 1);
+        for (uint32_t i = 0; i < num_words; i++) {
+                fprintf(out, "%s0x%08x,", (i % 6 == 0) ? "\n        " : " ",
+                        image[i]);
+        }
+        fprintf(out, "\n        0\n};\n\n");
+
+        write_bitmap(out, "aot_code", reached, num_words);
+        write_bitmap(out, "aot_leaders", leader, num_words);
+        fprintf(out, "static Aot_program aot_program = {\n        aot_image, "
+                     "aot_code, aot_leaders, NULL, AOT_NUM_WORDS\n};\n\n");
+
+        fprintf(out, "static Um_result run(Operations_T op)\n{\n");
+        fprintf(out, "        static void *labels[%u] = {\n",
+                num_words + 1);
+        for (uint32_t i = 0; i < num_words; i++) {
+                if (leader[i]) {
+                        fprintf(out, "                [%u] = AOT_LABEL(L%u),"
+                                     "\n", i, i);
+                }
+        }
+        fprintf(out, "                [%u] = NULL\n        };\n\n", num_words);
+        fprintf(out, "        AOT_ENTER;\n\n");
+
+        uint32_t block = 0;
+        for (uint32_t i = 0; i < num_words; i++) {
+                if (!reached[i]) {
+                        continue;
+                }
+                if (leader[i]) {
+                        block = i;
+                        fprintf(out, "L%u:\n        AOT_BLOCK(%u);\n", i, i);
+                }
+                write_instruction(out, decode_instruction(image[i]), i, 
+                                  block);
+        }
+
+        /* running off the last translated word */
+        if (num_words > 0 && reached[num_words - 1]) {
+                fprintf(out, "        AOT_LEAVE(%u);\n", num_words);
+        }
+        fprintf(out, "}\n\n");
+
+        fprintf(out, "int main(int argc, char *argv[])\n{\n");
+        fprintf(out, "        return Aot_main(argc, argv, &aot_program, "
+                     "run);\n}\n");
+
+        free(leader);
+        free(reached);
+}
+
+
+/* FUNCTION:    write_bitmap
+ * Purpose:     write a bitmap with one bit per word of the program
+ * Arg:         out: where to write it
+ *              name: the name of the array
+ *              bits: one flag per word
+ *              num_words: the number of words
+ * Returns:     N/A
+ * Effect:      Bit i of the array is bit i % 32 of element i / 32
+ * Error:       N/A
+ */
+static void write_bitmap(FILE *out, const char *name, const bool *bits,
+                         uint32_t num_words)
+{
+        uint32_t length = num_words / 32 + 1;
+
+        fprintf(out, "static const uint32_t %s[%u] = {", name, length);
+        for (uint32_t k = 0; k < length; k++) {
+                uint32_t word = 0;
+                for (uint32_t j = 0; j < 32; j++) {
+                        uint32_t i = k * 32 + j;
+                        if (i < num_words && bits[i]) {
+                                word |= (uint32_t)1 << j;
+                        }
+                }
+                fprintf(out, "%s0x%08x,", (k % 6 == 0) ? "\n        " : " ",
+                        word);
+        }
+        fprintf(out, "\n};\n\n");
+}
+
+
+/* FUNCTION:    write_instruction
+ * Purpose:     write the translation of one instruction
+ * Arg:         out: where to write it
+ *              ins: the decoded instruction
+ *              pc: its index in segment 0
+ *              block: the start of its block
+ * Returns:     N/A
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static void write_instruction(FILE *out, Um_decoded ins, uint32_t pc,
+                              uint32_t block)
+{
+        unsigned a = ins.a, b = ins.b, c = ins.c;
+
+        fprintf(out, "        ");
+        switch (ins.opcode) {
+        case CMOV:  fprintf(out, "AOT_CMOV(%u, %u, %u);", a, b, c);    break;
+        case SLOAD: fprintf(out, "AOT_SLOAD(%u, %u, %u);", a, b, c);   break;
+        case SSTORE:
+                fprintf(out, "AOT_SSTORE(%u, %u, %u, %u, %u);", pc, block,
+                        a, b, c);
+                break;
+        case ADD:   fprintf(out, "AOT_ADD(%u, %u, %u);", a, b, c);     break;
+        case MUL:   fprintf(out, "AOT_MUL(%u, %u, %u);", a, b, c);     break;
+        case DIV:
+                fprintf(out, "AOT_DIV(%u, %u, %u, %u);", pc, a, b, c);
+                break;
+        case NAND:  fprintf(out, "AOT_NAND(%u, %u, %u);", a, b, c);    break;
+        case HALT:  fprintf(out, "AOT_HALT(%u);", pc);                 break;
+        case ACTIVATE:   fprintf(out, "AOT_MAP(%u, %u);", b, c);       break;
+        case INACTIVATE: fprintf(out, "AOT_UNMAP(%u, %u);", pc, c);    break;
+        case OUT:   fprintf(out, "AOT_OUT(%u, %u);", pc, c);           break;
+        case IN:    fprintf(out, "AOT_IN(%u);", c);                    break;
+        case LOADP: fprintf(out, "AOT_LOADP(%u, %u, %u);", pc, b, c);  break;
+        case LV:    fprintf(out, "AOT_LV(%u, %uu);", a, ins.value);    break;
+        default:    fprintf(out, "AOT_INVALID(%u);", pc);              break;
+        }
+        fprintf(out, "\n");
+}
@@ -0,0 +1,107 @@
+/*****************************************************************************
+ *
+ *                                  um2umn.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary: This is the main function of our native image converter. It
+ *     reads a .um program, converts its big-endian words to host order once
+ *     and writes them as a .umn image, which um then maps instead of
+ *     converting:
+ *
+ *        um2umn midmark.um midmark.umn
+ *
+ *     The image only runs on hosts with the same byte order; elsewhere um
+ *     reports it as not valid. Trailing bytes that do not make up a whole
+ *     word are dropped, as um drops them when loading the .um file.
+ *
+ *
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "instruction_packing.h"
+#include "umn.h"
+
+static uint32_t *read_image(const char *file_name, uint32_t *num_words);
+
+int main(int argc, char *argv[])
+{
+        if (argc != 3) {
+                fprintf(stderr, "Incorrect number of arguments provided\n");
+                fprintf(stderr, "Usage: %s program.um program.umn\n",
+                        argv[0]);
+                exit(EXIT_FAILURE);
+        }
+
+        uint32_t num_words;
+        uint32_t *image = read_image(argv[1], &num_words);
+        if (image == NULL) {
+                fprintf(stderr, "Provided file cannot be opened for reading\n");
+                exit(EXIT_FAILURE);
+        }
+
+        FILE *out = fopen(argv[2], "wb");
+        bool written = out != NULL && Umn_write(out, image, num_words);
+        if (out != NULL && fclose(out) != 0) {
+                written = false;
+        }
+        free(image);
+
+        if (!written) {
+                fprintf(stderr, "%s cannot be written\n", argv[2]);
+                remove(argv[2]);
+                exit(EXIT_FAILURE);
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+/* FUNCTION:    read_image
+ * Purpose:     read a program image into host words
+ * Arg:         file_name: the pathname of the .um file
+ *              num_words: set to the number of words read
+ * Returns:     the words, which the caller frees, or NULL if the file cannot
+ *              be read
+ * Effect:      Trailing bytes that do not make up a whole word are ignored
+ * Error:       Exits if memory allocation fails
+ */
+static uint32_t *read_image(const char *file_name, uint32_t *num_words)
+{
+        FILE *input = fopen(file_name, "rb");
+        if (input == NULL) {
+                return NULL;
+        }
+
+        size_t capacity = 1024, length = 0;
+        uint32_t *image = malloc(capacity * sizeof(*image));
+        unsigned char bytes[4];
+
+        while (image != NULL && fread(bytes, 1, 4, input) == 4) {
+                if (length == capacity) {
+                        capacity *= 2;
+                        uint32_t *bigger = realloc(image,
+                                                   capacity * sizeof(*image));
+                        if (bigger == NULL) {
+                                free(image);
+                        }
+                        image = bigger;
+                        if (image == NULL) {
+                                break;
+                        }
+                }
+                image[length++] = pack_instruction(bytes[0], bytes[1],
+                                                   bytes[2], bytes[3]);
+        }
+        fclose(input);
+
+        if (image == NULL) {
+                fprintf(stderr, "um2umn: out of memory\n");
+                exit(EXIT_FAILURE);
+        }
+
+        *num_words = length;
+        return image;
+}
@@ -17,49 +17,531 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
-#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
 #include "operations.h"
+#include "profile.h"
+
+/* the execution engines that can be selected from the command line */
+typedef enum Um_engine { 
+        ENGINE_THREADED = 0, ENGINE_LOOP, ENGINE_JIT 
+} Um_engine;
+
+/* the I/O devices that can be selected from the command line */
+typedef enum Um_io { 
+        IO_BUFFERED = 0, IO_DIRECT, IO_ASYNC 
+} Um_io;
+
+/* instructions between profile samples unless --profile-interval is given,
+   a prime so the samples do not keep landing on the same step of a loop */
+#define default_interval 9973
+
+/* the counts kept by --stats, and when the run started */
+static Um_stats stats;
+static struct timespec started;
+
+static void      usage       (const char *program);
+static bool      finish_log  (Iolog_T log, const char *name);
+static void      warn_trailing(const char *file_name, int trailing);
+static Um_result run         (Operations_T op, Um_engine engine,
+                              Profile_T profile, uint64_t interval,
+                              const char *snapshot, uint64_t snapshot_at);
+static void      report_stats(int signal_number);
+static char     *append      (char *out, const char *text);
+static char     *append_number(char *out, uint64_t number);
 
 int main (int argc, char *argv[]) 
 {
-        /* if a filename is provided open it for reading in and if not read 
-           in from stdin */
-        FILE *input;
-        char *file_name = argv[1];
-
-        if (argc == 2) {
-                input = fopen(file_name, "r");
-                if (input == NULL) {
-                        fprintf(stderr, 
-                               "Provided file cannot be opened for reading\n");
+        /* options come before the filename of the program */
+        Um_engine engine = ENGINE_THREADED;
+        Um_io io = IO_BUFFERED;
+        bool count = false;
+        const char *profile_name = NULL;
+        uint64_t interval = default_interval;
+        const char *snapshot = NULL;
+        uint64_t snapshot_at = 0;
+        const char *restore = NULL;
+        const char *cache = NULL;
+        const char *record = NULL;
+        bool record_output = false;
+        const char *replay = NULL;
+        const char *file_name = NULL;
+
+        for (int i = 1; i < argc; i++) {
+                if (strcmp(argv[i], "--engine=threaded") == 0) {
+                        engine = ENGINE_THREADED;
+                } else if (strcmp(argv[i], "--engine=loop") == 0) {
+                        engine = ENGINE_LOOP;
+                } else if (strcmp(argv[i], "--engine=jit") == 0) {
+                        engine = ENGINE_JIT;
+                } else if (strcmp(argv[i], "--io=buffered") == 0) {
+                        io = IO_BUFFERED;
+                } else if (strcmp(argv[i], "--io=direct") == 0) {
+                        io = IO_DIRECT;
+                } else if (strcmp(argv[i], "--io=async") == 0) {
+                        io = IO_ASYNC;
+                } else if (strcmp(argv[i], "--stats") == 0) {
+                        count = true;
+                } else if (strncmp(argv[i], "--profile=", 10) == 0 &&
+                           argv[i][10] != '\0') {
+                        profile_name = argv[i] + 10;
+                } else if (strncmp(argv[i], "--profile-interval=", 19) == 0) {
+                        char *end;
+                        interval = strtoull(argv[i] + 19, &end, 10);
+                        if (*end != '\0' || interval == 0) {
+                                usage(argv[0]);
+                        }
+                } else if (strncmp(argv[i], "--snapshot=", 11) == 0 &&
+                           argv[i][11] != '\0') {
+                        snapshot = argv[i] + 11;
+                } else if (strcmp(argv[i], "--snapshot-at=in") == 0) {
+                        snapshot_at = 0;
+                } else if (strncmp(argv[i], "--snapshot-at=", 14) == 0) {
+                        char *end;
+                        snapshot_at = strtoull(argv[i] + 14, &end, 10);
+                        if (*end != '\0' || snapshot_at == 0) {
+                                usage(argv[0]);
+                        }
+                } else if (strncmp(argv[i], "--restore=", 10) == 0 &&
+                           argv[i][10] != '\0') {
+                        restore = argv[i] + 10;
+                } else if (strncmp(argv[i], "--cache=", 8) == 0 &&
+                           argv[i][8] != '\0') {
+                        cache = argv[i] + 8;
+                } else if (strncmp(argv[i], "--record=", 9) == 0 &&
+                           argv[i][9] != '\0') {
+                        record = argv[i] + 9;
+                        record_output = true;
+                } else if (strncmp(argv[i], "--record-input=", 15) == 0 &&
+                           argv[i][15] != '\0') {
+                        record = argv[i] + 15;
+                        record_output = false;
+                } else if (strncmp(argv[i], "--replay=", 9) == 0 &&
+                           argv[i][9] != '\0') {
+                        replay = argv[i] + 9;
+                } else if (file_name == NULL && 
+                           (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)) {
+                        file_name = argv[i];
+                } else {
+                        usage(argv[0]);
+                }
+        }
+        /* a restored machine needs no program file */
+        if ((file_name == NULL) == (restore == NULL) || 
+            (count && engine != ENGINE_THREADED) ||
+            (record != NULL && replay != NULL) ||
+            (engine == ENGINE_LOOP && (profile_name != NULL || 
+                                       snapshot != NULL))) {
+                usage(argv[0]);
+        }
+        if (file_name == NULL) {
+                file_name = restore;
+        }
+
+        /* a program read from stdin has it all to itself, so it gets no
+           input */
+        int in_fd = STDIN_FILENO;
+        if (strcmp(file_name, "-") == 0) {
+                file_name = "/dev/stdin";
+                in_fd = open("/dev/null", O_RDONLY);
+        }
+
+        /* a log is attached to the device before the program runs, and
+           outlives it */
+        Iolog_T log = NULL;
+        if (record != NULL) {
+                log = Iolog_record(record, record_output);
+                if (log == NULL) {
+                        fprintf(stderr, "%s cannot be opened for writing\n",
+                                record);
+                        exit(EXIT_FAILURE);
+                }
+        } else if (replay != NULL) {
+                log = Iolog_replay(replay);
+                if (log == NULL) {
+                        fprintf(stderr, "%s is not an I/O log that can be "
+                                        "replayed\n", replay);
                         exit(EXIT_FAILURE);
                 }
-        } else {
-                fprintf(stderr, "Incorrect number of arguments provided\n");
-                exit(EXIT_FAILURE);
         }
 
         /* declare an operations struct */
         Operations_T operations = Operations_new();
+        Io_T device = NULL;
+        if (io == IO_DIRECT) {
+                device = Io_new_direct(in_fd, STDOUT_FILENO);
+        } else if (io == IO_ASYNC) {
+                device = Io_new_async(in_fd, STDOUT_FILENO);
+        } else if (in_fd != STDIN_FILENO || log != NULL) {
+                device = Io_new_buffered(in_fd, STDOUT_FILENO);
+        }
+        if (device != NULL && log != NULL) {
+                Io_set_log(device, log);
+        }
+        if (device != NULL) {
+                Operations_set_io(operations, device);
+        }
+        if (cache != NULL) {
+                Operations_set_cache(operations, cache);
+        }
 
-        /* get the number of words from the file metadata */
-        struct stat meta_data;
-        stat(file_name, &meta_data);
-        unsigned num_words = meta_data.st_size / 4;
-        
-        /* read in the program from the provided file */
-        read_in_program(input, num_words, operations);
-        fclose(input);
+        /* read in the program from the provided file, or the snapshot. A
+           pipe is streamed, except to the loop engine, which runs from the
+           memory module and cannot wait for the rest of segment 0 */
+        int trailing = (restore != NULL) ?
+                       (Operations_restore(operations, restore) ? 0 : -2) :
+                       (engine == ENGINE_LOOP) ?
+                       read_in_file(file_name, operations) :
+                       stream_in_file(file_name, operations);
+        if (trailing == -2 && restore != NULL) {
+                fprintf(stderr, "%s is not a snapshot that can be restored\n",
+                        restore);
+                exit(EXIT_FAILURE);
+        } else if (trailing == -2) {
+                fprintf(stderr, "%s is not a valid .umn image\n", file_name);
+                exit(EXIT_FAILURE);
+        } else if (trailing < 0) {
+                fprintf(stderr, "Provided file cannot be opened for reading\n");
+                exit(EXIT_FAILURE);
+        }
+        warn_trailing(file_name, trailing);
+
+        /* counting is left to the run; SIGUSR1 reports the counts so far */
+        if (count) {
+                Operations_set_stats(operations, &stats);
+                struct sigaction action;
+                memset(&action, 0, sizeof(action));
+                action.sa_handler = report_stats;
+                action.sa_flags = SA_RESTART;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGUSR1, &action, NULL);
+                clock_gettime(CLOCK_MONOTONIC, &started);
+        }
+
+        /* the profile is sampled every interval instructions */
+        FILE *profile_file = NULL;
+        Profile_T profile = NULL;
+        if (profile_name != NULL) {
+                profile_file = fopen(profile_name, "w");
+                if (profile_file == NULL) {
+                        fprintf(stderr, "%s cannot be opened for writing\n",
+                                profile_name);
+                        exit(EXIT_FAILURE);
+                }
+                profile = Profile_new(profile_file, file_name);
+        }
         
-        /* loop that reads an insruction from segment 0 and then runs it. Runs
-           until it reaches a HALT instruction */
-        uint32_t instruction;
-        do {
-                instruction = next_instruction(operations);
-        } while (do_instruction(instruction, operations));
+        if (engine != ENGINE_LOOP) {
+                Um_result result = run(operations, engine, profile, 
+                                       interval, snapshot, snapshot_at);
+
+                /* a streamed program's last bytes may only be known now */
+                warn_trailing(file_name, Operations_trailing(operations));
+
+                if (count) {
+                        report_stats(0);
+                }
+                if (profile != NULL) {
+                        Profile_free(&profile);
+                        fclose(profile_file);
+                }
+                if (result.status == UM_FAULT) {
+                        fprintf(stderr, "UM failure at instruction %u: %s\n",
+                                Operations_pc(operations), 
+                                Operations_fault(operations));
+                        Operations_free(&operations);
+                        finish_log(log, record != NULL ? record : replay);
+                        exit(EXIT_FAILURE);
+                }
+        } else {
+                /* loop that reads an insruction from segment 0 and then runs
+                   it. Runs until it reaches a HALT instruction */
+                uint32_t instruction;
+                do {
+                        instruction = next_instruction(operations);
+                } while (do_instruction(instruction, operations));
+        }
 
         /* free memory */
         Operations_free(&operations);
+        if (!finish_log(log, record != NULL ? record : replay)) {
+                exit(EXIT_FAILURE);
+        }
 
         return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+
+/* FUNCTION:    usage
+ * Purpose:     report how the program should be invoked and exit
+ * Arg:         program: the name the program was invoked with
+ * Returns:     N/A
+ * Effect:      prints a usage message to stderr and exits with failure
+ * Error:       N/A
+ */
+static void usage(const char *program)
+{
+        fprintf(stderr, "Incorrect number of arguments provided\n");
+        fprintf(stderr, "Usage: %s [--engine=threaded|loop|jit] "
+                        "[--io=buffered|direct|async] [--stats] "
+                        "[--profile=file] [--profile-interval=n] "
+                        "[--snapshot=file "
+                        "[--snapshot-at=in|n]] [--cache=dir] "
+                        "[--record=file|--record-input=file|--replay=file] "
+                        "program.um|- | --restore=file\n", program);
+        exit(EXIT_FAILURE);
+}
+
+
+/* FUNCTION:    warn_trailing
+ * Purpose:     report the bytes at the end of a program that were ignored
+ * Arg:         file_name: the program's pathname
+ *              trailing: how many bytes after its last whole word there
+ *                        were
+ * Returns:     N/A
+ * Effect:      Prints a warning on stderr if trailing is more than 0
+ * Error:       N/A
+ */
+static void warn_trailing(const char *file_name, int trailing)
+{
+        if (trailing > 0) {
+                fprintf(stderr, "%s: ignoring %d trailing byte(s) that do not "
+                                "make up a whole word\n", file_name, 
+                                trailing);
+        }
+}
+
+
+/* FUNCTION:    finish_log
+ * Purpose:     close the I/O log of a run once its device has been freed
+ * Arg:         log: the log, or NULL if there is none
+ *              name: the log's pathname
+ * Returns:     false if the log could not be written in full, or the run
+ *              replaying it wrote something else
+ * Effect:      Reports either failure on stderr and frees the log
+ * Error:       N/A
+ */
+static bool finish_log(Iolog_T log, const char *name)
+{
+        if (log == NULL) {
+                return true;
+        }
+
+        uint64_t offset;
+        bool ok = Iolog_finish(log, &offset);
+        if (!ok && Iolog_replaying(log)) {
+                fprintf(stderr, "output differs from %s at byte %llu\n",
+                        name, (unsigned long long)offset);
+        } else if (!ok) {
+                fprintf(stderr, "%s could not be written in full\n", name);
+        }
+
+        Iolog_free(&log);
+        return ok;
+}
+
+
+/* FUNCTION:    run
+ * Purpose:     run the program with the threaded or JIT engine until it
+ *              halts or fails
+ * Arg:         op: the machine
+ *              engine: ENGINE_THREADED or ENGINE_JIT
+ *              profile: sampled every interval instructions, unless NULL
+ *              interval: the instructions between samples
+ *              snapshot: where to save the machine once, or NULL
+ *              snapshot_at: the instructions to run before saving it, or 0
+ *                           to save it just before the first IN
+ * Returns:     the result of the last run
+ * Effect:      Runs the engine in slices that end at each sample and at the
+ *              snapshot, so neither is taken late. The program goes on
+ *              running after the snapshot is saved
+ * Error:       Exits with a message if the snapshot cannot be written
+ */
+static Um_result run(Operations_T op, Um_engine engine, Profile_T profile,
+                     uint64_t interval, const char *snapshot,
+                     uint64_t snapshot_at)
+{
+        uint64_t to_sample = interval;
+        uint64_t to_snapshot = snapshot_at;
+        bool pending = snapshot != NULL;
+        Operations_stop_at_input(op, pending && snapshot_at == 0);
+
+        for (;;) {
+                /* 0 is no limit, so a slice is the nearer of the two */
+                uint64_t steps = (profile == NULL) ? 0 : to_sample;
+                if (pending && to_snapshot != 0 && 
+                    (steps == 0 || to_snapshot < steps)) {
+                        steps = to_snapshot;
+                }
+
+                Um_result result = (engine == ENGINE_JIT) ?
+                                   Operations_run_jit(op, steps) :
+                                   Operations_run(op, steps);
+                if (result.status != UM_BUDGET && 
+                    result.status != UM_INPUT) {
+                        return result;
+                }
+
+                if (profile != NULL && (to_sample -= result.steps) == 0) {
+                        Profile_sample(profile, op);
+                        to_sample = interval;
+                }
+                if (pending && to_snapshot != 0) {
+                        to_snapshot -= result.steps;
+                }
+                if (pending && (result.status == UM_INPUT || 
+                                (snapshot_at != 0 && to_snapshot == 0))) {
+                        if (!Operations_save(op, snapshot)) {
+                                fprintf(stderr, "%s cannot be written\n",
+                                        snapshot);
+                                exit(EXIT_FAILURE);
+                        }
+                        pending = false;
+                        Operations_stop_at_input(op, false);
+                }
+        }
+}
+
+
+/* the names of the opcodes in the --stats report */
+static const char *const opcode_names[16] = {
+        "cmov", "sload", "sstore", "add", "mul", "div", "nand", "halt",
+        "map", "unmap", "out", "in", "loadp", "lv", "14", "15"
+};
+
+/* FUNCTION:    report_stats
+ * Purpose:     write the --stats report to stderr
+ * Arg:         signal_number: the signal being handled, or 0 when called
+ *                             after the run
+ * Returns:     N/A
+ * Effect:      Writes the instructions retired, the MIPS since the run
+ *              started and the other counts in stats. The counts of a run
+ *              that is still going may be off by the instruction being
+ *              counted. Uses only functions that are safe in a signal
+ *              handler, so SIGUSR1 can report a run while it goes
+ * Error:       N/A
+ */
+static void report_stats(int signal_number)
+{
+        (void)signal_number;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t micros = (uint64_t)(now.tv_sec - started.tv_sec) * 1000000 +
+                          (now.tv_nsec - started.tv_nsec) / 1000;
+
+        uint64_t total = 0;
+        for (int i = 0; i < 16; i++) {
+                total += stats.opcodes[i];
+        }
+
+        /* MIPS is instructions per microsecond, written to one decimal */
+        uint64_t tenths = (micros == 0) ? 0 : total * 10 / micros;
+
+        char buffer[4096];
+        char *out = buffer;
+        out = append(out, "um stats: ");
+        out = append_number(out, total);
+        out = append(out, " instructions in ");
+        out = append_number(out, micros / 1000);
+        out = append(out, " ms, ");
+        out = append_number(out, tenths / 10);
+        out = append(out, ".");
+        out = append_number(out, tenths % 10);
+        out = append(out, " MIPS\n");
+
+        for (int i = 0; i < 16; i++) {
+                if (stats.opcodes[i] == 0) {
+                        continue;
+                }
+                out = append(out, "  ");
+                out = append(out, opcode_names[i]);
+                out = append(out, "\t");
+                out = append_number(out, stats.opcodes[i]);
+                out = append(out, "\n");
+        }
+
+        out = append(out, "  loadp in segment 0: ");
+        out = append_number(out, stats.jumps);
+        out = append(out, ", from other segments: ");
+        out = append_number(out, stats.loads);
+        out = append(out, " (");
+        out = append_number(out, stats.words_loaded);
+        out = append(out, " words)\n");
+
+        out = append(out, "  map: ");
+        out = append_number(out, stats.maps);
+        out = append(out, ", unmap: ");
+        out = append_number(out, stats.unmaps);
+        out = append(out, ", peak live segments: ");
+        out = append_number(out, stats.peak_live);
+        out = append(out, "\n");
+        for (int bits = 0; bits <= 32; bits++) {
+                if (stats.map_sizes[bits] == 0) {
+                        continue;
+                }
+                out = append(out, "    size < 2^");
+                out = append_number(out, bits);
+                out = append(out, "\t");
+                out = append_number(out, stats.map_sizes[bits]);
+                out = append(out, "\n");
+        }
+
+        out = append(out, "  bytes in: ");
+        out = append_number(out, stats.bytes_in);
+        out = append(out, ", bytes out: ");
+        out = append_number(out, stats.bytes_out);
+        out = append(out, "\n");
+
+        for (char *next = buffer; next < out; ) {
+                ssize_t written = write(STDERR_FILENO, next, out - next);
+                if (written <= 0) {
+                        break;
+                }
+                next += written;
+        }
+}
+
+
+/* FUNCTION:    append
+ * Purpose:     copy a string to the end of a report
+ * Arg:         out: where the report ends
+ *              text: the string
+ * Returns:     where the report now ends
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static char *append(char *out, const char *text)
+{
+        while (*text != '\0') {
+                *out++ = *text++;
+        }
+        return out;
+}
+
+
+/* FUNCTION:    append_number
+ * Purpose:     write a number in decimal at the end of a report
+ * Arg:         out: where the report ends
+ *              number: the number
+ * Returns:     where the report now ends
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static char *append_number(char *out, uint64_t number)
+{
+        char digits[20];
+        int length = 0;
+        do {
+                digits[length++] = '0' + number % 10;
+                number /= 10;
+        } while (number != 0);
+
+        while (length > 0) {
+                *out++ = digits[--length];
+        }
+        return out;
+}
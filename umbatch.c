@@ -0,0 +1,220 @@
+/*****************************************************************************
+ *
+ *                                  umbatch.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary: This is the main function of our batch runner. It reads a
+ *     list of jobs, one per line, each a .um program and optionally a file
+ *     holding its input:
+ *
+ *        testing/midmark.um
+ *        testing/advent.umz testing/advent.0
+ *
+ *     and runs them all in this process with the batch module, on one
+ *     thread per processor unless told otherwise. Blank lines and lines
+ *     starting with # are skipped. A line is printed for each job, in the
+ *     order of the list, and each job's output is written to <n>.out in
+ *     the directory given with --out, where n counts jobs from 0.
+ *
+ *
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "batch.h"
+
+/* the instructions a job runs before it yields, unless --slice is given */
+#define default_slice (1 << 20)
+
+static void           usage    (const char *program);
+static unsigned char *read_file(const char *file_name, size_t *length);
+
+int main(int argc, char *argv[])
+{
+        long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        uint64_t slice = default_slice;
+        bool jit = false;
+        const char *out_dir = NULL;
+        const char *list_name = NULL;
+
+        for (int i = 1; i < argc; i++) {
+                char *end = NULL;
+                if (strncmp(argv[i], "--threads=", 10) == 0) {
+                        num_threads = strtol(argv[i] + 10, &end, 10);
+                        if (*end != '\0' || num_threads < 1) {
+                                usage(argv[0]);
+                        }
+                } else if (strncmp(argv[i], "--slice=", 8) == 0) {
+                        slice = strtoull(argv[i] + 8, &end, 10);
+                        if (*end != '\0' || slice == 0) {
+                                usage(argv[0]);
+                        }
+                } else if (strcmp(argv[i], "--engine=threaded") == 0) {
+                        jit = false;
+                } else if (strcmp(argv[i], "--engine=jit") == 0) {
+                        jit = true;
+                } else if (strncmp(argv[i], "--out=", 6) == 0 &&
+                           argv[i][6] != '\0') {
+                        out_dir = argv[i] + 6;
+                } else if (list_name == NULL && argv[i][0] != '-') {
+                        list_name = argv[i];
+                } else {
+                        usage(argv[0]);
+                }
+        }
+        if (list_name == NULL) {
+                usage(argv[0]);
+        }
+        if (num_threads < 1) {
+                num_threads = 1;
+        }
+
+        FILE *list = fopen(list_name, "r");
+        if (list == NULL) {
+                fprintf(stderr, "%s cannot be opened for reading\n",
+                        list_name);
+                exit(EXIT_FAILURE);
+        }
+
+        /* the program names are kept until the batch has run */
+        Batch_T batch = Batch_new(num_threads, slice, jit);
+        char **programs = NULL;
+        unsigned num_jobs = 0;
+        char line[4096];
+        while (fgets(line, sizeof(line), list) != NULL) {
+                char program[sizeof(line)], input_name[sizeof(line)];
+                int fields = sscanf(line, "%s %s", program, input_name);
+                if (fields < 1 || program[0] == '#') {
+                        continue;
+                }
+
+                size_t length = 0;
+                unsigned char *input = NULL;
+                if (fields == 2) {
+                        input = read_file(input_name, &length);
+                        if (input == NULL) {
+                                fprintf(stderr, "%s cannot be opened for "
+                                                "reading\n", input_name);
+                                exit(EXIT_FAILURE);
+                        }
+                }
+
+                programs = realloc(programs, (num_jobs + 1) *
+                                             sizeof(*programs));
+                if (programs == NULL || 
+                    (programs[num_jobs] = malloc(strlen(program) + 1)) ==
+                    NULL) {
+                        fprintf(stderr, "umbatch: out of memory\n");
+                        exit(EXIT_FAILURE);
+                }
+                strcpy(programs[num_jobs], program);
+
+                Batch_add(batch, programs[num_jobs], input, length);
+                free(input);
+                num_jobs++;
+        }
+        fclose(list);
+
+        Batch_run(batch);
+
+        int exit_status = EXIT_SUCCESS;
+        for (unsigned i = 0; i < num_jobs; i++) {
+                const char *fault;
+                size_t length;
+                const unsigned char *output = Batch_output(batch, i, &length);
+
+                if (Batch_status(batch, i, &fault) == UM_FAULT) {
+                        printf("job %u %s: failed (%s) after %llu "
+                               "instructions\n", i, programs[i], fault,
+                               (unsigned long long)Batch_steps(batch, i));
+                        exit_status = EXIT_FAILURE;
+                } else {
+                        printf("job %u %s: halted after %llu instructions, "
+                               "%zu bytes of output\n", i, programs[i],
+                               (unsigned long long)Batch_steps(batch, i),
+                               length);
+                }
+
+                if (out_dir != NULL) {
+                        char out_name[4096];
+                        snprintf(out_name, sizeof(out_name), "%s/%u.out",
+                                 out_dir, i);
+                        FILE *out = fopen(out_name, "wb");
+                        if (out == NULL ||
+                            fwrite(output, 1, length, out) != length ||
+                            fclose(out) != 0) {
+                                fprintf(stderr, "%s cannot be written\n",
+                                        out_name);
+                                exit(EXIT_FAILURE);
+                        }
+                }
+                free(programs[i]);
+        }
+
+        free(programs);
+        Batch_free(&batch);
+        return exit_status;
+}
+
+
+/* FUNCTION:    usage
+ * Purpose:     report how the program should be invoked and exit
+ * Arg:         program: the name the program was invoked with
+ * Returns:     N/A
+ * Effect:      prints a usage message to stderr and exits with failure
+ * Error:       N/A
+ */
+static void usage(const char *program)
+{
+        fprintf(stderr, "Usage: %s [--threads=n] [--slice=n] "
+                        "[--engine=threaded|jit] [--out=dir] jobs.txt\n",
+                        program);
+        exit(EXIT_FAILURE);
+}
+
+
+/* FUNCTION:    read_file
+ * Purpose:     read a whole file into memory
+ * Arg:         file_name: the pathname of the file
+ *              length: set to the number of bytes read
+ * Returns:     the bytes, which the caller frees, or NULL if the file
+ *              cannot be read
+ * Effect:      N/A
+ * Error:       Exits if memory allocation fails
+ */
+static unsigned char *read_file(const char *file_name, size_t *length)
+{
+        FILE *input = fopen(file_name, "rb");
+        if (input == NULL) {
+                return NULL;
+        }
+
+        size_t capacity = 4096;
+        unsigned char *bytes = malloc(capacity);
+        *length = 0;
+        size_t got;
+        while (bytes != NULL &&
+               (got = fread(bytes + *length, 1, capacity - *length,
+                            input)) > 0) {
+                *length += got;
+                if (*length == capacity) {
+                        capacity *= 2;
+                        unsigned char *bigger = realloc(bytes, capacity);
+                        if (bigger == NULL) {
+                                free(bytes);
+                        }
+                        bytes = bigger;
+                }
+        }
+        fclose(input);
+
+        if (bytes == NULL) {
+                fprintf(stderr, "umbatch: out of memory\n");
+                exit(EXIT_FAILURE);
+        }
+        return bytes;
+}
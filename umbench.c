@@ -0,0 +1,454 @@
+/*****************************************************************************
+ *
+ *                                  umbench.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary: This is the main function of our benchmark driver. It runs
+ *     the um executable on each benchmark program a number of times and
+ *     reports the mean wall time with a 95% confidence interval, millions
+ *     of instructions per second and peak resident set size, plus the time
+ *     the um takes to start up and halt on a one-word program:
+ *
+ *        umbench --runs=5 --startup=testing/halt.um \
+ *                --baseline=testing/bench.json testing/midmark.um
+ *
+ *     A program's input is pinned to the file with the same name and the
+ *     extension .0, as for the unit tests, or is empty. The instruction
+ *     count comes from one extra run with --stats, which is not timed.
+ *     The results can be written as a JSON baseline, and a run whose wall
+ *     time is worse than the baseline's by more than the threshold, even
+ *     at the low end of its confidence interval, makes the driver fail.
+ *
+ *
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/* the most programs that can be benchmarked at once, counting startup */
+#define max_workloads 32
+
+/* the most runs of each program */
+#define max_runs 1000
+
+/*
+ * what was measured for one program:
+ *      name: the program's file name without directory or extension
+ *      file: the program's path
+ *      input: the path of its pinned input, or /dev/null
+ *      wall_ms, ci_ms: the mean wall time and the half-width of its 95%
+ *                      confidence interval
+ *      instructions: the instructions retired by one run, 0 if not counted
+ *      peak_rss_kb: the largest resident set size of any run
+ */
+typedef struct Workload {
+        char name[64];
+        const char *file;
+        char input[4096];
+        double wall_ms;
+        double ci_ms;
+        uint64_t instructions;
+        long peak_rss_kb;
+} Workload;
+
+static void     usage      (const char *program);
+static void     set_up     (Workload *workload, const char *file);
+static bool     measure    (const char *um, Workload *workload, int runs);
+static bool     run_once   (const char *um, const char *stats,
+                            const Workload *workload, double *wall_ms,
+                            long *rss_kb, uint64_t *instructions);
+static double   t_value    (int degrees);
+static bool     read_baseline(const char *file_name, const char *name,
+                              double *wall_ms);
+static bool     write_baseline(const char *file_name,
+                               const Workload *workloads, int count,
+                               int runs);
+
+int main(int argc, char *argv[])
+{
+        const char *um = "./um";
+        const char *startup = NULL;
+        const char *baseline = NULL;
+        const char *output = NULL;
+        int runs = 5;
+        double threshold = 5.0;
+        Workload workloads[max_workloads];
+        int count = 0;
+
+        for (int i = 1; i < argc; i++) {
+                char *end = NULL;
+                if (strncmp(argv[i], "--um=", 5) == 0) {
+                        um = argv[i] + 5;
+                } else if (strncmp(argv[i], "--runs=", 7) == 0) {
+                        runs = strtol(argv[i] + 7, &end, 10);
+                        if (*end != '\0' || runs < 2 || runs > max_runs) {
+                                usage(argv[0]);
+                        }
+                } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+                        threshold = strtod(argv[i] + 12, &end);
+                        if (*end != '\0' || threshold < 0) {
+                                usage(argv[0]);
+                        }
+                } else if (strncmp(argv[i], "--startup=", 10) == 0) {
+                        startup = argv[i] + 10;
+                } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+                        baseline = argv[i] + 11;
+                } else if (strncmp(argv[i], "--write=", 8) == 0) {
+                        output = argv[i] + 8;
+                } else if (argv[i][0] != '-' && count < max_workloads - 1) {
+                        set_up(&workloads[count++], argv[i]);
+                } else {
+                        usage(argv[0]);
+                }
+        }
+        if (count == 0 && startup == NULL) {
+                usage(argv[0]);
+        }
+
+        /* startup is the time to load and halt, so it is not counted */
+        if (startup != NULL) {
+                set_up(&workloads[count], startup);
+                strcpy(workloads[count].name, "startup");
+                count++;
+        }
+
+        printf("%-12s %22s %10s %12s %12s\n", "program", "wall ms (95% CI)",
+               "MIPS", "peak RSS KB", "vs baseline");
+
+        bool regressed = false;
+        for (int i = 0; i < count; i++) {
+                Workload *workload = &workloads[i];
+                bool counted = startup == NULL || i != count - 1;
+                if (!measure(um, workload, runs) ||
+                    (counted && !run_once(um, "--stats", workload, NULL,
+                                          NULL, &workload->instructions))) {
+                        fprintf(stderr, "umbench: %s failed to run %s\n", um,
+                                workload->file);
+                        exit(EXIT_FAILURE);
+                }
+
+                char mips[32] = "-";
+                if (workload->instructions != 0) {
+                        snprintf(mips, sizeof(mips), "%.1f",
+                                 workload->instructions /
+                                 (workload->wall_ms * 1000.0));
+                }
+
+                /* a regression must show even at the low end of the CI */
+                char change[32] = "-";
+                double before;
+                if (baseline != NULL &&
+                    read_baseline(baseline, workload->name, &before)) {
+                        snprintf(change, sizeof(change), "%+.1f%%",
+                                 100.0 * (workload->wall_ms - before) /
+                                 before);
+                        if (workload->wall_ms - workload->ci_ms >
+                            before * (1.0 + threshold / 100.0)) {
+                                strcat(change, " SLOWER");
+                                regressed = true;
+                        }
+                }
+
+                printf("%-12s %12.1f +- %-6.1f %10s %12ld %12s\n",
+                       workload->name, workload->wall_ms, workload->ci_ms,
+                       mips, workload->peak_rss_kb, change);
+                fflush(stdout);
+        }
+
+        if (output != NULL && !write_baseline(output, workloads, count,
+                                               runs)) {
+                fprintf(stderr, "umbench: %s cannot be written\n", output);
+                exit(EXIT_FAILURE);
+        }
+        if (regressed) {
+                fprintf(stderr, "umbench: slower than %s by more than "
+                                "%.1f%%\n", baseline, threshold);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+
+/* FUNCTION:    usage
+ * Purpose:     report how the program should be invoked and exit
+ * Arg:         program: the name the program was invoked with
+ * Returns:     N/A
+ * Effect:      prints a usage message to stderr and exits with failure
+ * Error:       N/A
+ */
+static void usage(const char *program)
+{
+        fprintf(stderr, "Usage: %s [--um=path] [--runs=n] [--threshold=pct] "
+                        "[--startup=program.um] [--baseline=file.json] "
+                        "[--write=file.json] program.um...\n", program);
+        fprintf(stderr, "--runs must be from 2 to %d\n", max_runs);
+        exit(EXIT_FAILURE);
+}
+
+
+/* FUNCTION:    set_up
+ * Purpose:     name a program and find its pinned input
+ * Arg:         workload: filled in
+ *              file: the program's path
+ * Returns:     N/A
+ * Effect:      The name is the file name without directory or extension,
+ *              and the input is that path with the extension .0 if such a
+ *              file exists, or /dev/null
+ * Error:       N/A
+ */
+static void set_up(Workload *workload, const char *file)
+{
+        memset(workload, 0, sizeof(*workload));
+        workload->file = file;
+
+        const char *base = strrchr(file, '/');
+        base = (base == NULL) ? file : base + 1;
+        snprintf(workload->name, sizeof(workload->name), "%s", base);
+        char *dot = strrchr(workload->name, '.');
+        if (dot != NULL) {
+                *dot = '\0';
+        }
+
+        snprintf(workload->input, sizeof(workload->input), "%s", file);
+        dot = strrchr(workload->input, '.');
+        if (dot != NULL && strchr(dot, '/') == NULL) {
+                strcpy(dot, ".0");
+        }
+        if (dot == NULL || access(workload->input, R_OK) != 0) {
+                strcpy(workload->input, "/dev/null");
+        }
+}
+
+
+/* FUNCTION:    measure
+ * Purpose:     time a number of runs of a program
+ * Arg:         um: the um executable
+ *              workload: the program, whose results are filled in
+ *              runs: how many runs to time
+ * Returns:     false if any run failed
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static bool measure(const char *um, Workload *workload, int runs)
+{
+        double times[max_runs];
+        double sum = 0;
+
+        for (int i = 0; i < runs; i++) {
+                long rss_kb;
+                if (!run_once(um, NULL, workload, &times[i], &rss_kb,
+                              NULL)) {
+                        return false;
+                }
+                sum += times[i];
+                if (rss_kb > workload->peak_rss_kb) {
+                        workload->peak_rss_kb = rss_kb;
+                }
+        }
+
+        double mean = sum / runs;
+        double squares = 0;
+        for (int i = 0; i < runs; i++) {
+                squares += (times[i] - mean) * (times[i] - mean);
+        }
+
+        workload->wall_ms = mean;
+        workload->ci_ms = t_value(runs - 1) * sqrt(squares / (runs - 1)) /
+                          sqrt(runs);
+        return true;
+}
+
+
+/* FUNCTION:    run_once
+ * Purpose:     run the um on a program once
+ * Arg:         um: the um executable
+ *              stats: an option to give the um before the program, or NULL
+ *              workload: the program and its input
+ *              wall_ms: set to the wall time of the run, unless NULL
+ *              rss_kb: set to the peak resident set size, unless NULL
+ *              instructions: set to the instructions retired, read from
+ *                            the --stats report on stderr, unless NULL
+ * Returns:     false if the um could not be run or did not exit with
+ *              success
+ * Effect:      The program's output is thrown away
+ * Error:       N/A
+ */
+static bool run_once(const char *um, const char *stats,
+                     const Workload *workload, double *wall_ms,
+                     long *rss_kb, uint64_t *instructions)
+{
+        int report[2];
+        if (instructions != NULL && pipe(report) != 0) {
+                return false;
+        }
+
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        pid_t child = fork();
+        if (child == 0) {
+                int input = open(workload->input, O_RDONLY);
+                int output = open("/dev/null", O_WRONLY);
+                if (input < 0 || output < 0) {
+                        _exit(127);
+                }
+                dup2(input, STDIN_FILENO);
+                dup2(output, STDOUT_FILENO);
+                if (instructions != NULL) {
+                        dup2(report[1], STDERR_FILENO);
+                        close(report[0]);
+                }
+                if (stats != NULL) {
+                        execl(um, um, stats, workload->file, (char *)NULL);
+                } else {
+                        execl(um, um, workload->file, (char *)NULL);
+                }
+                _exit(127);
+        } else if (child < 0) {
+                return false;
+        }
+
+        /* the report is read before waiting, so a full pipe cannot stall */
+        char text[8192] = "";
+        if (instructions != NULL) {
+                close(report[1]);
+                size_t length = 0;
+                ssize_t got;
+                while ((got = read(report[0], text + length,
+                                   sizeof(text) - 1 - length)) > 0) {
+                        length += got;
+                }
+                text[length] = '\0';
+                close(report[0]);
+        }
+
+        int status;
+        struct rusage resources;
+        if (wait4(child, &status, 0, &resources) != child) {
+                return false;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+        if (wall_ms != NULL) {
+                *wall_ms = (stop.tv_sec - start.tv_sec) * 1000.0 +
+                           (stop.tv_nsec - start.tv_nsec) / 1e6;
+        }
+        if (rss_kb != NULL) {
+                *rss_kb = resources.ru_maxrss;
+        }
+        if (instructions != NULL) {
+                const char *line = strstr(text, "um stats: ");
+                if (line == NULL) {
+                        return false;
+                }
+                *instructions = strtoull(line + strlen("um stats: "), NULL,
+                                         10);
+        }
+
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+/* FUNCTION:    t_value
+ * Purpose:     get the two-sided 95% critical value of Student's t
+ * Arg:         degrees: the degrees of freedom, at least 1
+ * Returns:     the critical value, or the normal one past 30 degrees
+ * Effect:      N/A
+ * Error:       N/A
+ */
+static double t_value(int degrees)
+{
+        static const double table[30] = {
+                12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+                2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+                2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+                2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+        };
+
+        return (degrees <= 30) ? table[degrees - 1] : 1.960;
+}
+
+
+/* FUNCTION:    read_baseline
+ * Purpose:     find a program's mean wall time in a baseline
+ * Arg:         file_name: a baseline written by write_baseline
+ *              name: the program's name
+ *              wall_ms: set to its mean wall time
+ * Returns:     false if the file cannot be read or has no such program
+ * Effect:      Only reads the layout write_baseline writes, not JSON in
+ *              general
+ * Error:       N/A
+ */
+static bool read_baseline(const char *file_name, const char *name,
+                          double *wall_ms)
+{
+        FILE *input = fopen(file_name, "r");
+        if (input == NULL) {
+                return false;
+        }
+
+        char key[80];
+        snprintf(key, sizeof(key), "\"%s\":", name);
+
+        char line[512];
+        bool found = false;
+        while (!found && fgets(line, sizeof(line), input) != NULL) {
+                const char *at = strstr(line, key);
+                const char *wall = (at == NULL) ? NULL :
+                                   strstr(at, "\"wall_ms\":");
+                if (wall != NULL) {
+                        *wall_ms = strtod(wall + strlen("\"wall_ms\":"),
+                                          NULL);
+                        found = *wall_ms > 0;
+                }
+        }
+
+        fclose(input);
+        return found;
+}
+
+
+/* FUNCTION:    write_baseline
+ * Purpose:     write the results as a JSON baseline
+ * Arg:         file_name: where to write it
+ *              workloads, count: the results
+ *              runs: the runs each result is the mean of
+ * Returns:     false if the file cannot be written
+ * Effect:      Writes one line per program, which read_baseline relies on
+ * Error:       N/A
+ */
+static bool write_baseline(const char *file_name, const Workload *workloads,
+                           int count, int runs)
+{
+        FILE *output = fopen(file_name, "w");
+        if (output == NULL) {
+                return false;
+        }
+
+        fprintf(output, "{\n  \"runs\": %d,\n  \"programs\": {\n", runs);
+        for (int i = 0; i < count; i++) {
+                const Workload *workload = &workloads[i];
+                fprintf(output, "    \"%s\": { \"wall_ms\": %.3f, "
+                                "\"ci_ms\": %.3f, \"instructions\": %llu, "
+                                "\"peak_rss_kb\": %ld }%s\n",
+                        workload->name, workload->wall_ms, workload->ci_ms,
+                        (unsigned long long)workload->instructions,
+                        workload->peak_rss_kb, (i < count - 1) ? "," : "");
+        }
+        fprintf(output, "  }\n}\n");
+
+        return fclose(output) == 0;
+}
@@ -642,4 +642,149 @@ void run_500k_times(Seq_T stream)
         append(stream, load_prog(r1, r7));
 
         append(stream, halt());
-}
\ No newline at end of file
+}
+
+void build_prog_load_cow(Seq_T stream)
+{
+        /* map a segment of size 22 */
+        append(stream, loadval(r1, 22));
+        append(stream, map_seg(r2, r1));
+
+        /* copy the 22 words from index 19 onwards into the new segment,
+           from the last word down to the first. r3 = -1 */
+        append(stream, loadval(r1, 40));
+        append(stream, loadval(r5, 21));
+        append(stream, nand(r3, r0, r0));
+
+        /* line 5: r7 = mem[0][r1], mem[r2][r5] = r7 */
+        append(stream, seg_load(r7, r0, r1));
+        append(stream, seg_store(r2, r5, r7));
+
+        /* stop once the word at index 0 has been copied */
+        append(stream, loadval(r7, 15));
+        append(stream, loadval(r4, 11));
+        append(stream, cond_move(r7, r4, r5));
+        append(stream, load_prog(r0, r7));
+
+        /* line 11: decrement both indices and go back to line 5 */
+        append(stream, add(r1, r1, r3));
+        append(stream, add(r5, r5, r3));
+        append(stream, loadval(r7, 5));
+        append(stream, load_prog(r0, r7));
+
+        /* line 15: r4 and r5 index the two data words, run the copy */
+        append(stream, loadval(r4, 20));
+        append(stream, loadval(r5, 21));
+        append(stream, loadval(r6, 0));
+        append(stream, load_prog(r2, r6));
+
+        /* line 19, copied to the new segment: a store to the loaded
+           segment must not show up in segment 0 and the other way round */
+        append(stream, loadval(r3, 'B'));
+        append(stream, seg_store(r2, r4, r3));
+        append(stream, seg_load(r7, r0, r4));
+        append(stream, output(r7));
+        append(stream, seg_store(r0, r5, r3));
+        append(stream, seg_load(r7, r2, r5));
+        append(stream, output(r7));
+        append(stream, seg_load(r7, r0, r5));
+        append(stream, output(r7));
+
+        /* load the segment again and store to segment 0 first this time */
+        append(stream, loadval(r6, 12));
+        append(stream, load_prog(r2, r6));
+        append(stream, halt());
+        append(stream, loadval(r3, 'C'));
+        append(stream, seg_store(r0, r4, r3));
+        append(stream, seg_load(r7, r2, r4));
+        append(stream, output(r7));
+        append(stream, seg_load(r7, r0, r4));
+        append(stream, output(r7));
+        append(stream, halt());
+        append(stream, halt());
+
+        /* the two data words */
+        append(stream, 'A');
+        append(stream, 'A');
+}
+
+void build_fused_store(Seq_T stream)
+{
+        /* two LVs in a row, then line 2: LV and OUT of a constant */
+        append(stream, loadval(r6, 13));
+        append(stream, loadval(r2, 'B'));
+        append(stream, loadval(r1, 'A'));
+        append(stream, output(r1));
+
+        /* conditional branch: to line 13 once r3 is set, else line 7 */
+        append(stream, loadval(r7, 7));
+        append(stream, cond_move(r7, r6, r3));
+        append(stream, load_prog(r0, r7));
+
+        /* line 7: store output(r2) over the output at line 3, which breaks
+           the LV and OUT apart, set r3 and jump back to line 2 */
+        append(stream, loadval(r4, 14));
+        append(stream, seg_load(r5, r0, r4));
+        append(stream, loadval(r3, 3));
+        append(stream, seg_store(r0, r3, r5));
+        append(stream, loadval(r7, 2));
+        append(stream, load_prog(r0, r7));
+
+        /* line 13 */
+        append(stream, halt());
+
+        /* the data word */
+        append(stream, output(r2));
+}
+
+void build_store_blocks(Seq_T stream)
+{
+        /* LVs to move where the stores start in the JIT's code cache */
+        for (int i = 0; i < 100; i++) {
+                append(stream, loadval(r7, 0));
+        }
+
+        /* map segment 1 and store into it 107,000 times in a row, so the
+           full blocks of stores fill the code cache and it is flushed */
+        append(stream, loadval(r3, 8));
+        append(stream, map_seg(r1, r3));
+        append(stream, loadval(r2, 5));
+        append(stream, loadval(r3, 'A'));
+        for (int i = 0; i < 107000; i++) {
+                append(stream, seg_store(r1, r2, r3));
+        }
+
+        append(stream, seg_load(r4, r1, r2));
+        append(stream, output(r4));
+        append(stream, halt());
+}
+
+void build_bad_segment_id(Seq_T stream)
+{
+        /* a load from the largest ID an LV can make, far past the end of
+           the segment table */
+        append(stream, loadval(r1, 0x1ffffff));
+        append(stream, loadval(r2, 0));
+        append(stream, seg_load(r3, r1, r2));
+        append(stream, halt());
+}
+
+void build_bad_load_chain(Seq_T stream)
+{
+        /* map a segment large enough to be guarded */
+        append(stream, loadval(r3, 20000));
+        append(stream, map_seg(r1, r3));
+
+        /* blocks at lines 4, 6 and 8, each reached by a jump */
+        append(stream, loadval(r2, 4));
+        append(stream, load_prog(r0, r2));
+        append(stream, loadval(r2, 6));
+        append(stream, load_prog(r0, r2));
+        append(stream, loadval(r2, 8));
+        append(stream, load_prog(r0, r2));
+
+        /* line 8: a load past the end of the segment at line 9 */
+        append(stream, loadval(r5, 30000));
+        append(stream, seg_load(r4, r1, r5));
+        append(stream, halt());
+}
@@ -42,6 +42,11 @@ extern void build_seg_load          (Seq_T stream);
 extern void build_seg_storeload     (Seq_T stream);
 extern void build_prog_load         (Seq_T stream);
 extern void run_500k_times          (Seq_T stream);
+extern void build_prog_load_cow     (Seq_T stream);
+extern void build_fused_store       (Seq_T stream);
+extern void build_store_blocks      (Seq_T stream);
+extern void build_bad_segment_id    (Seq_T stream);
+extern void build_bad_load_chain    (Seq_T stream);
 
 
 
@@ -97,6 +102,11 @@ static struct test_info {
         { "load_prog", NULL, "2", build_prog_load },
 
         { "run_500k", NULL, "", run_500k_times },
+        { "load_prog_cow", NULL, "AABBC", build_prog_load_cow },
+        { "fused_store", NULL, "AB", build_fused_store },
+        { "store_blocks", NULL, "A", build_store_blocks },
+        { "bad_segment_id", NULL, "", build_bad_segment_id },
+        { "bad_load_chain", NULL, "", build_bad_load_chain },
 };
 
   
@@ -0,0 +1,96 @@
+/*****************************************************************************
+ *
+ *                                   umn.c
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the private implementation of our native image module. The
+ *     checksum keeps two 64-bit running sums, of the words and of the
+ *     first sum, which is two additions a word and still catches words
+ *     that trade places. This module is exported to our operations module
+ *     and to um2umn.
+ *
+ *
+ ****************************************************************************/
+
+#include "umn.h"
+#include <assert.h>
+
+/* FUNCTION:    Umn_checksum
+ * Purpose:     compute the checksum kept in a .umn header
+ * Arg:         words: the program's words, in host byte order
+ *              num_words: how many there are
+ * Returns:     a Fletcher-style sum of the words, which changes if any word
+ *              changes or two words trade places
+ * Effect:      N/A
+ * Exported to: Operation module and um2umn
+ * Error:       Checked runtime error if words is NULL and num_words is not 0
+ */
+uint32_t Umn_checksum(const uint32_t *words, uint32_t num_words)
+{
+        assert(words != NULL || num_words == 0);
+
+        uint64_t sum = 0, sum_of_sums = 0;
+        for (uint32_t i = 0; i < num_words; i++) {
+                sum += words[i];
+                sum_of_sums += sum;
+        }
+
+        return (uint32_t)(sum ^ (sum >> 32)) ^
+               (uint32_t)(sum_of_sums ^ (sum_of_sums >> 32)) * 0x9e3779b1u;
+}
+
+
+/* FUNCTION:    Umn_valid
+ * Purpose:     check that bytes are a whole .umn image
+ * Arg:         bytes: the contents of the file, aligned for words
+ *              num_bytes: how many there are
+ * Returns:     true if the header has the magic and the version, the size
+ *              is exactly the header and its words, and the checksum
+ *              matches
+ * Effect:      N/A
+ * Exported to: Operation module: used before running a .umn image
+ * Error:       Checked runtime error if bytes is NULL
+ */
+bool Umn_valid(const void *bytes, size_t num_bytes)
+{
+        assert(bytes != NULL);
+
+        const Umn_header *header = bytes;
+        if (num_bytes < sizeof(*header) || header->magic != UMN_MAGIC ||
+            header->version != UMN_VERSION ||
+            (num_bytes - sizeof(*header)) / sizeof(uint32_t) !=
+            header->num_words ||
+            (num_bytes - sizeof(*header)) % sizeof(uint32_t) != 0) {
+                return false;
+        }
+
+        const uint32_t *words = (const uint32_t *)(header + 1);
+        return Umn_checksum(words, header->num_words) == header->checksum;
+}
+
+
+/* FUNCTION:    Umn_write
+ * Purpose:     write a program as a .umn image
+ * Arg:         out: an open file to write to
+ *              words: the program's words, in host byte order
+ *              num_words: how many there are
+ * Returns:     false if a write failed
+ * Effect:      N/A
+ * Exported to: um2umn
+ * Error:       Checked runtime error if out is NULL, or words is NULL and
+ *              num_words is not 0
+ */
+bool Umn_write(FILE *out, const uint32_t *words, uint32_t num_words)
+{
+        assert(out != NULL);
+        assert(words != NULL || num_words == 0);
+
+        Umn_header header = { UMN_MAGIC, UMN_VERSION, num_words,
+                              Umn_checksum(words, num_words), { 0, 0, 0, 0 } };
+
+        return fwrite(&header, sizeof(header), 1, out) == 1 &&
+               fwrite(words, sizeof(*words), num_words, out) == num_words;
+}
@@ -0,0 +1,93 @@
+/*****************************************************************************
+ *
+ *                                   umn.h
+ *
+ *     Authors:    Eric Zhao, Leo Kim
+ *     Date:       November 21, 2022
+ *
+ *     Summary:
+ *     This is the public interface of our native image module. A .umn file
+ *     holds the same program as a .um file, but with its words already in
+ *     host byte order behind a header of eight words, so the loader can map
+ *     the file and use the words where they are instead of converting each
+ *     one. The words start 32 bytes into the file, and the last three header
+ *     words are zero in the file and left to the loader for its own
+ *     bookkeeping. This module is exported to our operations module and to
+ *     um2umn, the converter.
+ *
+ *
+ ****************************************************************************/
+
+#ifndef UM_UMN_INCLUDED
+#define UM_UMN_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* the first word of a .umn file, "UMn1" as bytes on a little-endian host,
+   so a file from a host of the other byte order is not mistaken for one */
+#define UMN_MAGIC 0x316e4d55
+
+/* the version of the format written by Umn_write */
+#define UMN_VERSION 1
+
+/*
+ * the header of a .umn file:
+ *      magic: UMN_MAGIC
+ *      version: UMN_VERSION
+ *      num_words: the number of words in the program
+ *      checksum: Umn_checksum of the words
+ *      reserved: zero in the file; the loader's private copy of the last
+ *                three is used by the memory module
+ */
+typedef struct Umn_header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t num_words;
+        uint32_t checksum;
+        uint32_t reserved[4];
+} Umn_header;
+
+/* FUNCTION:    Umn_checksum
+ * Purpose:     compute the checksum kept in a .umn header
+ * Arg:         words: the program's words, in host byte order
+ *              num_words: how many there are
+ * Returns:     a Fletcher-style sum of the words, which changes if any word
+ *              changes or two words trade places
+ * Effect:      N/A
+ * Exported to: Operation module and um2umn
+ * Error:       Checked runtime error if words is NULL and num_words is not 0
+ */
+uint32_t Umn_checksum(const uint32_t *words, uint32_t num_words);
+
+
+/* FUNCTION:    Umn_valid
+ * Purpose:     check that bytes are a whole .umn image
+ * Arg:         bytes: the contents of the file, aligned for words
+ *              num_bytes: how many there are
+ * Returns:     true if the header has the magic and the version, the size
+ *              is exactly the header and its words, and the checksum
+ *              matches
+ * Effect:      N/A
+ * Exported to: Operation module: used before running a .umn image
+ * Error:       Checked runtime error if bytes is NULL
+ */
+bool Umn_valid(const void *bytes, size_t num_bytes);
+
+
+/* FUNCTION:    Umn_write
+ * Purpose:     write a program as a .umn image
+ * Arg:         out: an open file to write to
+ *              words: the program's words, in host byte order
+ *              num_words: how many there are
+ * Returns:     false if a write failed
+ * Effect:      N/A
+ * Exported to: um2umn
+ * Error:       Checked runtime error if out is NULL, or words is NULL and
+ *              num_words is not 0
+ */
+bool Umn_write(FILE *out, const uint32_t *words, uint32_t num_words);
+
+#endif